@@ -0,0 +1,123 @@
+#pragma once
+
+#include <Arduino.h>
+#include "RotationEstimator.h"
+#include "Telemetry.h"
+#include "TurretConfig.h"
+
+#define BARREL_CHAMBER_ANGLE 60   // Degrees the barrel turns to fire one dart
+
+// Keeps count of the darts left in the barrel and paces bursts. It lives in TurretHardware, so the count
+// carries over when switching programs. It doesn't move the roll servo itself: programs call Fire() for
+// every shot they queue and turn the barrel for TurnTime( 1 ).
+class Barrel
+{
+public:
+   Barrel( RotationEstimator& rollRotation )
+      : rotation( rollRotation )
+   {
+   }
+
+   // Darts that haven't been fired yet
+   uint8_t Loaded() const
+   {
+      return BARREL_CHAMBERS - fired;
+   }
+
+   bool IsEmpty() const
+   {
+      return fired >= BARREL_CHAMBERS;
+   }
+
+   // Chamber (0 to BARREL_CHAMBERS - 1) the next dart is fired from, counting from where the barrel was last reloaded
+   uint8_t NextChamber() const
+   {
+      return fired % BARREL_CHAMBERS;
+   }
+
+   // Counts a shot. Returns false without counting it if the barrel is empty, in which case the barrel
+   // shouldn't be turned. EVENT_BARREL_EMPTY is sent over Serial (see EventFrame) when the last dart goes and
+   // for every shot after that.
+   bool Fire()
+   {
+      if ( IsEmpty() )
+      {
+         burstShots = 0;
+         SendEvent( EVENT_BARREL_EMPTY );
+         return false;
+      }
+
+      fired++;
+
+      if ( IsEmpty() )
+      {
+         burstShots = 0;
+         SendEvent( EVENT_BARREL_EMPTY );
+      }
+      return true;
+   }
+
+   // Call once every chamber has been loaded again
+   void Reload()
+   {
+      fired = 0;
+   }
+
+   // Time (ms) it takes to turn the barrel by chambers at config.rollMoveSpeed. Uses the speed measured by the
+   // calibration program when it has been run, otherwise config.rollPrecision for every chamber.
+   uint16_t TurnTime( uint8_t chambers ) const
+   {
+      if ( rotation.IsCalibrated() )
+      {
+         return rotation.TurnTime( chambers * BARREL_CHAMBER_ANGLE, config.rollStopSpeed + config.rollMoveSpeed );
+      }
+      return (uint32_t)config.rollPrecision * chambers;
+   }
+
+   // Starts a burst of up to shots darts (however many are left), one every interval ms. An interval shorter
+   // than TurnTime( 1 ) (e.g. 0) keeps the barrel turning until the burst is done. Returns false if the
+   // barrel is empty, which is reported like Fire().
+   bool StartBurst( uint8_t shots, uint16_t interval, unsigned long now )
+   {
+      if ( IsEmpty() )
+      {
+         return Fire();
+      }
+
+      burstShots = min( shots, Loaded() );
+      burstInterval = interval;
+      nextShotTime = now;
+      return true;
+   }
+
+   void StopBurst()
+   {
+      burstShots = 0;
+   }
+
+   bool IsBursting() const
+   {
+      return burstShots > 0;
+   }
+
+   // Returns true once for every shot of a burst when it is due. The caller fires it, which calls Fire().
+   bool BurstShotDue( unsigned long now )
+   {
+      if ( burstShots == 0 || (long)(now - nextShotTime) < 0 )
+      {
+         return false;
+      }
+
+      burstShots--;
+      nextShotTime += burstInterval; // From when the last shot was due, so a late Loop() doesn't slow the burst down
+      return true;
+   }
+
+private:
+   RotationEstimator& rotation;
+   uint8_t fired = 0; // Darts fired since the last reload
+
+   uint8_t burstShots = 0; // Shots of the burst still to fire
+   uint16_t burstInterval = 0;
+   unsigned long nextShotTime = 0;
+};
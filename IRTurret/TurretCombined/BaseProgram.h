@@ -1,10 +1,31 @@
 #pragma once
 
+#include <Arduino.h>
+
 class BaseProgram
 {
 public:
+   virtual ~BaseProgram() {}
+
    virtual void Setup() = 0;
    virtual void Loop( uint16_t cmd ) = 0;
+
+   // Called instead of Loop() for the NEC repeat frames the remote sends every ~110ms while a button is
+   // held down. A repeat is handled like another press of the button unless a program overrides this.
+   virtual void LoopRepeat( uint16_t cmd )
+   {
+      Loop( cmd );
+   }
    virtual bool CanShutdown() = 0;
+
+   // Return true to have ok and star throw away the direction buttons that are still waiting in the IR
+   // queue (see IrCommandQueue::Push()). Only worth it when those buttons aim what ok is about to fire.
+   virtual bool PreemptsAim()
+   {
+      return false;
+   }
+
+   // Can be called even when CanShutdown() is false if the program is being switched away from
+   // preemptively, so it has to cancel anything that is still moving.
    virtual void Shutdown() = 0;
 };
\ No newline at end of file
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <Arduino.h>
+#include "TurretConfig.h"
+
+#define CONSOLE_LINE_SIZE 24 // Longest command line that can be typed into the config console
+
+// Names of the config values that can be changed over Serial, in the same order as configFieldOffsets
+const char configFieldNames[] PROGMEM =
+   "yawPin pitchPin rollPin yawStopSpeed rollStopSpeed pitchHomeAngle "
+   "pitchMin pitchMax pitchMoveSpeed yawMoveSpeed rollMoveSpeed yawPrecision rollPrecision recoilAmount recoilRiseTime recoilDecayTime burstSize burstInterval "
+   "rollMinSpeed rollMaxSpeed yawMinSpeed yawMaxSpeed yawTurnSpeed pitchMinAngle pitchMaxAngle pitchMaxSpeed";
+
+#define CONFIG_FIELD_WORD 0x80 // Set on an offset in configFieldOffsets when the value is a uint16_t
+
+const uint8_t configFieldOffsets[] PROGMEM =
+{
+   offsetof( TurretConfig, yawPin ),
+   offsetof( TurretConfig, pitchPin ),
+   offsetof( TurretConfig, rollPin ),
+   offsetof( TurretConfig, yawStopSpeed ),
+   offsetof( TurretConfig, rollStopSpeed ),
+   offsetof( TurretConfig, pitchHomeAngle ),
+   offsetof( TurretConfig, pitchMin ),
+   offsetof( TurretConfig, pitchMax ),
+   offsetof( TurretConfig, pitchMoveSpeed ),
+   offsetof( TurretConfig, yawMoveSpeed ),
+   offsetof( TurretConfig, rollMoveSpeed ),
+   offsetof( TurretConfig, yawPrecision ) | CONFIG_FIELD_WORD,
+   offsetof( TurretConfig, rollPrecision ) | CONFIG_FIELD_WORD,
+   offsetof( TurretConfig, recoilAmount ),
+   offsetof( TurretConfig, recoilRiseTime ) | CONFIG_FIELD_WORD,
+   offsetof( TurretConfig, recoilDecayTime ) | CONFIG_FIELD_WORD,
+   offsetof( TurretConfig, burstSize ),
+   offsetof( TurretConfig, burstInterval ) | CONFIG_FIELD_WORD,
+   offsetof( TurretConfig, rollMinSpeed ),
+   offsetof( TurretConfig, rollMaxSpeed ),
+   offsetof( TurretConfig, yawMinSpeed ),
+   offsetof( TurretConfig, yawMaxSpeed ),
+   offsetof( TurretConfig, yawTurnSpeed ) | CONFIG_FIELD_WORD,
+   offsetof( TurretConfig, pitchMinAngle ),
+   offsetof( TurretConfig, pitchMaxAngle ),
+   offsetof( TurretConfig, pitchMaxSpeed ) | CONFIG_FIELD_WORD,
+};
+
+// Lets the config be viewed and changed by typing lines into the Serial monitor (115200 baud, newline ending):
+//   config          Prints every value
+//   <name> <value>  Changes a value, e.g. "pitchMax 160". Replies ? if the value doesn't fit in the field.
+//   save            Saves the values to EEPROM so they are used from now on. Replies ? instead if they conflict
+//                   with each other (see TurretConfig::IsValid()).
+//   defaults        Goes back to the built in values (until saved)
+// Characters are handed over one at a time as they arrive from loop(), so typing never blocks the turret.
+class ConfigConsole
+{
+public:
+   void Receive( char c )
+   {
+      if ( c == '\n' || c == '\r' )
+      {
+         if ( length > 0 )
+         {
+            line[length] = '\0';
+            RunCommand();
+            length = 0;
+         }
+      }
+      else if ( length < CONSOLE_LINE_SIZE - 1 )
+      {
+         line[length++] = c;
+      }
+   }
+
+private:
+   char line[CONSOLE_LINE_SIZE];
+   uint8_t length = 0;
+
+   void RunCommand()
+   {
+      if ( strcmp_P( line, PSTR( "config" ) ) == 0 )
+      {
+         for ( uint8_t i = 0; i < sizeof( configFieldOffsets ); i++ )
+         {
+            PrintField( i );
+         }
+      }
+      else if ( strcmp_P( line, PSTR( "save" ) ) == 0 )
+      {
+         // Values that conflict with each other (e.g. pitchMin above pitchMax) would be loaded on every boot
+         if ( !config.IsValid() )
+         {
+            Serial.println( F( "?" ) );
+            return;
+         }
+
+         config.Save();
+         Serial.println( F( "saved" ) );
+      }
+      else if ( strcmp_P( line, PSTR( "defaults" ) ) == 0 )
+      {
+         config.SetDefaults();
+         Serial.println( F( "defaults" ) );
+      }
+      else
+      {
+         char* value = strchr( line, ' ' );
+         int8_t field = -1;
+
+         if ( value != nullptr )
+         {
+            *value++ = '\0';
+            field = FindField( line );
+         }
+
+         if ( field < 0 )
+         {
+            Serial.println( F( "?" ) );
+            return;
+         }
+
+         uint8_t offset = pgm_read_byte( configFieldOffsets + field );
+         uint8_t* address = (uint8_t*)&config + (offset & ~CONFIG_FIELD_WORD);
+         char* end;
+         long number = strtol( value, &end, 10 );
+
+         // Values that aren't a whole number or don't fit in the field are refused instead of being cut down
+         if ( end == value || *end != '\0' || number < 0 || number > ((offset & CONFIG_FIELD_WORD) ? 0xFFFFL : 0xFFL) )
+         {
+            Serial.println( F( "?" ) );
+            return;
+         }
+
+         if ( offset & CONFIG_FIELD_WORD )
+         {
+            *(uint16_t*)address = number;
+         }
+         else
+         {
+            *address = number;
+         }
+
+         PrintField( field );
+      }
+   }
+
+   // Index of a field in configFieldOffsets, -1 if there isn't one with that name
+   int8_t FindField( const char* name )
+   {
+      uint8_t nameLength = strlen( name );
+      const char* names = configFieldNames;
+
+      for ( int8_t i = 0; i < (int8_t)sizeof( configFieldOffsets ); i++ )
+      {
+         const char* end = strchr_P( names, ' ' );
+         uint8_t fieldLength = end != nullptr ? end - names : strlen_P( names );
+
+         if ( fieldLength == nameLength && strncmp_P( name, names, nameLength ) == 0 )
+         {
+            return i;
+         }
+
+         names += fieldLength + 1;
+      }
+
+      return -1;
+   }
+
+   void PrintField( uint8_t field )
+   {
+      const char* names = configFieldNames;
+      for ( uint8_t i = 0; i < field; i++ )
+      {
+         names = strchr_P( names, ' ' ) + 1;
+      }
+
+      for ( char c = pgm_read_byte( names ); c != ' ' && c != '\0'; c = pgm_read_byte( ++names ) )
+      {
+         Serial.print( c );
+      }
+
+      uint8_t offset = pgm_read_byte( configFieldOffsets + field );
+      const uint8_t* address = (const uint8_t*)&config + (offset & ~CONFIG_FIELD_WORD);
+
+      Serial.print( '=' );
+      if ( offset & CONFIG_FIELD_WORD )
+      {
+         Serial.println( *(const uint16_t*)address );
+      }
+      else
+      {
+         Serial.println( *address );
+      }
+   }
+};
+
+ConfigConsole configConsole;
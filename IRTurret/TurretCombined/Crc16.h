@@ -0,0 +1,14 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Updates a CRC-16/CCITT with one byte. Start from 0xFFFF.
+inline uint16_t Crc16( uint16_t crc, uint8_t data )
+{
+   crc ^= (uint16_t)data << 8;
+   for ( uint8_t i = 0; i < 8; i++ )
+   {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+   }
+   return crc;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <Arduino.h>
+
+#ifndef DANCE_BENCHMARK
+#define DANCE_BENCHMARK 0 // Set to 1 to measure the dance controllers and print a report over Serial after every routine
+#endif
+
+#if DANCE_BENCHMARK
+
+// Measurements for one servo controller over a dance routine
+// ticks: Number of times Update() was called
+// totalMicros/maxMicros: Time spent inside Update(). A tick is often shorter than micros() can tell apart,
+//    but it reads 1 as often as the tick crosses a microsecond, so the average still comes out right.
+// servoWrites: Number of times the servo was written to
+// maxStep: Biggest change in the value written to the servo from one write to the next (speed for roll/yaw, degrees for pitch)
+// moves/totalDrift/maxDrift: How late (ms) each move ended compared to when it should have ended based on the routine start
+struct DanceStats
+{
+   uint32_t ticks;
+   uint32_t totalMicros;
+   uint16_t maxMicros;
+   uint16_t servoWrites;
+   uint8_t maxStep;
+   uint16_t moves;
+   int32_t totalDrift;
+   int16_t maxDrift;
+
+   void Reset()
+   {
+      memset( this, 0, sizeof( DanceStats ) );
+   }
+
+   void AddTick( unsigned long micros )
+   {
+      ticks++;
+      totalMicros += micros;
+      maxMicros = max( maxMicros, (uint16_t)min( micros, 0xFFFFUL ) );
+   }
+
+   void AddWrite( uint8_t oldValue, uint8_t newValue )
+   {
+      servoWrites++;
+      maxStep = max( maxStep, (uint8_t)abs( (int)newValue - oldValue ) );
+   }
+
+   void AddMoveEnd( long drift )
+   {
+      moves++;
+      totalDrift += drift;
+      if ( moves == 1 || drift > maxDrift )
+      {
+         maxDrift = drift;
+      }
+   }
+
+   static void PrintTenths( unsigned long tenths )
+   {
+      Serial.print( tenths / 10 );
+      Serial.print( '.' );
+      Serial.print( tenths % 10 );
+   }
+
+   void Print( const __FlashStringHelper* name )
+   {
+      Serial.print( name );
+      Serial.print( F( " ticks=" ) );
+      Serial.print( ticks );
+      Serial.print( F( " avgUs=" ) );
+      PrintTenths( ticks > 0 ? totalMicros * 10 / ticks : 0 );
+      Serial.print( F( " maxUs=" ) );
+      Serial.print( maxMicros );
+      Serial.print( F( " writes=" ) );
+      Serial.print( servoWrites );
+      Serial.print( F( " maxStep=" ) );
+      Serial.print( maxStep );
+      Serial.print( F( " moves=" ) );
+      Serial.print( moves );
+      Serial.print( F( " avgDriftMs=" ) );
+      Serial.print( moves > 0 ? totalDrift / (long)moves : 0 );
+      Serial.print( F( " maxDriftMs=" ) );
+      Serial.println( maxDrift );
+   }
+};
+
+#endif
@@ -1,56 +1,471 @@
+#pragma once
+
+#include <Arduino.h>
+#include "DanceStream.h"
+
+// How a move speeds up and slows down
+enum class MotionProfile : uint8_t
+{
+   Constant,  // Jumps straight to the speed of the move and stops instantly
+   Trapezoid, // Speeds up and slows down at a fixed acceleration
+   SCurve     // Like Trapezoid, but the acceleration is also ramped up and down (limited by jerk)
+};
+
+// A dance move after it has been decoded from a routine. Controllers keep only the
+// move that is currently playing in RAM.
+// profile/acceleration/jerk: Set by the last DANCE_PROFILE before the move (see below)
+// plannedSpeed: Speed of a pitch move worked out by the routine compiler, if hasPlannedSpeed (see DANCE_SPEED)
 struct DanceMove
 {
 public:
    uint16_t duration;
    int8_t speed;
-   bool started = false;
-   bool isWaitMove = false;
+   bool isWaitMove;
+   MotionProfile profile;
+   uint8_t acceleration; // Steps of DANCE_ACCEL_UNIT
+   uint8_t jerk;         // Steps of DANCE_JERK_UNIT
+   bool hasPlannedSpeed;
+   int16_t plannedSpeed; // Degrees/ms in fixed point with 16 fraction bits (ANGLE_FRACTION_BITS)
 };
 
 // Dance move for rotating roll and yaw servos
-// You can assign a duration and speed
 // Duration is milliseconds
-// Speed is from 0-1
-// You can also use the other constructor to define a duration to wait for
+// Speed is from -100 to 100
 struct DanceSpeedMove : DanceMove
 {
-public:
-   DanceSpeedMove() {}
-
-   DanceSpeedMove( uint16_t dur, int8_t spd )
-   {
-      duration = dur;
-      speed = max( -100, min( spd, 100 ) );
-   }
-
-   DanceSpeedMove( uint16_t dur )
-   {
-      duration = dur;
-      isWaitMove = true;
-   }
 };
 
 // Dance move for rotating pitch servo
-// You can assign a target angle and duration
 // Target angle (degrees) is the angle you want to end up at
 // Duration is milliseconds
-// You can also use the other constructor to define a duration to wait for
 struct DanceAngleMove : DanceMove
 {
 public:
    uint8_t targetAngle;
+};
+
+// Routines are stored as packed bytes in a constexpr uint8_t PROGMEM array. The top 2 bits of the
+// first byte of each entry say what it is:
+//   Wait:       2 bytes [00 | duration high 6 bits] [duration low 8 bits]
+//   Move:       3 bytes [01 | duration high 6 bits] [duration low 8 bits] [speed or angle]
+//   Repeat:     1 byte  [10 | count 6 bits] - plays everything up to the matching end count times
+//   End repeat: 1 byte  [11 | 000000]
+//   Speed:      3 bytes [11 | 000001] [speed low 8 bits] [speed high 8 bits] - speed of the pitch move right after it
+//   Profile:    3 bytes [11 | 1 | profile 5 bits] [acceleration] [jerk] - applies to every move after it
+// Durations are stored in steps of DANCE_TIME_UNIT ms. Repeats are expanded while playing, so a
+// phrase that is repeated only takes up space once. Moves use MotionProfile::Constant until a
+// profile is set. Durations can be given in beats of a tempo with DanceBeats(). Build routines
+// with the macros below, e.g.
+//   constexpr uint8_t yawMoves[] PROGMEM = { DANCE_WAIT( 4000 ), DANCE_REPEAT( 14 ), DANCE_MOVE( 100, 80 ), DANCE_MOVE( 100, -80 ), DANCE_END_REPEAT };
+//   constexpr uint8_t pitchMoves[] PROGMEM = { DANCE_PROFILE( MotionProfile::SCurve, 3000, 30000 ), DANCE_MOVE( 400, 120 ), DANCE_MOVE( 400, 80 ) };
+// Routines are constexpr so they can be checked when compiling with DANCE_CHECK_SPEEDS() and
+// DANCE_CHECK_ANGLES() below, and so that the length of each axis can be checked with DanceRoutineLength().
+// The built in routines are written as text choreographies in test/routines/ and turned into
+// DanceRoutines.h by the routine compiler (test/DanceCompiler.h), which also adds the DANCE_SPEED entries.
+
+#define DANCE_TIME_UNIT 10           // Milliseconds per duration step in a packed routine
+#define DANCE_MAX_REPEAT_DEPTH 3     // How many repeats can be nested inside each other
+#define DANCE_ACCEL_UNIT 50          // Degrees/sec^2 per acceleration step in a packed routine
+#define DANCE_JERK_UNIT 1000         // Degrees/sec^3 per jerk step in a packed routine
+
+#define DANCE_OP_MASK       0xC0
+#define DANCE_OP_WAIT       0x00
+#define DANCE_OP_MOVE       0x40
+#define DANCE_OP_REPEAT     0x80
+#define DANCE_OP_END_REPEAT 0xC0
+#define DANCE_OP_SPEED      0xC1
+#define DANCE_OP_PROFILE    0xE0
+
+// Only declared, so a routine with a duration that can't be stored exactly doesn't compile
+uint16_t DanceDurationMustBeAMultipleOfDanceTimeUnit();
+
+constexpr uint16_t DanceDurationSteps( uint16_t duration )
+{
+   return duration % DANCE_TIME_UNIT == 0 ? duration / DANCE_TIME_UNIT : DanceDurationMustBeAMultipleOfDanceTimeUnit();
+}
+
+// Only declared, so a profile with an acceleration or jerk that can't be stored doesn't compile
+uint8_t DanceAccelerationMustBeFrom50To12750();
+uint8_t DanceJerkMustBe0OrFrom1000To255000();
+
+// Acceleration (degrees/sec^2) in steps of DANCE_ACCEL_UNIT. It can't round down to 0 because a profiled
+// move that can't speed up never gets anywhere. MotionProfile::Constant doesn't use it.
+constexpr uint8_t DanceAccelerationSteps( MotionProfile profile, uint32_t acceleration )
+{
+   return profile == MotionProfile::Constant ? 0 :
+      acceleration >= DANCE_ACCEL_UNIT && acceleration / DANCE_ACCEL_UNIT <= 0xFF ? acceleration / DANCE_ACCEL_UNIT :
+      DanceAccelerationMustBeFrom50To12750();
+}
+
+// Jerk (degrees/sec^3) in steps of DANCE_JERK_UNIT. Only MotionProfile::SCurve uses it, where 0 ramps like a Trapezoid.
+constexpr uint8_t DanceJerkSteps( MotionProfile profile, uint32_t jerk )
+{
+   return profile != MotionProfile::SCurve ? 0 :
+      jerk == 0 || (jerk >= DANCE_JERK_UNIT && jerk / DANCE_JERK_UNIT <= 0xFF) ? jerk / DANCE_JERK_UNIT :
+      DanceJerkMustBe0OrFrom1000To255000();
+}
+
+// Duration (ms) of a number of beats at a tempo, rounded to the nearest DANCE_TIME_UNIT
+constexpr uint16_t DanceBeats( uint16_t beats, uint16_t beatsPerMinute )
+{
+   return ((uint32_t)beats * 60000UL + beatsPerMinute * DANCE_TIME_UNIT / 2) / ((uint32_t)beatsPerMinute * DANCE_TIME_UNIT) * DANCE_TIME_UNIT;
+}
+
+// Wait for duration ms (up to 65000) without moving
+#define DANCE_WAIT( duration ) \
+   (uint8_t)(DANCE_OP_WAIT | ((DanceDurationSteps( duration ) >> 8) & 0x3F)), (uint8_t)(DanceDurationSteps( duration ) & 0xFF)
+
+// Move for duration ms (up to 65000). value is the speed (-100 to 100) for roll/yaw or the target angle for pitch.
+#define DANCE_MOVE( duration, value ) \
+   (uint8_t)(DANCE_OP_MOVE | ((DanceDurationSteps( duration ) >> 8) & 0x3F)), (uint8_t)(DanceDurationSteps( duration ) & 0xFF), (uint8_t)(value)
+
+// Play everything up to the matching DANCE_END_REPEAT count (1-63) times
+#define DANCE_REPEAT( count ) (uint8_t)(DANCE_OP_REPEAT | ((count) & 0x3F))
+#define DANCE_END_REPEAT (uint8_t)DANCE_OP_END_REPEAT
+
+// Use profile (a MotionProfile) for the moves after this. acceleration is in degrees/sec^2
+// (50 to 12750) and jerk is in degrees/sec^3 (0 or 1000 to 255000, only used by MotionProfile::SCurve).
+#define DANCE_PROFILE( profile, acceleration, jerk ) \
+   (uint8_t)(DANCE_OP_PROFILE | (uint8_t)(profile)), DanceAccelerationSteps( profile, acceleration ), DanceJerkSteps( profile, jerk )
+
+// Play the pitch move right after this at speed (degrees/ms in fixed point with 16 fraction bits) instead of
+// working it out from where the servo is. It is only used if it is what working it out would give, so a
+// routine that starts somewhere else, or has its angles narrowed by config, still plays right.
+#define DANCE_SPEED( speed ) (uint8_t)DANCE_OP_SPEED, (uint8_t)((int16_t)(speed) & 0xFF), (uint8_t)(((int16_t)(speed) >> 8) & 0xFF)
+
+// Expands to the arguments SetDanceMoves() needs for a PROGMEM routine
+#define DANCE_MOVES( moveTable ) moveTable, sizeof( moveTable )
+
+// Bytes taken up by the entry that starts with op
+constexpr uint8_t DanceEntrySize( uint8_t op )
+{
+   return (op & DANCE_OP_PROFILE) == DANCE_OP_PROFILE || (op & DANCE_OP_MASK) == DANCE_OP_MOVE || op == DANCE_OP_SPEED ? 3 :
+      (op & DANCE_OP_MASK) == DANCE_OP_WAIT ? 2 : 1;
+}
+
+// The functions below walk a routine when compiling (they are far too slow to use while playing).
+// They are written as single expressions so that they work with C++11 constexpr.
+
+constexpr bool DanceIsMove( uint8_t op )
+{
+   return (op & DANCE_OP_MASK) == DANCE_OP_MOVE;
+}
+
+constexpr bool DanceIsRepeat( uint8_t op )
+{
+   return (op & DANCE_OP_MASK) == DANCE_OP_REPEAT;
+}
+
+constexpr bool DanceIsEndRepeat( uint8_t op )
+{
+   return op == DANCE_OP_END_REPEAT;
+}
+
+constexpr bool DanceIsProfile( uint8_t op )
+{
+   return (op & DANCE_OP_PROFILE) == DANCE_OP_PROFILE;
+}
+
+// Duration (ms) of the entry at index, 0 if it isn't a wait or a move
+constexpr uint32_t DanceEntryDuration( const uint8_t* routine, uint16_t index )
+{
+   return (routine[index] & DANCE_OP_MASK) == DANCE_OP_WAIT || DanceIsMove( routine[index] ) ?
+      (((uint32_t)(routine[index] & 0x3F) << 8) | routine[index + 1]) * DANCE_TIME_UNIT : 0;
+}
+
+// Index just after the DANCE_END_REPEAT that ends the phrase starting at index (size if there isn't one)
+constexpr uint16_t DancePhraseEnd( const uint8_t* routine, uint16_t size, uint16_t index )
+{
+   return index >= size ? size :
+      DanceIsEndRepeat( routine[index] ) ? index + 1 :
+      DanceIsRepeat( routine[index] ) ? DancePhraseEnd( routine, size, DancePhraseEnd( routine, size, index + 1 ) ) :
+      DancePhraseEnd( routine, size, index + DanceEntrySize( routine[index] ) );
+}
+
+// Length (ms) of the phrase starting at index, with the repeats in it expanded
+constexpr uint32_t DancePhraseLength( const uint8_t* routine, uint16_t size, uint16_t index )
+{
+   return index >= size || DanceIsEndRepeat( routine[index] ) ? 0 :
+      DanceIsRepeat( routine[index] ) ?
+         max( 1, routine[index] & 0x3F ) * DancePhraseLength( routine, size, index + 1 ) + DancePhraseLength( routine, size, DancePhraseEnd( routine, size, index + 1 ) ) :
+      DanceEntryDuration( routine, index ) + DancePhraseLength( routine, size, index + DanceEntrySize( routine[index] ) );
+}
 
-   DanceAngleMove() {}
+// How long (ms) a routine takes to play, e.g. static_assert( DanceRoutineLength( DANCE_MOVES( yawMoves ) ) == 10800, "" )
+constexpr uint32_t DanceRoutineLength( const uint8_t* routine, uint16_t size )
+{
+   return DancePhraseLength( routine, size, 0 );
+}
+
+// True if every repeat is ended, repeats aren't nested deeper than DANCE_MAX_REPEAT_DEPTH and the last entry isn't cut off
+constexpr bool DanceRepeatsValid( const uint8_t* routine, uint16_t size, uint16_t index = 0, uint8_t depth = 0 )
+{
+   return index >= size ? index == size && depth == 0 :
+      DanceIsRepeat( routine[index] ) ? depth < DANCE_MAX_REPEAT_DEPTH && DanceRepeatsValid( routine, size, index + 1, depth + 1 ) :
+      DanceIsEndRepeat( routine[index] ) ? depth > 0 && DanceRepeatsValid( routine, size, index + 1, depth - 1 ) :
+      DanceRepeatsValid( routine, size, index + DanceEntrySize( routine[index] ), depth );
+}
+
+// True if every move of a roll/yaw routine has a speed from -100 to 100
+constexpr bool DanceSpeedsValid( const uint8_t* routine, uint16_t size, uint16_t index = 0 )
+{
+   return index >= size ||
+      ((!DanceIsMove( routine[index] ) || ((int8_t)routine[index + 2] >= -100 && (int8_t)routine[index + 2] <= 100)) &&
+       DanceSpeedsValid( routine, size, index + DanceEntrySize( routine[index] ) ));
+}
+
+// True if every move of a pitch routine has a target from minAngle to maxAngle
+constexpr bool DanceAnglesValid( const uint8_t* routine, uint16_t size, uint8_t minAngle, uint8_t maxAngle, uint16_t index = 0 )
+{
+   return index >= size ||
+      ((!DanceIsMove( routine[index] ) || (routine[index + 2] >= minAngle && routine[index + 2] <= maxAngle)) &&
+       DanceAnglesValid( routine, size, minAngle, maxAngle, index + DanceEntrySize( routine[index] ) ));
+}
 
-   DanceAngleMove( uint8_t targetAng, uint16_t dur )
-      : targetAngle( targetAng )
+// True if every Trapezoid or SCurve profile of a routine has an acceleration of at least one DANCE_ACCEL_UNIT
+constexpr bool DanceProfilesValid( const uint8_t* routine, uint16_t size, uint16_t index = 0 )
+{
+   return index >= size ||
+      ((!DanceIsProfile( routine[index] ) || (MotionProfile)(routine[index] & 0x1F) == MotionProfile::Constant || routine[index + 1] > 0) &&
+       DanceProfilesValid( routine, size, index + DanceEntrySize( routine[index] ) ));
+}
+
+#define DANCE_TOO_FAST -2 // Returned by DancePhraseAngle() when a move is faster than the max speed
+
+// Angle the pitch servo is at after the move at index, which starts at angle (-1 if it isn't known)
+constexpr int16_t DanceMoveAngle( const uint8_t* routine, uint16_t index, int16_t angle, uint16_t maxSpeed )
+{
+   return !DanceIsMove( routine[index] ) ? angle :
+      angle >= 0 && (uint32_t)(routine[index + 2] > angle ? routine[index + 2] - angle : angle - routine[index + 2]) * 1000 >
+         (uint32_t)maxSpeed * DanceEntryDuration( routine, index ) ? DANCE_TOO_FAST : routine[index + 2];
+}
+
+// Angle the pitch servo is at after the phrase starting at index, which starts at angle (-1 if it isn't known).
+// A phrase that is repeated is walked twice, so going from its last move back to its first is checked too.
+constexpr int16_t DancePhraseAngle( const uint8_t* routine, uint16_t size, uint16_t index, int16_t angle, uint16_t maxSpeed )
+{
+   return angle == DANCE_TOO_FAST || index >= size || DanceIsEndRepeat( routine[index] ) ? angle :
+      DanceIsRepeat( routine[index] ) ?
+         DancePhraseAngle( routine, size, DancePhraseEnd( routine, size, index + 1 ),
+            (routine[index] & 0x3F) > 1 ?
+               DancePhraseAngle( routine, size, index + 1, DancePhraseAngle( routine, size, index + 1, angle, maxSpeed ), maxSpeed ) :
+               DancePhraseAngle( routine, size, index + 1, angle, maxSpeed ),
+            maxSpeed ) :
+      DancePhraseAngle( routine, size, index + DanceEntrySize( routine[index] ), DanceMoveAngle( routine, index, angle, maxSpeed ), maxSpeed );
+}
+
+// True if no move of a pitch routine has to go faster than maxSpeed (degrees/sec) to reach its target in time.
+// The first move isn't checked because it starts from wherever the servo is.
+constexpr bool DancePitchSpeedsValid( const uint8_t* routine, uint16_t size, uint16_t maxSpeed )
+{
+   return DancePhraseAngle( routine, size, 0, -1, maxSpeed ) != DANCE_TOO_FAST;
+}
+
+// Stops the build if a roll/yaw routine has a speed outside -100 to 100, a profile with no acceleration or its repeats don't match up
+#define DANCE_CHECK_SPEEDS( moveTable ) \
+   static_assert( DanceRepeatsValid( DANCE_MOVES( moveTable ) ), #moveTable " has a repeat that isn't ended or is nested too deep" ); \
+   static_assert( DanceSpeedsValid( DANCE_MOVES( moveTable ) ), #moveTable " has a speed outside -100 to 100" ); \
+   static_assert( DanceProfilesValid( DANCE_MOVES( moveTable ) ), #moveTable " has a profile with no acceleration" )
+
+// Stops the build if a pitch routine goes outside minAngle to maxAngle, has a move that has to go faster
+// than maxSpeed (degrees/sec) to reach its target in time, has a profile with no acceleration or its repeats don't match up
+#define DANCE_CHECK_ANGLES( moveTable, minAngle, maxAngle, maxSpeed ) \
+   static_assert( DanceRepeatsValid( DANCE_MOVES( moveTable ) ), #moveTable " has a repeat that isn't ended or is nested too deep" ); \
+   static_assert( DanceAnglesValid( DANCE_MOVES( moveTable ), minAngle, maxAngle ), #moveTable " has an angle outside " #minAngle " to " #maxAngle ); \
+   static_assert( DancePitchSpeedsValid( DANCE_MOVES( moveTable ), maxSpeed ), #moveTable " has a move faster than " #maxSpeed ); \
+   static_assert( DanceProfilesValid( DANCE_MOVES( moveTable ) ), #moveTable " has a profile with no acceleration" )
+
+// Reads moves one at a time out of a packed PROGMEM routine or a DanceStream, expanding repeats as it goes
+class DanceMoveReader
+{
+public:
+   void Start( const uint8_t* routine, uint16_t length )
    {
-      duration = dur;
+      data = routine;
+      size = routine != nullptr ? length : 0;
+      stream = nullptr;
+      Restart();
    }
 
-   DanceAngleMove( uint16_t dur )
+   // Reads the moves of an axis as they arrive in a stream
+   void Start( DanceStream& source, uint8_t streamAxis )
    {
-      duration = dur;
-      isWaitMove = true;
+      data = nullptr;
+      size = 0;
+      stream = &source;
+      axis = streamAxis;
+      Restart();
    }
-};
\ No newline at end of file
+
+   // Decodes the next move. Returns false when the end of the routine has been reached.
+   // If the next move of a stream hasn't arrived yet, a short wait is returned instead.
+   bool Next( DanceMove& move, uint8_t& value )
+   {
+      if ( stream != nullptr && !peeking )
+      {
+         // Everything before this move has been played, except for a repeat that is still being played
+         stream->Release( axis, depth > 0 ? loops[0].start : offset );
+      }
+
+      while ( HasEntry() )
+      {
+         uint8_t op = Byte( offset );
+
+         switch ( op & DANCE_OP_MASK )
+         {
+            case DANCE_OP_REPEAT:
+            {
+               offset++;
+               if ( depth < DANCE_MAX_REPEAT_DEPTH )
+               {
+                  loops[depth].start = offset;
+                  loops[depth].remaining = max( 1, op & 0x3F );
+                  depth++;
+               }
+               break;
+            }
+            case DANCE_OP_END_REPEAT:
+            {
+               if ( (op & DANCE_OP_PROFILE) == DANCE_OP_PROFILE )
+               {
+                  profile = (MotionProfile)(op & 0x1F);
+                  acceleration = Byte( offset + 1 );
+                  jerk = Byte( offset + 2 );
+                  offset += 3;
+
+                  // Streamed routines aren't checked when compiling. A profile that can't speed up is played as Constant.
+                  if ( acceleration == 0 || profile > MotionProfile::SCurve )
+                  {
+                     profile = MotionProfile::Constant;
+                  }
+                  break;
+               }
+
+               if ( op == DANCE_OP_SPEED )
+               {
+                  hasPlannedSpeed = true;
+                  plannedSpeed = (int16_t)(Byte( offset + 1 ) | ((uint16_t)Byte( offset + 2 ) << 8));
+                  offset += 3;
+                  break;
+               }
+
+               offset++;
+               if ( depth > 0 )
+               {
+                  if ( --loops[depth - 1].remaining > 0 )
+                  {
+                     offset = loops[depth - 1].start;
+                  }
+                  else
+                  {
+                     depth--;
+                  }
+               }
+               break;
+            }
+            default:
+            {
+               uint16_t steps = ((uint16_t)(op & 0x3F) << 8) | Byte( offset + 1 );
+               move.duration = steps * DANCE_TIME_UNIT;
+               move.isWaitMove = (op & DANCE_OP_MASK) == DANCE_OP_WAIT;
+               move.profile = profile;
+               move.acceleration = acceleration;
+               move.jerk = jerk;
+               move.hasPlannedSpeed = hasPlannedSpeed && !move.isWaitMove;
+               move.plannedSpeed = plannedSpeed;
+               hasPlannedSpeed = false;
+               offset += 2;
+
+               value = 0;
+               if ( !move.isWaitMove )
+               {
+                  value = Byte( offset );
+                  offset++;
+               }
+               return true;
+            }
+         }
+      }
+
+      if ( stream != nullptr && !stream->IsEnded( axis ) )
+      {
+         // Hold still until the host catches up
+         if ( !peeking )
+         {
+            stream->SetStarved( axis );
+         }
+         move.duration = DANCE_TIME_UNIT;
+         move.isWaitMove = true;
+         move.profile = profile;
+         move.acceleration = acceleration;
+         move.jerk = jerk;
+         move.hasPlannedSpeed = false;
+         value = 0;
+         return true;
+      }
+
+      return false;
+   }
+
+   // Decodes the move Next() would return without moving on to it. Nothing is released from a stream and
+   // a move that hasn't arrived yet doesn't count as the axis running out, since it isn't due yet.
+   bool Peek( DanceMove& move, uint8_t& value ) const
+   {
+      DanceMoveReader next = *this;
+      next.peeking = true;
+      return next.Next( move, value );
+   }
+
+private:
+   struct RepeatLoop
+   {
+      uint16_t start;
+      uint8_t remaining;
+   };
+
+   const uint8_t* data = nullptr;
+   uint16_t size = 0;
+   DanceStream* stream = nullptr; // Stream to read from instead of data
+   uint8_t axis = 0;              // DanceAxis of the stream that is read
+   bool peeking = false;          // Copy made by Peek(), which leaves the stream alone
+   uint16_t offset = 0;
+   uint8_t depth = 0;
+   MotionProfile profile = MotionProfile::Constant;
+   uint8_t acceleration = 0;
+   uint8_t jerk = 0;
+   bool hasPlannedSpeed = false; // A DANCE_SPEED was read for the next move
+   int16_t plannedSpeed = 0;
+   RepeatLoop loops[DANCE_MAX_REPEAT_DEPTH];
+
+   void Restart()
+   {
+      offset = 0;
+      depth = 0;
+      profile = MotionProfile::Constant;
+      acceleration = 0;
+      jerk = 0;
+      hasPlannedSpeed = false;
+   }
+
+   uint8_t Byte( uint16_t position ) const
+   {
+      return stream != nullptr ? stream->Read( axis, position ) : pgm_read_byte( data + position );
+   }
+
+   // True if the whole entry at offset can be read
+   bool HasEntry() const
+   {
+      if ( stream == nullptr )
+      {
+         return offset < size;
+      }
+
+      uint16_t available = stream->Available( axis, offset );
+      if ( available == 0 )
+      {
+         return false;
+      }
+
+      return available >= DanceEntrySize( Byte( offset ) );
+   }
+};
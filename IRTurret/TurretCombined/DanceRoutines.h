@@ -0,0 +1,95 @@
+#pragma once
+
+// Generated by the routine compiler (test/DanceCompiler.h) from the choreographies in test/routines/. Change
+// those and run `cmake --build build --target dance_routines` instead of editing this file.
+
+#include <Arduino.h>
+#include "DanceMove.h"
+#include "TurretConfig.h"
+
+// routine1.dance: 68 bytes, 15 of them planned pitch speeds (DANCE_SPEED)
+namespace DanceRoutine1
+{
+   constexpr uint8_t rollMoves[] PROGMEM =
+   {
+      DANCE_WAIT( 10800 ),
+      DANCE_REPEAT( 2 ),
+         DANCE_MOVE( 4000, 50 ),
+         DANCE_MOVE( 4000, -50 ),
+      DANCE_END_REPEAT,
+   };
+
+   constexpr uint8_t yawMoves[] PROGMEM =
+   {
+      DANCE_WAIT( 4400 ),
+      DANCE_MOVE( 200, 80 ),
+      DANCE_REPEAT( 3 ),
+         DANCE_WAIT( 800 ),
+         DANCE_MOVE( 200, -80 ),
+         DANCE_WAIT( 800 ),
+         DANCE_MOVE( 200, 80 ),
+      DANCE_END_REPEAT,
+   };
+
+   constexpr uint8_t pitchMoves[] PROGMEM =
+   {
+      DANCE_MOVE( 1000, 110 ),
+      DANCE_WAIT( 3000 ),
+      DANCE_SPEED( -3276 ), DANCE_MOVE( 400, 90 ),
+      DANCE_SPEED( 13107 ), DANCE_MOVE( 100, 110 ),
+      DANCE_REPEAT( 5 ),
+         DANCE_WAIT( 500 ),
+         DANCE_SPEED( -3276 ), DANCE_MOVE( 400, 90 ),
+         DANCE_SPEED( 13107 ), DANCE_MOVE( 100, 110 ),
+      DANCE_END_REPEAT,
+      DANCE_WAIT( 500 ),
+      DANCE_SPEED( -1638 ), DANCE_MOVE( 800, 90 ),
+   };
+
+   DANCE_CHECK_SPEEDS( rollMoves );
+   DANCE_CHECK_SPEEDS( yawMoves );
+   DANCE_CHECK_ANGLES( pitchMoves, PITCH_MIN_ANGLE, PITCH_MAX_ANGLE, PITCH_MAX_SPEED );
+}
+
+// routine2.dance: 33 bytes, 12 of them planned pitch speeds (DANCE_SPEED)
+namespace DanceRoutine2
+{
+   constexpr uint8_t pitchMoves[] PROGMEM =
+   {
+      DANCE_MOVE( 1000, 110 ),
+      DANCE_WAIT( 3000 ),
+      DANCE_REPEAT( 13 ),
+         DANCE_SPEED( -9830 ), DANCE_MOVE( 200, 80 ),
+         DANCE_SPEED( 19660 ), DANCE_MOVE( 100, 110 ),
+         DANCE_WAIT( 200 ),
+      DANCE_END_REPEAT,
+      DANCE_SPEED( -9830 ), DANCE_MOVE( 200, 80 ),
+      DANCE_SPEED( 19660 ), DANCE_MOVE( 100, 110 ),
+   };
+
+   DANCE_CHECK_ANGLES( pitchMoves, PITCH_MIN_ANGLE, PITCH_MAX_ANGLE, PITCH_MAX_SPEED );
+}
+
+// routine4.dance: 21 bytes, 0 of them planned pitch speeds (DANCE_SPEED)
+namespace DanceRoutine4
+{
+   constexpr uint8_t yawMoves[] PROGMEM =
+   {
+      DANCE_WAIT( 4000 ),
+      DANCE_PROFILE( MotionProfile::Trapezoid, 4000, 0 ),
+      DANCE_MOVE( 600, 80 ),
+      DANCE_REPEAT( 14 ),
+         DANCE_MOVE( 100, 80 ),
+         DANCE_MOVE( 100, -80 ),
+      DANCE_END_REPEAT,
+   };
+
+   constexpr uint8_t pitchMoves[] PROGMEM =
+   {
+      DANCE_MOVE( 1000, 110 ),
+      DANCE_WAIT( 3000 ),
+   };
+
+   DANCE_CHECK_SPEEDS( yawMoves );
+   DANCE_CHECK_ANGLES( pitchMoves, PITCH_MIN_ANGLE, PITCH_MAX_ANGLE, PITCH_MAX_SPEED );
+}
@@ -0,0 +1,310 @@
+#pragma once
+
+#include <Arduino.h>
+#include "Crc16.h"
+
+#define DANCE_STREAM_BUFFER_SIZE 64  // Bytes of moves buffered for each axis. Must be a power of 2.
+#define DANCE_STREAM_MAX_FRAME   48  // Longest frame accepted, which keeps a frame inside the 64 byte Serial receive buffer
+#define DANCE_STREAM_TIMEOUT     100 // Milliseconds without a byte before a partly received frame is dropped
+
+#define DANCE_STREAM_SYNC1 0xA5
+#define DANCE_STREAM_SYNC2 0x5B
+
+// Frame types sent by the host
+#define DANCE_STREAM_RESET  0x01 // Empties the buffers of every axis (refused while a streamed routine is playing)
+#define DANCE_STREAM_MOVES  0x02 // Adds packed moves to the buffer of an axis
+#define DANCE_STREAM_END    0x03 // There are no more moves for an axis
+#define DANCE_STREAM_PLAY   0x04 // Starts playing the streamed routine (only while TurretDance is running and idle)
+#define DANCE_STREAM_STATUS 0x05 // Does nothing, just gets a reply with the free space
+
+// Frame types sent back
+#define DANCE_STREAM_ACK 0x80
+#define DANCE_STREAM_NAK 0x81
+
+#define DANCE_STREAM_HEADER_SIZE 5 // sync1, sync2, length, type, sequence
+#define DANCE_STREAM_REPLY_SIZE  11
+
+enum DanceAxis : uint8_t { DanceAxisRoll, DanceAxisYaw, DanceAxisPitch, DanceAxisCount };
+
+// Lets a host stream a dance routine over Serial while it plays, so routines of any length can be played
+// without reflashing and only DANCE_STREAM_BUFFER_SIZE bytes per axis are ever held in RAM. Each axis has
+// a ring buffer of packed moves in the same format as the PROGMEM routines (see DanceMove.h), which the dance
+// controllers read from and free up as the moves are played.
+//
+// Every frame, in both directions, is:
+//   [0xA5] [0x5B] [length] [type] [sequence] [payload ...] [crc low] [crc high]
+// length: Size of the whole frame in bytes (at most DANCE_STREAM_MAX_FRAME)
+// sequence: Chosen by the host and sent back in the reply to that frame
+// crc: CRC-16/CCITT (see Crc16.h) of every byte from length up to the crc
+// Moves and End frames have the DanceAxis as the first byte of the payload, followed by the packed moves for Moves.
+//
+// Every frame the turret receives gets a reply with 4 bytes of payload: the free space (bytes) in the roll,
+// yaw and pitch buffers and a bit per DanceAxis that is set if that axis ran out of moves while playing.
+// The reply is a NAK if the CRC was wrong, the type is unknown, a Moves frame didn't fit or a Reset came
+// while the streamed routine is still playing (stop it with ok first), in which case nothing was changed. Send one frame at a time and wait for its reply (resending it if no reply comes),
+// and only send as many moves as there is free space for. A Moves frame with the same sequence as the last
+// Moves frame that was added is acknowledged without adding it again, so resending is always safe.
+//
+// Moves should be sent well before they are due. An axis that runs out holds still until more moves arrive,
+// which puts it behind the others. A DANCE_REPEAT keeps the whole repeated phrase in the buffer until
+// it has finished, so repeated phrases have to fit in DANCE_STREAM_BUFFER_SIZE.
+class DanceStream
+{
+public:
+   // Feeds a byte received over Serial to the frame reader. Returns false if the byte isn't part of a
+   // frame, so it can be handed to something else. The sync byte isn't ASCII so it is never part of text.
+   bool Receive( uint8_t c )
+   {
+      auto now = millis();
+      if ( received > 0 && now - lastByteTime > DANCE_STREAM_TIMEOUT )
+      {
+         received = 0;
+      }
+      lastByteTime = now;
+
+      if ( received == 0 )
+      {
+         if ( c != DANCE_STREAM_SYNC1 )
+         {
+            return false;
+         }
+         received = 1;
+         return true;
+      }
+
+      switch ( received )
+      {
+         case 1:
+         {
+            if ( c != DANCE_STREAM_SYNC2 )
+            {
+               // Not a frame after all, unless this is the start of one
+               received = c == DANCE_STREAM_SYNC1 ? 1 : 0;
+               return c == DANCE_STREAM_SYNC1;
+            }
+            crc = 0xFFFF;
+            break;
+         }
+         case 2:
+         {
+            if ( c < DANCE_STREAM_HEADER_SIZE + 2 || c > DANCE_STREAM_MAX_FRAME )
+            {
+               received = 0;
+               return true;
+            }
+            length = c;
+            break;
+         }
+         case 3:
+         {
+            type = c;
+            break;
+         }
+         case 4:
+         {
+            sequence = c;
+            axis = DanceAxisCount;
+            break;
+         }
+         default:
+         {
+            if ( received < length - 2 )
+            {
+               ReceivePayload( c, received - DANCE_STREAM_HEADER_SIZE );
+            }
+            else if ( received == length - 2 )
+            {
+               frameCrc = c;
+            }
+            else
+            {
+               frameCrc |= (uint16_t)c << 8;
+               received = 0;
+               HandleFrame();
+               return true;
+            }
+            break;
+         }
+      }
+
+      if ( received >= 2 && received < length - 2 )
+      {
+         crc = Crc16( crc, c );
+      }
+      received++;
+      return true;
+   }
+
+   // Number of bytes of an axis that have arrived from position on. Positions count up forever (wrapping
+   // around at 65536) and are turned into places in the ring buffer by Read().
+   uint16_t Available( uint8_t streamAxis, uint16_t position ) const
+   {
+      return written[streamAxis] - position;
+   }
+
+   uint8_t Read( uint8_t streamAxis, uint16_t position ) const
+   {
+      return buffers[streamAxis][position % DANCE_STREAM_BUFFER_SIZE];
+   }
+
+   // Everything before position has been played, so its space can be used for new moves
+   void Release( uint8_t streamAxis, uint16_t position )
+   {
+      released[streamAxis] = position;
+   }
+
+   // True once the host has said there are no more moves for an axis
+   bool IsEnded( uint8_t streamAxis ) const
+   {
+      return ended & (1 << streamAxis);
+   }
+
+   // Called when an axis wanted a move that hasn't arrived yet
+   void SetStarved( uint8_t streamAxis )
+   {
+      starved |= 1 << streamAxis;
+   }
+
+   // Set while the streamed routine is being played, when the dance controllers are reading the buffers
+   void SetPlaying( bool isPlaying )
+   {
+      playing = isPlaying;
+   }
+
+   // Returns true once if the host has asked for the streamed routine to be played
+   bool TakePlay()
+   {
+      bool play = playRequested;
+      playRequested = false;
+      return play;
+   }
+
+private:
+   uint8_t buffers[DanceAxisCount][DANCE_STREAM_BUFFER_SIZE];
+   uint16_t written[DanceAxisCount] = {};  // Position after the last byte that has arrived
+   uint16_t released[DanceAxisCount] = {}; // Position of the first byte that hasn't been played
+   uint8_t ended = 0;                      // Bit per DanceAxis
+   uint8_t starved = 0;                    // Bit per DanceAxis
+   bool playRequested = false;
+   bool playing = false;                   // See SetPlaying()
+   int16_t lastMovesSequence = -1;         // Sequence of the last Moves frame that was added, -1 if none
+
+   // Frame being received
+   uint8_t received = 0; // Bytes of the frame received so far
+   uint8_t length;
+   uint8_t type;
+   uint8_t sequence;
+   uint8_t axis;
+   bool fits;            // A Moves frame has room in the buffer of its axis
+   uint16_t crc;         // CRC worked out from the bytes received
+   uint16_t frameCrc;    // CRC at the end of the frame
+   unsigned long lastByteTime = 0;
+
+   uint16_t Free( uint8_t streamAxis ) const
+   {
+      return DANCE_STREAM_BUFFER_SIZE - (uint16_t)(written[streamAxis] - released[streamAxis]);
+   }
+
+   // Moves are copied straight into the ring buffer past the bytes that have arrived and only
+   // counted as arrived once the CRC has been checked, so a frame doesn't need its own buffer
+   void ReceivePayload( uint8_t c, uint8_t index )
+   {
+      if ( index == 0 )
+      {
+         axis = c;
+         fits = axis < DanceAxisCount && (uint16_t)(length - DANCE_STREAM_HEADER_SIZE - 3) <= Free( axis );
+      }
+      else if ( type == DANCE_STREAM_MOVES && fits )
+      {
+         buffers[axis][(uint16_t)(written[axis] + index - 1) % DANCE_STREAM_BUFFER_SIZE] = c;
+      }
+   }
+
+   void HandleFrame()
+   {
+      bool accepted = crc == frameCrc;
+
+      if ( accepted )
+      {
+         switch ( type )
+         {
+            case DANCE_STREAM_RESET:
+            {
+               // The readers have their own positions in the buffers, which would point past what has arrived
+               accepted = !playing;
+               if ( !accepted )
+               {
+                  break;
+               }
+
+               for ( uint8_t i = 0; i < DanceAxisCount; i++ )
+               {
+                  written[i] = 0;
+                  released[i] = 0;
+               }
+               ended = 0;
+               starved = 0;
+               playRequested = false;
+               lastMovesSequence = -1;
+               break;
+            }
+            case DANCE_STREAM_MOVES:
+            {
+               accepted = axis < DanceAxisCount && (fits || sequence == lastMovesSequence);
+               if ( accepted && sequence != lastMovesSequence )
+               {
+                  written[axis] += length - DANCE_STREAM_HEADER_SIZE - 3;
+                  lastMovesSequence = sequence;
+               }
+               break;
+            }
+            case DANCE_STREAM_END:
+            {
+               accepted = axis < DanceAxisCount;
+               if ( accepted )
+               {
+                  ended |= 1 << axis;
+               }
+               break;
+            }
+            case DANCE_STREAM_PLAY:
+            {
+               playRequested = true;
+               break;
+            }
+            case DANCE_STREAM_STATUS:
+            {
+               break;
+            }
+            default:
+            {
+               accepted = false;
+               break;
+            }
+         }
+      }
+
+      SendReply( accepted ? DANCE_STREAM_ACK : DANCE_STREAM_NAK );
+   }
+
+   void SendReply( uint8_t replyType )
+   {
+      uint8_t reply[DANCE_STREAM_REPLY_SIZE] =
+      {
+         DANCE_STREAM_SYNC1, DANCE_STREAM_SYNC2, DANCE_STREAM_REPLY_SIZE, replyType, sequence,
+         (uint8_t)Free( DanceAxisRoll ), (uint8_t)Free( DanceAxisYaw ), (uint8_t)Free( DanceAxisPitch ), starved
+      };
+
+      uint16_t replyCrc = 0xFFFF;
+      for ( uint8_t i = 2; i < DANCE_STREAM_REPLY_SIZE - 2; i++ )
+      {
+         replyCrc = Crc16( replyCrc, reply[i] );
+      }
+      reply[DANCE_STREAM_REPLY_SIZE - 2] = replyCrc & 0xFF;
+      reply[DANCE_STREAM_REPLY_SIZE - 1] = replyCrc >> 8;
+
+      Serial.write( reply, DANCE_STREAM_REPLY_SIZE );
+   }
+};
+
+DanceStream danceStream;
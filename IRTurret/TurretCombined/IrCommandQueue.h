@@ -0,0 +1,172 @@
+#pragma once
+
+#include <Arduino.h>
+#include <IRremote.hpp>
+#include "Utils.h"
+
+#define IR_QUEUE_SIZE 8 // Number of decoded commands that can be waiting to be handled
+
+// A decoded button press from the remote
+// command: Code of the button (see Utils.h)
+// isRepeat: NEC repeat frame that is sent while a button is held down
+// time: millis() when the frame finished being received
+struct IrCommand
+{
+   uint16_t command;
+   bool isRepeat;
+   unsigned long time;
+};
+
+// Fire and stop buttons. These aren't kept waiting behind aim buttons when aim preemption is on (see IrCommandQueue::Push()).
+inline bool IsPriorityCommand( uint16_t command )
+{
+   return command == ok || command == star;
+}
+
+inline bool IsAimCommand( uint16_t command )
+{
+   return command == up || command == down || command == left || command == right;
+}
+
+// Commands are decoded from the IR receive interrupt and stored in a ring buffer, so presses
+// that arrive while a program is busy are kept until the main loop gets to them.
+class IrCommandQueue
+{
+public:
+   void Begin( uint8_t pin );
+
+   // Takes the oldest command out of the queue. Returns false if the queue is empty.
+   bool Pop( IrCommand& command )
+   {
+      bool hasCommand = false;
+
+      noInterrupts();
+      if ( count > 0 )
+      {
+         command.command = commands[head].command;
+         command.isRepeat = commands[head].isRepeat;
+         command.time = commands[head].time;
+         head = (head + 1) % IR_QUEUE_SIZE;
+         count--;
+         hasCommand = true;
+      }
+      interrupts();
+
+      return hasCommand;
+   }
+
+   // Frames that were thrown away because the queue was full
+   uint16_t DroppedCount()
+   {
+      noInterrupts();
+      auto dropped = droppedCount;
+      interrupts();
+      return dropped;
+   }
+
+   // Repeat frames that were not queued because the same button was already waiting in the queue
+   uint16_t MergedRepeatCount()
+   {
+      noInterrupts();
+      auto merged = mergedRepeatCount;
+      interrupts();
+      return merged;
+   }
+
+   // Aim commands that were dropped because a fire or stop command arrived after them
+   uint16_t PreemptedCount()
+   {
+      noInterrupts();
+      auto preempted = preemptedCount;
+      interrupts();
+      return preempted;
+   }
+
+   // Whether the running program wants aim commands dropped when a fire or stop command arrives
+   void SetAimPreemption( bool preempt )
+   {
+      aimPreemption = preempt;
+   }
+
+   // Called from the receive interrupt once a frame has been decoded
+   void Push( uint16_t command, bool isRepeat, unsigned long time )
+   {
+      if ( aimPreemption && IsPriorityCommand( command ) )
+      {
+         DropAimCommands();
+      }
+
+      // A held button sends a repeat frame every ~110ms. If the last queued command is the same button
+      // then the main loop hasn't caught up yet and another copy of it doesn't add anything.
+      if ( isRepeat && count > 0 && commands[(head + count - 1) % IR_QUEUE_SIZE].command == command )
+      {
+         mergedRepeatCount++;
+         return;
+      }
+
+      if ( count >= IR_QUEUE_SIZE )
+      {
+         droppedCount++;
+         return;
+      }
+
+      volatile IrCommand& slot = commands[(head + count) % IR_QUEUE_SIZE];
+      slot.command = command;
+      slot.isRepeat = isRepeat;
+      slot.time = time;
+      count++;
+   }
+
+private:
+   volatile IrCommand commands[IR_QUEUE_SIZE];
+   volatile uint8_t head = 0;
+   volatile uint8_t count = 0;
+   volatile uint16_t droppedCount = 0;
+   volatile uint16_t mergedRepeatCount = 0;
+   volatile uint16_t preemptedCount = 0;
+   volatile bool aimPreemption = false;
+
+   // Takes the aim commands out of the queue, so a fire or stop command that is queued next is handled
+   // straight after whatever else was pressed before it instead of after moves that are no longer wanted
+   void DropAimCommands()
+   {
+      uint8_t kept = 0;
+      for ( uint8_t i = 0; i < count; i++ )
+      {
+         volatile IrCommand& queued = commands[(head + i) % IR_QUEUE_SIZE];
+         if ( IsAimCommand( queued.command ) )
+         {
+            preemptedCount++;
+            continue;
+         }
+
+         volatile IrCommand& slot = commands[(head + kept) % IR_QUEUE_SIZE];
+         slot.command = queued.command;
+         slot.isRepeat = queued.isRepeat;
+         slot.time = queued.time;
+         kept++;
+      }
+      count = kept;
+   }
+};
+
+IrCommandQueue irCommands;
+
+// Runs in the IR receive interrupt every time a full frame has been received
+void OnIrReceiveComplete()
+{
+   IrReceiver.decode();
+
+   if ( IrReceiver.decodedIRData.protocol != UNKNOWN )
+   {
+      irCommands.Push( IrReceiver.decodedIRData.command, IrReceiver.decodedIRData.flags & IRDATA_FLAGS_IS_REPEAT, millis() );
+   }
+
+   IrReceiver.resume();
+}
+
+void IrCommandQueue::Begin( uint8_t pin )
+{
+   IrReceiver.begin( pin, ENABLE_LED_FEEDBACK );
+   IrReceiver.registerReceiveCompleteCallback( OnIrReceiveComplete );
+}
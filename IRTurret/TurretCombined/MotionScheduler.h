@@ -0,0 +1,290 @@
+#pragma once
+
+#include <Arduino.h>
+#include "TurretHardware.h"
+
+#define MOTION_QUEUE_SIZE 16 // Max number of segments that can be queued for a single servo
+
+// A single timed piece of motion for one servo
+// value: Speed (roll/yaw) or angle (pitch) to write to the servo
+// duration: Milliseconds before the next segment starts
+// ramp: Move gradually from the current position to value over the duration instead of jumping to it
+// isWait: Don't write anything, just hold the servo where it is for the duration
+struct MotionSegment
+{
+   uint16_t duration;
+   uint8_t value;
+   bool ramp;
+   bool isWait;
+};
+
+// Queue of motion segments for a single servo. Segments are played back to back
+// from Update() using millis() instead of delay(), so the rest of the program keeps
+// running while the servo moves. An offset can be layered on top of the queued moves
+// (see SetOffset()), so something like recoil doesn't have to wait for them.
+// The Push functions return false, and queue nothing, when there isn't room for the move.
+class MotionAxis
+{
+public:
+   // Moves start from wherever the servo currently is
+   void Attach( TurretServo* servoToMove )
+   {
+      servo = servoToMove;
+      offset = 0;
+      appliedOffset = 0;
+      Clear();
+   }
+
+   // Queue a move that writes value right away and holds it for duration
+   bool Push( uint8_t value, uint16_t duration )
+   {
+      return Enqueue( value, duration, false, false );
+   }
+
+   // Queue a move that gradually moves from the current position to value over duration
+   bool PushRamp( uint8_t value, uint16_t duration )
+   {
+      return Enqueue( value, duration, true, false );
+   }
+
+   // Queue a move that writes value for duration and then restValue for restDuration, e.g. to turn a
+   // continuous servo for a while and then stop it. If the last thing queued is a move at the same value
+   // that hasn't got to its rest yet, that move is made longer instead, so the servo doesn't stop and
+   // start again in between.
+   bool PushPulse( uint8_t value, uint16_t duration, uint8_t restValue, uint16_t restDuration )
+   {
+      if ( count >= 2 )
+      {
+         MotionSegment& rest = segments[(head + count - 1) % MOTION_QUEUE_SIZE];
+         MotionSegment& move = segments[(head + count - 2) % MOTION_QUEUE_SIZE];
+
+         if ( rest.value == restValue && !rest.ramp && !rest.isWait && move.value == value && !move.ramp && !move.isWait &&
+              (uint32_t)move.duration + duration <= 0xFFFF )
+         {
+            move.duration += duration;
+            rest.duration = restDuration;
+            return true;
+         }
+      }
+
+      return HasRoom( 2 ) && Push( value, duration ) && Push( restValue, restDuration );
+   }
+
+   // Queue a pause where the servo is left as it is
+   bool PushWait( uint16_t duration )
+   {
+      return Enqueue( 0, duration, false, true );
+   }
+
+   // Queue a pause that lasts until everything queued on the other axis has finished
+   bool PushWaitFor( const MotionAxis& other, unsigned long now )
+   {
+      auto otherTime = other.RemainingTime( now );
+      auto ourTime = RemainingTime( now );
+
+      if ( otherTime <= ourTime )
+      {
+         return true;
+      }
+
+      return PushWait( otherTime - ourTime );
+   }
+
+   // Drops everything that is queued. The servo is left at its last written value.
+   void Clear()
+   {
+      head = 0;
+      count = 0;
+      segmentActive = false;
+      restartClock = true;
+   }
+
+   bool IsIdle() const
+   {
+      return count == 0;
+   }
+
+   // Whether segmentCount more segments can be queued. Sequences that end by stopping the servo check this
+   // first, so a full queue skips the whole sequence instead of cutting it off before the stop.
+   bool HasRoom( uint8_t segmentCount ) const
+   {
+      return count + segmentCount <= MOTION_QUEUE_SIZE;
+   }
+
+   // Milliseconds until everything currently queued has finished
+   unsigned long RemainingTime( unsigned long now ) const
+   {
+      unsigned long total = 0;
+      for ( uint8_t i = 0; i < count; i++ )
+      {
+         total += segments[(head + i) % MOTION_QUEUE_SIZE].duration;
+      }
+
+      if ( segmentActive )
+      {
+         auto elapsed = now - segmentStart;
+         total -= min( elapsed, (unsigned long)segments[head].duration );
+      }
+
+      return total;
+   }
+
+   // Adds offset to the value of the queued moves from the next Update() on. The servo is
+   // kept from 0 to 180 however big the offset is.
+   void SetOffset( int16_t newOffset )
+   {
+      offset = newOffset;
+   }
+
+   // Writes value straight away (plus the offset), for programs that drive the servo directly for a while.
+   // Clear() anything queued first, or it will carry on from wherever it was.
+   void Set( uint8_t value )
+   {
+      Write( value );
+   }
+
+   // Last value of the queued moves, without the offset
+   uint8_t Position() const
+   {
+      return servo != nullptr ? servo->Position() - appliedOffset : 0;
+   }
+
+   void Update( unsigned long now )
+   {
+      UpdateSegments( now );
+
+      if ( appliedOffset != offset )
+      {
+         Write( Position() );
+      }
+   }
+
+private:
+   TurretServo* servo = nullptr;
+   MotionSegment segments[MOTION_QUEUE_SIZE];
+   uint8_t head = 0;
+   uint8_t count = 0;
+   bool segmentActive = false;
+   bool restartClock = true;
+   unsigned long segmentStart = 0;
+   uint8_t rampStart = 0;
+   int16_t offset = 0;        // Added to every value written
+   int16_t appliedOffset = 0; // Offset the servo was last written with, after keeping it from 0 to 180
+
+   void UpdateSegments( unsigned long now )
+   {
+      while ( count > 0 )
+      {
+         MotionSegment& segment = segments[head];
+
+         if ( !segmentActive )
+         {
+            if ( restartClock )
+            {
+               // Queue was empty, so this segment starts now rather than when the last one ended
+               segmentStart = now;
+               restartClock = false;
+            }
+
+            segmentActive = true;
+            rampStart = Position();
+
+            if ( !segment.ramp && !segment.isWait )
+            {
+               Write( segment.value );
+            }
+         }
+
+         unsigned long elapsed = now - segmentStart;
+         if ( elapsed < segment.duration )
+         {
+            if ( segment.ramp )
+            {
+               long travel = (long)segment.value - rampStart;
+               Write( rampStart + travel * (long)elapsed / (long)segment.duration );
+            }
+            return;
+         }
+
+         if ( segment.ramp )
+         {
+            Write( segment.value );
+         }
+
+         // Next segment starts exactly when this one was supposed to end so that a late tick doesn't add drift
+         segmentStart += segment.duration;
+         segmentActive = false;
+         head = (head + 1) % MOTION_QUEUE_SIZE;
+         count--;
+      }
+
+      restartClock = true;
+   }
+
+   bool Enqueue( uint8_t value, uint16_t duration, bool ramp, bool isWait )
+   {
+      if ( count >= MOTION_QUEUE_SIZE )
+      {
+         return false;
+      }
+
+      MotionSegment& segment = segments[(head + count) % MOTION_QUEUE_SIZE];
+      segment.value = value;
+      segment.duration = duration;
+      segment.ramp = ramp;
+      segment.isWait = isWait;
+      count++;
+
+      return true;
+   }
+
+   void Write( uint8_t value )
+   {
+      if ( servo != nullptr )
+      {
+         int withOffset = max( 0, min( 180, value + offset ) );
+         servo->Write( withOffset );
+         appliedOffset = withOffset - value;
+      }
+   }
+};
+
+// Runs the yaw, pitch and roll motion queues together. Every axis is advanced from the
+// same clock sample each tick, so a yaw move and a pitch move can happen at the same time.
+class MotionScheduler
+{
+public:
+   MotionAxis yaw;
+   MotionAxis pitch;
+   MotionAxis roll;
+
+   void Update()
+   {
+      auto now = millis();
+      yaw.Update( now );
+      pitch.Update( now );
+      roll.Update( now );
+   }
+
+   void Clear()
+   {
+      yaw.Clear();
+      pitch.Clear();
+      roll.Clear();
+   }
+
+   // Makes anything queued after this wait until everything already queued on every axis has finished
+   void WaitForAll()
+   {
+      auto now = millis();
+      yaw.PushWaitFor( pitch, now );
+      yaw.PushWaitFor( roll, now );
+      pitch.PushWaitFor( yaw, now );
+      roll.PushWaitFor( yaw, now );
+   }
+
+   bool IsIdle() const
+   {
+      return yaw.IsIdle() && pitch.IsIdle() && roll.IsIdle();
+   }
+};
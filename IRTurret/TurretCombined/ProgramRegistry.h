@@ -0,0 +1,80 @@
+#pragma once
+
+#include <Arduino.h>
+#include <new.h>
+#include "BaseProgram.h"
+#include "TurretControl.h"
+#include "TurretRoulette.h"
+#include "TurretDance.h"
+#include "TurretCalibration.h"
+#include "TurretHardware.h"
+
+enum ProgramType { TurretControl, TurretRoulette, TurretDance, TurretCalibration, ProgramCount };
+
+constexpr size_t MaxProgramSize( size_t a, size_t b )
+{
+   return a > b ? a : b;
+}
+
+// Size of the largest program, which is how much memory is set aside for the running program
+#define PROGRAM_ARENA_SIZE MaxProgramSize( MaxProgramSize( sizeof( TurretControlProgram ), sizeof( TurretRouletteProgram ) ), \
+                                           MaxProgramSize( sizeof( TurretDanceProgram ), sizeof( TurretCalibrationProgram ) ) )
+
+// Only the program that is running is kept in memory. It is constructed in a static buffer
+// that is big enough for the largest program when it is switched to, and destroyed when it is
+// switched away from, so switching programs never touches the heap.
+class ProgramRegistry
+{
+public:
+   // hardware: Servos that are lent to every program that gets created
+   ProgramRegistry( TurretHardware& turretHardware )
+      : hardware( turretHardware )
+   {
+   }
+
+   // Destroys the running program (if there is one) and constructs the new one in its place
+   BaseProgram* Create( ProgramType type )
+   {
+      Destroy();
+
+      if ( type < ProgramCount )
+      {
+         program = factories[type]( arena, hardware );
+      }
+
+      return program;
+   }
+
+   void Destroy()
+   {
+      if ( program != nullptr )
+      {
+         program->~BaseProgram();
+         program = nullptr;
+      }
+   }
+
+private:
+   typedef BaseProgram* ( *Factory )( void* memory, TurretHardware& hardware );
+
+   template<typename T>
+   static BaseProgram* Construct( void* memory, TurretHardware& hardware )
+   {
+      return new ( memory ) T( hardware );
+   }
+
+   static const Factory factories[ProgramCount];
+
+   alignas( alignof( unsigned long ) ) uint8_t arena[PROGRAM_ARENA_SIZE];
+   BaseProgram* program = nullptr;
+   TurretHardware& hardware;
+};
+
+// Indexed by ProgramType
+const ProgramRegistry::Factory ProgramRegistry::factories[ProgramCount] =
+{
+   ProgramRegistry::Construct<TurretControlProgram>,
+   ProgramRegistry::Construct<TurretRouletteProgram>,
+   ProgramRegistry::Construct<TurretDanceProgram>,
+   ProgramRegistry::Construct<TurretCalibrationProgram>
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <Arduino.h>
+#include "Barrel.h"
+#include "MotionScheduler.h"
+#include "TurretConfig.h"
+
+#define RECOIL_QUEUE_SIZE 6 // Max number of shots whose recoil can be waiting or playing at once
+
+enum class FireResult : uint8_t
+{
+   Fired,
+   Empty,   // There was nothing left to fire, which has been reported (see Barrel::Fire())
+   RollBusy // The roll queue was full, so nothing was fired or counted
+};
+
+// Recoil bounce of the pitch servo, worked out from the time since each shot instead of being queued as
+// moves. Programs add Offset() on top of whatever the pitch servo is doing (see MotionAxis::SetOffset() and
+// ServoAngleController::SetOffset()), so aiming or dancing carries on during it and nothing waits for it.
+// The bounce kicks up by config.recoilAmount degrees over config.recoilRiseTime ms and falls back over
+// config.recoilDecayTime ms. When shots overlap the biggest bounce is used, so rapid fire doesn't add up.
+class RecoilLayer
+{
+public:
+   // Starts a bounce at startTime, which can be in the future (e.g. when the barrel will have finished turning)
+   void Trigger( unsigned long startTime )
+   {
+      if ( amount != 0 && count < RECOIL_QUEUE_SIZE )
+      {
+         starts[count++] = startTime;
+      }
+   }
+
+   // Fires shots darts (however many are left): turns the barrel by that many chambers on roll, counts them on
+   // barrel and starts a bounce for when the turn has finished. Only roll is queued, so a program can keep
+   // aiming while it turns, and shots fired before the last turn has finished keep the barrel turning instead
+   // of stopping it in between. The darts are only counted once the turn has been queued, so a full roll queue
+   // doesn't leave the count ahead of the barrel.
+   FireResult FireDarts( Barrel& barrel, MotionAxis& roll, uint8_t shots, uint8_t rollStopSpeed, uint8_t rollMoveSpeed )
+   {
+      if ( barrel.IsEmpty() )
+      {
+         barrel.Fire(); // reports that it is empty
+         return FireResult::Empty;
+      }
+
+      shots = min( shots, barrel.Loaded() );
+      if ( !roll.PushPulse( rollStopSpeed + rollMoveSpeed, barrel.TurnTime( shots ), rollStopSpeed, 5 ) ) // rotate the barrel, then stop
+      {
+         return FireResult::RollBusy;
+      }
+
+      for ( uint8_t i = 0; i < shots; i++ )
+      {
+         barrel.Fire();
+      }
+
+      auto now = millis();
+      Trigger( now + roll.RemainingTime( now ) - 5 ); // the last 5ms is the roll servo stopping
+      return FireResult::Fired;
+   }
+
+   // Offset (degrees) to add to angle right now, kept so that angle plus the offset stays from minAngle to maxAngle
+   int16_t Offset( unsigned long now, uint8_t angle, uint8_t minAngle, uint8_t maxAngle )
+   {
+      unsigned long length = (unsigned long)riseTime + decayTime;
+      int16_t kick = 0;
+
+      for ( uint8_t i = 0; i < count; i++ )
+      {
+         long elapsed = (long)(now - starts[i]);
+         if ( elapsed < 0 || (unsigned long)elapsed >= length )
+         {
+            continue;
+         }
+
+         int16_t shotKick = (unsigned long)elapsed < riseTime ?
+            (uint32_t)amount * elapsed / riseTime :
+            (uint32_t)amount * (length - elapsed) / max( decayTime, (uint16_t)1 );
+         kick = max( kick, shotKick );
+      }
+
+      // Shots are triggered in order, so finished bounces are always at the front
+      while ( count > 0 && (long)(now - starts[0]) >= (long)length )
+      {
+         count--;
+         memmove( starts, starts + 1, count * sizeof( starts[0] ) );
+      }
+
+      return constrain( angle + kick, minAngle, maxAngle ) - angle;
+   }
+
+   // True when no bounce is playing or waiting to start
+   bool IsIdle() const
+   {
+      return count == 0;
+   }
+
+   void Clear()
+   {
+      count = 0;
+   }
+
+private:
+   uint8_t amount = config.recoilAmount;
+   uint16_t riseTime = config.recoilRiseTime;
+   uint16_t decayTime = config.recoilDecayTime;
+
+   unsigned long starts[RECOIL_QUEUE_SIZE]; // When each bounce starts, oldest first
+   uint8_t count = 0;
+};
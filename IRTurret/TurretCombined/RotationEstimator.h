@@ -0,0 +1,149 @@
+#pragma once
+
+#include <Arduino.h>
+
+#define ROTATION_TABLE_STEP 10 // Servo values between entries of a rotation speed table
+#define ROTATION_TABLE_SIZE 10 // Entries in a rotation speed table, covering 0 to 90 away from the stop speed
+
+// Keeps track of how far a continuous rotation servo has turned by adding up the speed it was told
+// to turn at over time (dead reckoning). The servo has no feedback, so the error grows the longer it
+// runs, but it is close enough to turn back to roughly where it started.
+// degreesPerSecondTable: PROGMEM table of how fast (degrees/sec) the servo turns at every ROTATION_TABLE_STEP
+//                        away from stopSpd. It has ROTATION_TABLE_SIZE entries and is used for both directions.
+//                        It is copied to RAM so that it can be replaced by a calibrated table (see SetTable()).
+// stopSpd: Servo value that keeps the servo stationary
+class RotationEstimator
+{
+public:
+   RotationEstimator( const uint16_t* degreesPerSecondTable, uint8_t stopSpd )
+      : stopValue( stopSpd ), value( stopSpd )
+   {
+      memcpy_P( table, degreesPerSecondTable, sizeof( table ) );
+   }
+
+   // Replaces the table with one measured for this servo (ROTATION_TABLE_SIZE entries in RAM)
+   void SetTable( const uint16_t* degreesPerSecond )
+   {
+      memcpy( table, degreesPerSecond, sizeof( table ) );
+      calibrated = true;
+   }
+
+   const uint16_t* Table() const
+   {
+      return table;
+   }
+
+   // True once a table measured for this servo has been set
+   bool IsCalibrated() const
+   {
+      return calibrated;
+   }
+
+   // Called when the servo is written to. Adds up the turning done at the old value before switching to the new one.
+   void SpeedChanged( uint8_t newValue )
+   {
+      Advance();
+      value = newValue;
+   }
+
+   // Degrees turned since the heading was last set. Positive is the direction servo values above the stop value turn.
+   int32_t Heading()
+   {
+      Advance();
+      return milliDegrees / 1000;
+   }
+
+   void SetHeading( int32_t degrees )
+   {
+      Advance();
+      milliDegrees = degrees * 1000;
+   }
+
+   void SetStopValue( uint8_t stopSpd )
+   {
+      Advance();
+      stopValue = stopSpd;
+      value = stopSpd;
+   }
+
+   uint8_t StopValue() const
+   {
+      return stopValue;
+   }
+
+   // Degrees/sec the servo turns at for a servo value, negative below the stop value
+   int16_t DegreesPerSecond( uint8_t servoValue ) const
+   {
+      uint8_t offset = abs( (int)servoValue - stopValue );
+      uint8_t index = offset / ROTATION_TABLE_STEP;
+      uint16_t rate = table[ROTATION_TABLE_SIZE - 1];
+
+      if ( index < ROTATION_TABLE_SIZE - 1 )
+      {
+         uint16_t low = table[index];
+         uint16_t high = table[index + 1];
+         rate = low + (int32_t)(high - low) * (offset - index * ROTATION_TABLE_STEP) / ROTATION_TABLE_STEP;
+      }
+
+      return servoValue < stopValue ? -(int16_t)rate : rate;
+   }
+
+   // Servo value that turns at degreesPerSecond, or as close to it as the table allows. Offsets between table
+   // entries are rounded away from the stop value, so a rate that isn't 0 never gives a value the table says
+   // doesn't turn (unless the table never turns at all).
+   uint8_t ServoValue( int16_t degreesPerSecond ) const
+   {
+      uint16_t rate = abs( degreesPerSecond );
+      uint8_t offset = ROTATION_TABLE_STEP * (ROTATION_TABLE_SIZE - 1);
+
+      if ( rate == 0 )
+      {
+         return stopValue;
+      }
+
+      for ( uint8_t i = 1; i < ROTATION_TABLE_SIZE; i++ )
+      {
+         uint16_t high = table[i];
+         if ( high >= rate )
+         {
+            uint16_t low = table[i - 1];
+            offset = ROTATION_TABLE_STEP * i;
+            if ( high > low )
+            {
+               offset = ROTATION_TABLE_STEP * (i - 1) + ((uint32_t)(rate - low) * ROTATION_TABLE_STEP + high - low - 1) / (high - low);
+            }
+            break;
+         }
+      }
+
+      // Interpolating a steep step out of the dead band can still land on a value that works out to 0
+      while ( offset < ROTATION_TABLE_STEP * (ROTATION_TABLE_SIZE - 1) && DegreesPerSecond( stopValue + offset ) == 0 )
+      {
+         offset++;
+      }
+
+      return degreesPerSecond < 0 ? stopValue - offset : stopValue + offset;
+   }
+
+   // Milliseconds it takes to turn degrees at a servo value, 0 if the servo doesn't turn at that value
+   uint16_t TurnTime( uint16_t degrees, uint8_t servoValue ) const
+   {
+      uint16_t rate = abs( DegreesPerSecond( servoValue ) );
+      return rate > 0 ? (uint32_t)degrees * 1000 / rate : 0;
+   }
+
+private:
+   uint16_t table[ROTATION_TABLE_SIZE];
+   bool calibrated = false;
+   uint8_t stopValue;
+   uint8_t value;               // Servo value the servo is running at
+   int32_t milliDegrees = 0;    // Heading in 1/1000 degrees, so degrees/sec * ms adds up exactly
+   unsigned long lastTime = 0;  // When the turning was last added up
+
+   void Advance()
+   {
+      auto now = millis();
+      milliDegrees += (int32_t)DegreesPerSecond( value ) * (int32_t)(now - lastTime);
+      lastTime = now;
+   }
+};
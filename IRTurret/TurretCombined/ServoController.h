@@ -1,239 +1,674 @@
-#include <Servo.h>
+#pragma once
+
+#include <Arduino.h>
+#include "DanceMove.h"
+#include "DanceBenchmark.h"
+#include "TurretHardware.h"
 
 class ServoController
 {
 public:
    virtual void Reset() = 0;
-   virtual bool Update() = 0;
+
+   // Plays the routine up to routineTime (ms since the routine started). Every controller is given
+   // the same routineTime each tick and move boundaries are based on the total duration of the moves
+   // before them, so the axes stay in sync no matter how late a tick is. Returns true when all moves are done.
+   virtual bool Update( unsigned long routineTime ) = 0;
 
 protected:
-   Servo servo;
-   uint16_t numMoves = 0;
-   uint16_t currentMoveIndex = 0;
-   uint16_t startMoveTime;
-   uint16_t lastTime;
-   uint8_t currentPosition;
+   TurretServo& servo;
+   DanceMoveReader moves; // Reads the packed routine out of flash one move at a time
+   bool moveStarted = false;
+   unsigned long startMoveTime; // When the current move started (ms since the routine started)
+   unsigned long lastTime;      // routineTime of the last update
    uint16_t maxSpeed;
 
+   ServoController( TurretServo& turretServo )
+      : servo( turretServo )
+   {
+   }
+
    virtual void MoveTo( uint8_t position ) = 0;
+
+#if DANCE_BENCHMARK
+   DanceStats* stats = nullptr;
+
+   // Call before writing newValue to the servo
+   void RecordWrite( uint8_t newValue )
+   {
+      if ( stats != nullptr )
+      {
+         stats->AddWrite( servo.Position(), newValue );
+      }
+   }
+
+   // Records how late the tick that noticed the end of a move was compared to when the move was scheduled to end
+   void RecordMoveEnd( unsigned long routineTime, unsigned long moveEndTime )
+   {
+      if ( stats != nullptr )
+      {
+         stats->AddMoveEnd( (long)(routineTime - moveEndTime) );
+      }
+   }
+#endif
 };
 
+#define SPEED_FRACTION_BITS 8 // Ramped roll/yaw speeds are tracked in fixed point with this many bits for the fraction
+
 // Controller to define properties for a servo that lets you set the speed
 // and rotates 360 degrees. This is for the roll and yaw servos.
-// pin: Arduino pin for servo
+// turretServo: Servo to control
 // zeroSpd: Speed that is used to keep servo stationary
 // minSpd: Minimum speed away from zeroSpd needed to get servo moving. You may need to experient for your own values
 // maxSpd: Maximum speed away from zeroSpd needed to get servo moving. You may need to experient for your own values
-// moveArray: Array of dance moves to perform
+// moveArray: Packed PROGMEM routine of dance moves to perform (see DanceMove.h)
+// Moves with a Trapezoid or SCurve profile ramp their speed up from where the last move left off and
+// back down by the time they end, changing by at most the profile's acceleration (speed/sec).
+// A move ramps into the next one if it turns the same way, otherwise it ramps down to a stop.
 class ServoSpeedController : ServoController
 {
 private:
-   DanceSpeedMove* moves = nullptr;
+   DanceSpeedMove move; // Move that is currently playing
    uint8_t zeroSpeed;
    uint8_t minSpeed;
+   int16_t rampStartSpeed; // Speed (SPEED_FRACTION_BITS) the current move ramps up from
+   int16_t rampEndSpeed;   // Speed (SPEED_FRACTION_BITS) the current move ramps down to
+   int32_t rampRate;       // Speed change per ms (SPEED_FRACTION_BITS) of the current move
 
    void MoveTo( uint8_t position ) override
    {
-      servo.write( position );
-      currentPosition = position;
+#if DANCE_BENCHMARK
+      RecordWrite( position );
+#endif
+      servo.Write( position );
+   }
+
+   // Servo value for a speed from -100 to 100
+   uint8_t ServoSpeed( int8_t speed )
+   {
+      // A calibrated servo's speeds are a percentage of how fast it really turns at maxSpeed,
+      // which keeps them even across the range and skips past the speeds it doesn't move at
+      RotationEstimator* rotation = servo.Rotation();
+      if ( rotation != nullptr && rotation->IsCalibrated() && speed != 0 )
+      {
+         int32_t fastest = abs( rotation->DegreesPerSecond( zeroSpeed + maxSpeed ) );
+         uint8_t value = rotation->ServoValue( fastest * speed / 100 );
+         return max( zeroSpeed - maxSpeed, min( (int)value, zeroSpeed + maxSpeed ) );
+      }
+
+      if ( speed > 0 )
+      {
+         return map( speed, 0, 100, zeroSpeed + minSpeed, zeroSpeed + maxSpeed );
+      }
+      else if ( speed < 0 )
+      {
+         return map( speed, -100, 0, zeroSpeed - maxSpeed, zeroSpeed - minSpeed );
+      }
+      return zeroSpeed;
+   }
+
+   // Speed the current move should have ramped to when it ends
+   int8_t EndSpeed()
+   {
+      DanceSpeedMove next;
+      uint8_t speed;
+
+      if ( move.speed == 0 || !moves.Peek( next, speed ) || next.isWaitMove )
+      {
+         return 0;
+      }
+
+      int8_t nextSpeed = max( -100, min( (int8_t)speed, 100 ) );
+      return (nextSpeed > 0) == (move.speed > 0) ? nextSpeed : 0;
+   }
+
+   // Speed (SPEED_FRACTION_BITS) at time within the current ramped move
+   int16_t RampedSpeed( unsigned long time, unsigned long moveEndTime )
+   {
+      int32_t speed = (int32_t)move.speed << SPEED_FRACTION_BITS;
+      int32_t rampUp = rampRate * (int32_t)(time - startMoveTime);
+      int32_t rampDown = rampRate * (int32_t)(moveEndTime - time);
+
+      speed = max( rampStartSpeed - rampUp, min( rampStartSpeed + rampUp, speed ) );
+      speed = max( rampEndSpeed - rampDown, min( rampEndSpeed + rampDown, speed ) );
+      return speed;
    }
 
 public:
-   ServoSpeedController( uint8_t pin, uint8_t zeroSpd, uint8_t minSpd, uint8_t maxSpd )
-      : zeroSpeed( zeroSpd ), minSpeed( minSpd )
+#if DANCE_BENCHMARK
+   using ServoController::stats;
+#endif
+
+   ServoSpeedController( TurretServo& turretServo, uint8_t zeroSpd, uint8_t minSpd, uint8_t maxSpd )
+      : ServoController( turretServo ), zeroSpeed( zeroSpd ), minSpeed( minSpd )
    {
       maxSpeed = maxSpd;
-      servo.attach( pin );
    }
 
-   ~ServoSpeedController()
+   void SetDanceMoves( const uint8_t moveArray[], uint16_t length )
    {
-      servo.detach();
+      Reset();
+      moves.Start( moveArray, length );
    }
 
-   void SetDanceMoves( DanceSpeedMove moveArray[], uint16_t moveCount )
+   // Plays the moves of an axis as they are streamed into danceStream
+   void SetDanceStream( DanceAxis axis )
    {
       Reset();
-      moves = new DanceSpeedMove[moveCount];
-      memcpy( moves, moveArray, moveCount * sizeof( DanceSpeedMove ) );
-      numMoves = moveCount;
+      moves.Start( danceStream, axis );
    }
 
    void Reset() override
    {
       MoveTo( zeroSpeed );
-      lastTime = millis();
-      startMoveTime = lastTime;
-      currentMoveIndex = 0;
+      lastTime = 0;
+      startMoveTime = 0;
+      moveStarted = false;
+      rampEndSpeed = 0;
 
-      if ( moves != nullptr )
-      {
-         delete[] moves;
-         moves = nullptr;
-      }
-      numMoves = 0;
+      moves.Start( nullptr, 0 );
    }
 
-   bool Update() override
+   bool Update( unsigned long routineTime ) override
    {
-      if ( currentMoveIndex >= numMoves )
+      while ( true )
       {
-         return true;
+         if ( !moveStarted )
+         {
+            uint8_t speed;
+            if ( !moves.Next( move, speed ) )
+            {
+               if ( servo.Position() != zeroSpeed )
+               {
+                  MoveTo( zeroSpeed );
+               }
+               return true;
+            }
+
+            moveStarted = true;
+            move.speed = max( -100, min( (int8_t)speed, 100 ) );
+
+            if ( move.profile != MotionProfile::Constant )
+            {
+               rampStartSpeed = rampEndSpeed;
+               rampEndSpeed = (int16_t)EndSpeed() << SPEED_FRACTION_BITS;
+               rampRate = max( ((int32_t)move.acceleration * DANCE_ACCEL_UNIT << SPEED_FRACTION_BITS) / 1000, (int32_t)1 );
+            }
+            else
+            {
+               rampEndSpeed = (int16_t)move.speed << SPEED_FRACTION_BITS;
+
+               // Wait moves always have a speed of 0, so they stop the servo.
+               // Moves that end in the same tick are skipped over without stopping in between.
+               speed = ServoSpeed( move.speed );
+               if ( speed != servo.Position() )
+               {
+                  MoveTo( speed );
+               }
+            }
+         }
+
+         unsigned long moveEndTime = startMoveTime + move.duration;
+         if ( routineTime < moveEndTime )
+         {
+            if ( move.profile != MotionProfile::Constant )
+            {
+               int16_t rampedSpeed = RampedSpeed( routineTime, moveEndTime );
+               uint8_t speed = ServoSpeed( (rampedSpeed + (1 << (SPEED_FRACTION_BITS - 1))) >> SPEED_FRACTION_BITS );
+               if ( speed != servo.Position() )
+               {
+                  MoveTo( speed );
+               }
+            }
+            break;
+         }
+
+#if DANCE_BENCHMARK
+         RecordMoveEnd( routineTime, moveEndTime );
+#endif
+         moveStarted = false;
+         startMoveTime = moveEndTime;
       }
 
-      uint16_t currentTime = millis();
-      DanceSpeedMove& move = moves[currentMoveIndex];
-      uint16_t timeElapsed = currentTime - lastTime;
-      uint16_t animTimeElapsed = currentTime - startMoveTime;
+      lastTime = routineTime;
+
+      return false;
+   }
+};
+
+#define YAW_HEADING_TOLERANCE 3 // Degrees away from a target heading that counts as being there
+#define YAW_SLOWDOWN_ANGLE 30   // Degrees away from a target heading where the yaw servo starts slowing down
+#define YAW_TURN_TIMEOUT 10000  // Milliseconds turning to a heading can take before it is given up on and the servo stopped
+
+// Controller for the yaw servo that plays a speed routine like ServoSpeedController and then turns back
+// to the heading it started at, so the turret doesn't end up facing somewhere else after every routine.
+// It steers using the heading worked out by a RotationEstimator from the speeds the servo was given,
+// so TurnTo() can also be used on its own to turn to a heading.
+// turretServo: Servo to control
+// estimator: Estimator that tracks turretServo (see TurretServo::TrackRotation())
+// zeroSpd/minSpd/maxSpd: Same as ServoSpeedController
+// maxTurnSpd: Maximum degrees/sec to turn at when heading to a target
+class ServoYawPositionController : public ServoSpeedController
+{
+private:
+   TurretServo& yawServo;
+   RotationEstimator& heading;
+   int32_t targetHeading = 0;
+   uint16_t maxTurnSpeed;
+   bool turning = false;           // Done with the routine and turning to targetHeading
+   unsigned long turnStartTime = 0; // millis() when turning to targetHeading started
+
+   void StartTurning()
+   {
+      turning = true;
+      turnStartTime = millis();
+   }
+
+   // Turns towards targetHeading, slowing down close to it so it isn't overshot between ticks.
+   // Returns true once the servo is stopped at the target, or stopped because it can't get there: the
+   // table says it doesn't turn at the speed it would need, or it has taken longer than YAW_TURN_TIMEOUT.
+   bool Steer()
+   {
+      int32_t error = targetHeading - heading.Heading();
+      uint8_t speed = heading.StopValue();
 
-      if ( !move.started )
+      if ( abs( error ) > YAW_HEADING_TOLERANCE && millis() - turnStartTime < YAW_TURN_TIMEOUT )
       {
-         move.started = true;
+         int32_t rate = min( (int32_t)maxTurnSpeed, abs( error ) * maxTurnSpeed / YAW_SLOWDOWN_ANGLE );
+         speed = heading.ServoValue( error < 0 ? -rate : rate );
 
-         uint8_t speed = zeroSpeed;
-         if ( move.speed > 0 )
-         {
-            speed = map( move.speed, 0, 100, zeroSpeed + minSpeed, zeroSpeed + maxSpeed );
-         }
-         else if ( move.speed < 0 )
+         if ( heading.DegreesPerSecond( speed ) == 0 )
          {
-            speed = map( move.speed, -100, 0, zeroSpeed - maxSpeed, zeroSpeed - minSpeed );
+            speed = heading.StopValue(); // the heading would never move, so it would never get there
          }
+      }
+
+      yawServo.Write( speed );
+      return speed == heading.StopValue();
+   }
+
+public:
+   ServoYawPositionController( TurretServo& turretServo, RotationEstimator& estimator, uint8_t zeroSpd, uint8_t minSpd, uint8_t maxSpd, uint16_t maxTurnSpd )
+      : ServoSpeedController( turretServo, zeroSpd, minSpd, maxSpd ), yawServo( turretServo ), heading( estimator ), maxTurnSpeed( maxTurnSpd )
+   {
+   }
+
+   void SetDanceMoves( const uint8_t moveArray[], uint16_t length )
+   {
+      ServoSpeedController::SetDanceMoves( moveArray, length );
+      turning = false;
+      targetHeading = heading.Heading();
+   }
+
+   void SetDanceStream( DanceAxis axis )
+   {
+      ServoSpeedController::SetDanceStream( axis );
+      turning = false;
+      targetHeading = heading.Heading();
+   }
+
+   // Turns to a heading (degrees, see RotationEstimator::Heading()) instead of playing a routine.
+   // Keep calling Update() until it returns true.
+   void TurnTo( int32_t degrees )
+   {
+      ServoSpeedController::Reset();
+      StartTurning();
+      targetHeading = degrees;
+   }
+
+   void Reset() override
+   {
+      ServoSpeedController::Reset();
+      turning = false;
+   }
 
-         if ( !move.isWaitMove )
+   bool Update( unsigned long routineTime ) override
+   {
+      if ( !turning )
+      {
+         if ( !ServoSpeedController::Update( routineTime ) )
          {
-            MoveTo( speed );
+            return false;
          }
+         StartTurning();
       }
 
-      if ( animTimeElapsed >= move.duration )
-      {
-         currentMoveIndex++;
-         startMoveTime = millis();
-         MoveTo( zeroSpeed );
-      }
+      return Steer();
+   }
+};
 
-      lastTime = currentTime;
+#define ANGLE_FRACTION_BITS 16   // Pitch angles are tracked in fixed point with this many bits for the fraction of a degree
+#define PROFILE_FRACTION_BITS 24 // Speeds and accelerations of profiled pitch moves are tracked with this many bits for the fraction of a degree
 
-      return false;
+// Converts degrees/sec, degrees/sec^2 or degrees/sec^3 to degrees/ms^n in fixed point (PROFILE_FRACTION_BITS).
+// msPerSecondN is 1000, 1000000 or 1000000000. Only meant for constants so it is worked out when compiling.
+constexpr int32_t ProfileRate( uint64_t degreesPerSecondN, uint64_t msPerSecondN )
+{
+   return (int32_t)(((degreesPerSecondN << PROFILE_FRACTION_BITS) + msPerSecondN / 2) / msPerSecondN);
+}
+
+// Integer square root, rounded down
+inline uint16_t SquareRoot( uint32_t value )
+{
+   uint32_t root = 0;
+   for ( uint32_t bit = 1UL << 30; bit > 0; bit >>= 2 )
+   {
+      if ( value >= root + bit )
+      {
+         value -= root + bit;
+         root = (root >> 1) + bit;
+      }
+      else
+      {
+         root >>= 1;
+      }
    }
-};
+   return root;
+}
 
 // Controller to define properties for a servo that lets you set an angle.
 // This is for the pitch servo.
-// pin: Arduino pin for servo
+// turretServo: Servo to control
 // minAng: Minimum angle allowed. Prevents rotating too much in one direction.
 // maxAng: Maximum angle allowed. Prevents rotating too much in one direction.
 // maxSpd: Maximum degrees/sec movement allowed
-// moveArray: Array of dance moves to perform
+// moveArray: Packed PROGMEM routine of dance moves to perform (see DanceMove.h)
+// Moves with a Trapezoid or SCurve profile are stepped 1ms at a time: the servo speeds up towards the
+// speed that gets it to the target in time and starts slowing down once the target is within its stopping
+// distance. They carry on from the speed the last move left off at, so a move that couldn't reach its
+// target in time flows into the next one instead of stopping dead.
+// An offset (e.g. recoil, see RecoilLayer.h) can be added on top of the routine with SetOffset().
 class ServoAngleController : ServoController
 {
 private:
-   DanceAngleMove* moves = nullptr;
+   DanceAngleMove move; // Move that is currently playing
    uint8_t minAngle;
    uint8_t maxAngle;
+   uint8_t angle;         // Angle the routine is at, without the offset
+   int16_t offset = 0;    // Degrees added to angle when writing to the servo
+   int32_t exactPosition; // Current angle in fixed point (ANGLE_FRACTION_BITS fraction bits)
+   int32_t exactTarget;   // Target angle of the current move in fixed point (ANGLE_FRACTION_BITS fraction bits)
+   int32_t velocity;      // Degrees/ms of the current move in fixed point (ANGLE_FRACTION_BITS fraction bits)
+   bool velocityCapped;   // velocity was cut down to the max speed, so the move doesn't get to its target in time
+
+   // State of profiled moves. These are all in fixed point (PROFILE_FRACTION_BITS fraction bits).
+   int32_t profileVelocity;     // Degrees/ms
+   int32_t profileAcceleration; // Degrees/ms^2
+   int32_t cruiseSpeed;         // Degrees/ms the current move is planned to travel at
+   int32_t maxAcceleration;     // Degrees/ms^2 of the current move
+   int32_t maxJerk;             // Degrees/ms^3 of the current move, 0 if the acceleration isn't ramped
+   uint16_t jerkTime;           // ms it takes to ramp the acceleration from 0 to maxAcceleration
+
+   // True if speed is what distance / duration comes to (rounded towards 0), which only takes a multiplication to check
+   static bool IsSpeedFor( int16_t speed, int32_t distance, uint16_t duration )
+   {
+      uint32_t covered = (uint32_t)abs( (int32_t)speed ) * duration;
+      uint32_t length = abs( distance );
+      return (speed == 0 || (speed < 0) == (distance < 0)) && covered <= length && length - covered < duration;
+   }
+
+   // Distance (ANGLE_FRACTION_BITS) it takes to come to a stop from speed
+   uint32_t StoppingDistance( int32_t speed )
+   {
+      return (uint32_t)(speed >> (PROFILE_FRACTION_BITS - ANGLE_FRACTION_BITS)) * (speed / maxAcceleration + jerkTime) / 2;
+   }
+
+   // How much the speed still changes while the acceleration is ramped from acceleration down to 0
+   uint32_t RampSpeed( int32_t acceleration )
+   {
+      return (uint32_t)(acceleration / maxJerk) * acceleration / 2;
+   }
+
+   // Works out the speed that gets the servo from rest to exactTarget in move.duration,
+   // including the time spent speeding up and slowing down
+   void PlanProfile()
+   {
+      int32_t maxVelocity = (int32_t)maxSpeed * ProfileRate( 1, 1000 );
+
+      maxAcceleration = max( (int32_t)move.acceleration * ProfileRate( DANCE_ACCEL_UNIT, 1000000UL ), (int32_t)1 );
+      maxJerk = move.profile == MotionProfile::SCurve ? (int32_t)move.jerk * ProfileRate( DANCE_JERK_UNIT, 1000000000UL ) : 0;
+      jerkTime = maxJerk > 0 ? maxAcceleration / maxJerk : 0;
+
+      // Solving distance = speed * (duration - jerkTime - speed / acceleration) for speed
+      uint32_t distance = abs( exactTarget - exactPosition );
+      uint32_t time = move.duration > jerkTime ? move.duration - jerkTime : 0;
+      uint32_t rampTime = ((distance << (PROFILE_FRACTION_BITS - ANGLE_FRACTION_BITS)) / maxAcceleration) * 4;
+
+      cruiseSpeed = maxVelocity;
+      if ( time * time > rampTime )
+      {
+         uint32_t speed = 2 * distance / (time + SquareRoot( time * time - rampTime ));
+         cruiseSpeed = min( (int32_t)(speed << (PROFILE_FRACTION_BITS - ANGLE_FRACTION_BITS)), maxVelocity );
+      }
+      cruiseSpeed = max( cruiseSpeed, maxAcceleration );
+   }
+
+   // Moves the servo 1ms along the current profiled move
+   void StepProfile()
+   {
+      int32_t remaining = exactTarget - exactPosition;
+      if ( remaining == 0 && profileVelocity == 0 )
+      {
+         profileAcceleration = 0;
+         return;
+      }
+
+      // Work in the direction of the target so that positive speeds are towards it
+      int8_t direction = remaining < 0 ? -1 : 1;
+      uint32_t distance = abs( remaining );
+      int32_t speed = profileVelocity * direction;
+      int32_t acceleration = profileAcceleration * direction;
+
+      int32_t targetAcceleration = 0;
+      if ( speed > 0 && StoppingDistance( speed ) >= distance )
+      {
+         targetAcceleration = -maxAcceleration;
+         if ( maxJerk > 0 && acceleration < 0 && (uint32_t)speed <= RampSpeed( -acceleration ) )
+         {
+            targetAcceleration = 0; // Ease off the brakes so the acceleration is back to 0 when the servo stops
+         }
+      }
+      else if ( speed < cruiseSpeed )
+      {
+         targetAcceleration = maxAcceleration;
+         if ( maxJerk > 0 && acceleration > 0 && (uint32_t)(cruiseSpeed - speed) <= RampSpeed( acceleration ) )
+         {
+            targetAcceleration = 0; // Ease off so the acceleration is back to 0 when cruise speed is reached
+         }
+      }
+
+      if ( maxJerk > 0 )
+      {
+         acceleration += max( -maxJerk, min( maxJerk, targetAcceleration - acceleration ) );
+      }
+      else
+      {
+         acceleration = targetAcceleration;
+      }
+
+      int32_t newSpeed = min( speed + acceleration, max( cruiseSpeed, speed ) );
+      if ( acceleration < 0 && speed >= 0 && newSpeed < 0 )
+      {
+         // Braking stops the servo, it doesn't send it back the other way
+         newSpeed = 0;
+         acceleration = 0;
+      }
+
+      exactPosition += (newSpeed >> (PROFILE_FRACTION_BITS - ANGLE_FRACTION_BITS)) * direction;
+      if ( (exactTarget - exactPosition) * direction <= 0 )
+      {
+         exactPosition = exactTarget;
+         newSpeed = 0;
+         acceleration = 0;
+      }
+
+      profileVelocity = newSpeed * direction;
+      profileAcceleration = acceleration * direction;
+   }
 
    void MoveTo( uint8_t position ) override
    {
-      position = max( minAngle, min( maxAngle, position ) );
-      servo.write( position );
-      currentPosition = position;
+      angle = max( minAngle, min( maxAngle, position ) );
+      position = constrain( angle + offset, minAngle, maxAngle );
+#if DANCE_BENCHMARK
+      RecordWrite( position );
+#endif
+      servo.Write( position );
    }
 
 public:
-   ServoAngleController( uint8_t pin, uint8_t minAng, uint8_t maxAng, uint16_t maxSpd )
-      : minAngle( minAng ), maxAngle( maxAng )
+#if DANCE_BENCHMARK
+   using ServoController::stats;
+#endif
+
+   ServoAngleController( TurretServo& turretServo, uint8_t minAng, uint8_t maxAng, uint16_t maxSpd )
+      : ServoController( turretServo ), minAngle( minAng ), maxAngle( maxAng )
    {
       maxSpeed = maxSpd;
-      servo.attach( pin );
 
-      MoveTo( minAngle + (double( maxAngle - minAngle ) / 2.0) );
+      // Start from wherever the servo already is, only moving it if it is outside the allowed angles
+      MoveTo( servo.Position() );
+      exactPosition = (int32_t)servo.Position() << ANGLE_FRACTION_BITS;
+      exactTarget = exactPosition;
+      velocityCapped = false;
+      profileVelocity = 0;
+      profileAcceleration = 0;
    }
 
-   ~ServoAngleController()
+   void SetDanceMoves( const uint8_t moveArray[], uint16_t length )
    {
-      servo.detach();
+      Reset();
+      moves.Start( moveArray, length );
    }
 
-   void SetDanceMoves( DanceAngleMove moveArray[], int moveCount )
+   // Plays the moves of an axis as they are streamed into danceStream
+   void SetDanceStream( DanceAxis axis )
    {
       Reset();
-      moves = new DanceAngleMove[moveCount];
-      memcpy( moves, moveArray, moveCount * sizeof( DanceAngleMove ) );
-      numMoves = moveCount;
+      moves.Start( danceStream, axis );
    }
 
-   void Reset() override
+   // Adds degrees to every angle written from now on (still kept within the allowed angles),
+   // moving the servo right away if it changed. Works whether a routine is playing or not.
+   void SetOffset( int16_t degrees )
    {
-      lastTime = millis();
-      startMoveTime = lastTime;
-      currentMoveIndex = 0;
-
-      if ( moves != nullptr )
+      if ( degrees != offset )
       {
-         delete[] moves;
-         moves = nullptr;
+         offset = degrees;
+         MoveTo( angle );
       }
-      numMoves = 0;
    }
 
-   bool Update() override
+   // Angle the routine is at, without the offset
+   uint8_t Angle() const
    {
-      if ( currentMoveIndex >= numMoves )
-      {
-         return true;
-      }
+      return angle;
+   }
 
-      unsigned long currentTime = millis();
-      DanceAngleMove& move = moves[currentMoveIndex];
-      unsigned long timeElapsed = currentTime - lastTime;
-      double secsElapsed = (double)timeElapsed / 1000.0;
-      auto targetAngle = max( minAngle, min( maxAngle, move.targetAngle ) );
-      unsigned long animTimeElapsed = currentTime - startMoveTime;
+   void Reset() override
+   {
+      lastTime = 0;
+      startMoveTime = 0;
+      moveStarted = false;
+      exactTarget = exactPosition;
+      profileVelocity = 0;
+      profileAcceleration = 0;
+
+      moves.Start( nullptr, 0 );
+   }
 
-      if ( !move.started )
+   bool Update( unsigned long routineTime ) override
+   {
+      while ( true )
       {
-         move.started = true;
-         move.speed = ((double)targetAngle - currentPosition) / ((double)move.duration / 1000.0);
-
-         auto spd = move.speed;
-         if ( move.speed < 0 )
-         {
-            move.speed = max( -maxSpeed, move.speed );
-         }
-         else
+         if ( !moveStarted )
          {
-            move.speed = min( maxSpeed, move.speed );
+            if ( !moves.Next( move, move.targetAngle ) )
+            {
+               return true;
+            }
+
+            moveStarted = true;
+
+            // Waits keep the last target so that a profiled move can finish slowing down during them
+            if ( !move.isWaitMove )
+            {
+               move.targetAngle = max( minAngle, min( maxAngle, move.targetAngle ) );
+               exactTarget = (int32_t)move.targetAngle << ANGLE_FRACTION_BITS;
+            }
+
+            if ( move.profile != MotionProfile::Constant )
+            {
+               PlanProfile();
+            }
+            else
+            {
+               profileVelocity = 0;
+               profileAcceleration = 0;
+
+               // Speed needed to reach the target by the end of the move, capped to the max speed. Routines from
+               // the routine compiler come with it worked out, which saves a division when the servo is where the
+               // routine expects it to be.
+               int32_t maxVelocity = ((int32_t)maxSpeed << ANGLE_FRACTION_BITS) / 1000;
+               int32_t distance = exactTarget - exactPosition;
+               uint16_t duration = max( move.duration, (uint16_t)1 );
+               velocity = move.hasPlannedSpeed && IsSpeedFor( move.plannedSpeed, distance, duration ) ? move.plannedSpeed : distance / (int32_t)duration;
+               velocityCapped = velocity < -maxVelocity || velocity > maxVelocity;
+               velocity = max( -maxVelocity, min( maxVelocity, velocity ) );
+            }
          }
-      }
 
-      auto amtToMove = (double)move.speed * secsElapsed;
+         // Only move for the part of this tick that belongs to the current move
+         unsigned long moveEndTime = startMoveTime + move.duration;
+         unsigned long stepEndTime = min( routineTime, moveEndTime );
 
-      auto minMove = 1;
-      if ( (amtToMove >= minMove) || (animTimeElapsed >= move.duration) )
-      {
-         auto newPosition = currentPosition + amtToMove;
-         if ( move.speed < 0 )
+         if ( move.profile != MotionProfile::Constant )
          {
-            newPosition = max( targetAngle, newPosition );
+            for ( unsigned long time = lastTime; time < stepEndTime; time++ )
+            {
+               StepProfile();
+            }
          }
-         else
+         else if ( !move.isWaitMove )
          {
-            newPosition = min( targetAngle, newPosition );
+            // Keep the fraction of a degree that was moved so that slow moves still progress every tick
+            exactPosition += velocity * (int32_t)(stepEndTime - lastTime);
+
+            if ( velocity < 0 )
+            {
+               exactPosition = max( exactTarget, exactPosition );
+            }
+            else
+            {
+               exactPosition = min( exactTarget, exactPosition );
+            }
+
+            // Rounding the speed down leaves the move a fraction of a degree short, so it is put right on the target.
+            // Every move then starts from a whole angle, which is what the routine compiler works out speeds from.
+            if ( routineTime >= moveEndTime && !velocityCapped )
+            {
+               exactPosition = exactTarget;
+            }
          }
 
-         if ( !move.isWaitMove )
+         uint8_t newPosition = (exactPosition + (1L << (ANGLE_FRACTION_BITS - 1))) >> ANGLE_FRACTION_BITS;
+         if ( newPosition != angle )
          {
             MoveTo( newPosition );
          }
 
-         lastTime = currentTime;
-      }
+         lastTime = stepEndTime;
 
-      if ( animTimeElapsed >= move.duration )
-      {
-         currentMoveIndex++;
-         startMoveTime = millis();
+         if ( routineTime < moveEndTime )
+         {
+            break;
+         }
+
+#if DANCE_BENCHMARK
+         RecordMoveEnd( routineTime, moveEndTime );
+#endif
+         moveStarted = false;
+         startMoveTime = moveEndTime;
       }
 
       return false;
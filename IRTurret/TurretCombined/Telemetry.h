@@ -0,0 +1,210 @@
+#pragma once
+
+#include <Arduino.h>
+
+#ifndef TELEMETRY_ENABLED
+#define TELEMETRY_ENABLED 0     // Set to 1 to send timing frames over Serial
+#endif
+#define TELEMETRY_INTERVAL 1000 // Milliseconds between telemetry frames
+
+#define TELEMETRY_SYNC1 0xA5
+#define TELEMETRY_SYNC2 0x5A
+
+// Binary frame that is written to Serial every TELEMETRY_INTERVAL ms. Multi-byte values are little endian.
+// All values cover the time since the previous frame.
+// sync1/sync2: Always 0xA5 0x5A so a reader can find the start of a frame
+// length: Size of the whole frame in bytes
+// program: Index of the program that was running when the frame was sent
+// loops: Number of times loop() ran
+// loopMin/loopMax/loopAvg: Time (us) loop() took, not counting its delay
+// programMax/programAvg: Time (us) the current program's Loop() took
+// commands: Number of IR commands handled
+// latencyMax/latencyAvg: Time (ms) from an IR command being received to the first servo write after it
+// servoWrites: Number of servo writes
+// irDropped: Total number of IR frames dropped because the command queue was full
+// checksum: XOR of every byte before it
+struct __attribute__( (packed) ) TelemetryFrame
+{
+   uint8_t sync1;
+   uint8_t sync2;
+   uint8_t length;
+   uint8_t program;
+   uint16_t loops;
+   uint32_t loopMin;
+   uint32_t loopMax;
+   uint32_t loopAvg;
+   uint32_t programMax;
+   uint32_t programAvg;
+   uint16_t commands;
+   uint16_t latencyMax;
+   uint16_t latencyAvg;
+   uint16_t servoWrites;
+   uint16_t irDropped;
+   uint8_t checksum;
+};
+
+#define EVENT_SYNC2 0x5E
+
+// Events sent in an EventFrame
+#define EVENT_BARREL_EMPTY 0x01 // The last dart was fired, or a shot was asked for with none left
+
+// Binary frame written to Serial as soon as something happens, whether or not TELEMETRY_ENABLED is set. It is
+// framed like TelemetryFrame rather than sent as text, so it can't be mistaken for part of a telemetry frame or
+// a dance stream reply by a program reading those.
+// sync1/sync2: Always 0xA5 0x5E
+// length: Size of the whole frame in bytes
+// event: One of the EVENT_ values
+// checksum: XOR of every byte before it
+struct __attribute__( (packed) ) EventFrame
+{
+   uint8_t sync1;
+   uint8_t sync2;
+   uint8_t length;
+   uint8_t event;
+   uint8_t checksum;
+};
+
+inline void SendEvent( uint8_t event )
+{
+   EventFrame frame = { TELEMETRY_SYNC1, EVENT_SYNC2, sizeof( EventFrame ), event, 0 };
+   frame.checksum = frame.sync1 ^ frame.sync2 ^ frame.length ^ frame.event;
+   Serial.write( (const uint8_t*)&frame, sizeof( EventFrame ) );
+}
+
+// Collects loop timing and sends it as a TelemetryFrame. Every method does nothing when
+// TELEMETRY_ENABLED is 0, so the calls can be left in place.
+class Telemetry
+{
+public:
+   void LoopStart()
+   {
+#if TELEMETRY_ENABLED
+      loopStartTime = micros();
+#endif
+   }
+
+   void LoopEnd()
+   {
+#if TELEMETRY_ENABLED
+      auto duration = micros() - loopStartTime;
+      loopMin = frame.loops == 0 ? duration : min( loopMin, duration );
+      loopMax = max( loopMax, duration );
+      loopTotal += duration;
+      frame.loops++;
+#endif
+   }
+
+   void ProgramStart()
+   {
+#if TELEMETRY_ENABLED
+      programStartTime = micros();
+#endif
+   }
+
+   void ProgramEnd()
+   {
+#if TELEMETRY_ENABLED
+      auto duration = micros() - programStartTime;
+      programMax = max( programMax, duration );
+      programTotal += duration;
+#endif
+   }
+
+   // An IR command that was received at receivedTime (millis) is about to be handled
+   void CommandReceived( unsigned long receivedTime )
+   {
+#if TELEMETRY_ENABLED
+      frame.commands++;
+      commandTime = receivedTime;
+      waitingForWrite = true;
+#else
+      (void)receivedTime;
+#endif
+   }
+
+   void ServoWritten()
+   {
+#if TELEMETRY_ENABLED
+      frame.servoWrites++;
+
+      if ( waitingForWrite )
+      {
+         waitingForWrite = false;
+         uint16_t latency = min( millis() - commandTime, 0xFFFFUL );
+         frame.latencyMax = max( frame.latencyMax, latency );
+         latencyTotal += latency;
+         latencyCount++;
+      }
+#endif
+   }
+
+   // Sends a frame if it is time to. program is the index of the running program and irDropped is
+   // the total number of dropped IR frames.
+   void Send( uint8_t program, uint16_t irDropped )
+   {
+#if TELEMETRY_ENABLED
+      auto now = millis();
+      if ( now - lastSendTime < TELEMETRY_INTERVAL )
+      {
+         return;
+      }
+      lastSendTime = now;
+
+      frame.sync1 = TELEMETRY_SYNC1;
+      frame.sync2 = TELEMETRY_SYNC2;
+      frame.length = sizeof( TelemetryFrame );
+      frame.program = program;
+      frame.loopMin = loopMin;
+      frame.loopMax = loopMax;
+      frame.loopAvg = frame.loops > 0 ? loopTotal / frame.loops : 0;
+      frame.programMax = programMax;
+      frame.programAvg = frame.loops > 0 ? programTotal / frame.loops : 0;
+      frame.latencyAvg = latencyCount > 0 ? latencyTotal / latencyCount : 0;
+      frame.irDropped = irDropped;
+
+      const uint8_t* bytes = (const uint8_t*)&frame;
+      frame.checksum = 0;
+      for ( uint8_t i = 0; i < sizeof( TelemetryFrame ) - 1; i++ )
+      {
+         frame.checksum ^= bytes[i];
+      }
+
+      // Skip the frame instead of blocking the loop if the Serial buffer doesn't have room for it
+      if ( Serial.availableForWrite() >= (int)sizeof( TelemetryFrame ) )
+      {
+         Serial.write( bytes, sizeof( TelemetryFrame ) );
+      }
+
+      memset( &frame, 0, sizeof( TelemetryFrame ) );
+      loopMin = 0;
+      loopMax = 0;
+      loopTotal = 0;
+      programMax = 0;
+      programTotal = 0;
+      latencyTotal = 0;
+      latencyCount = 0;
+#else
+      (void)program;
+      (void)irDropped;
+#endif
+   }
+
+#if TELEMETRY_ENABLED
+private:
+   TelemetryFrame frame = {};
+   unsigned long lastSendTime = 0;
+   unsigned long loopStartTime = 0;
+   unsigned long loopMin = 0;
+   unsigned long loopMax = 0;
+   unsigned long loopTotal = 0;
+   unsigned long programStartTime = 0;
+   unsigned long programMax = 0;
+   unsigned long programTotal = 0;
+   unsigned long commandTime = 0;
+   bool waitingForWrite = false;
+   unsigned long latencyTotal = 0;
+   uint16_t latencyCount = 0;
+#endif
+};
+
+Telemetry telemetry;
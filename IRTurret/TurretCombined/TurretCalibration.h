@@ -0,0 +1,193 @@
+#pragma once
+
+#include <Arduino.h>
+#include "Utils.h"
+#include "BaseProgram.h"
+#include "RotationEstimator.h"
+#include "TurretConfig.h"
+#include "TurretHardware.h"
+
+#define CALIBRATION_SWEEP_TIME 250 // Milliseconds spent at each speed while looking for the slowest speed a servo turns at
+
+enum class CalibrationState : uint8_t
+{
+   Waiting,  // Waiting for ok to start on the next servo
+   Sweeping, // Speeding the servo up a little at a time until ok is pressed when it starts turning
+   Timing,   // Timing a full turn at each speed in the table, ok is pressed every time it gets back round
+   Done
+};
+
+// Measures how fast the yaw and roll servos really turn at different speeds and saves it to EEPROM, so
+// dancing, the yaw heading and firing use the speeds of this turret instead of rough defaults.
+// Take the darts out and put a mark on the base and on the barrel to watch. For each servo (yaw first, then roll):
+//   - Press ok to start. The servo speeds up a little at a time, press ok as soon as it starts turning.
+//   - It then turns at faster and faster speeds. Press ok every time the mark gets back round to where it was.
+// Only one direction is measured and it is used for both. Both servos are saved once the roll servo is done,
+// pressing star stops without saving.
+class TurretCalibrationProgram : public BaseProgram
+{
+public:
+   TurretCalibrationProgram( TurretHardware& turretHardware )
+      : hardware( turretHardware )
+   {
+   }
+
+   void Setup() override
+   {
+      hardware.Stop();
+      memcpy( yawSpeeds, hardware.yawHeading.Table(), sizeof( yawSpeeds ) );
+      memcpy( rollSpeeds, hardware.rollRotation.Table(), sizeof( rollSpeeds ) );
+      servoIndex = 0;
+      state = CalibrationState::Waiting;
+   }
+
+   void Loop( uint16_t cmd ) override
+   {
+      auto now = millis();
+
+      if ( cmd == star )
+      {
+         hardware.Stop();
+         state = CalibrationState::Done;
+         return;
+      }
+
+      switch ( state )
+      {
+         case CalibrationState::Waiting:
+         {
+            if ( cmd == ok )
+            {
+               offset = 0;
+               stepStartTime = now;
+               state = CalibrationState::Sweeping;
+            }
+            break;
+         }
+         case CalibrationState::Sweeping:
+         {
+            if ( cmd == ok )
+            {
+               // Speeds in the table below where the servo started turning stay at 0
+               uint16_t* table = Table();
+               tableIndex = max( 1, (offset + ROTATION_TABLE_STEP - 1) / ROTATION_TABLE_STEP );
+               for ( uint8_t i = 0; i < tableIndex; i++ )
+               {
+                  table[i] = 0;
+               }
+               StartTiming( now );
+            }
+            else if ( now - stepStartTime >= CALIBRATION_SWEEP_TIME )
+            {
+               if ( offset >= ROTATION_TABLE_STEP * (ROTATION_TABLE_SIZE - 1) )
+               {
+                  // Never saw it move, so start this servo over
+                  hardware.Stop();
+                  state = CalibrationState::Waiting;
+                  break;
+               }
+
+               offset++;
+               stepStartTime = now;
+               Servo().Write( Servo().Rotation()->StopValue() + offset );
+            }
+            break;
+         }
+         case CalibrationState::Timing:
+         {
+            // A full turn is 360 degrees. A press so soon after the last one that the speed wouldn't fit in the
+            // table can't be a full turn (e.g. a double press), so it is ignored.
+            if ( cmd == ok && now - stepStartTime > 360000UL / 0xFFFF )
+            {
+               // Faster speeds never turn slower than the one before, even if ok was pressed late
+               uint16_t* table = Table();
+               table[tableIndex] = 360000UL / (now - stepStartTime);
+               table[tableIndex] = max( table[tableIndex], table[tableIndex - 1] );
+
+               tableIndex++;
+               if ( tableIndex < ROTATION_TABLE_SIZE )
+               {
+                  StartTiming( now );
+               }
+               else
+               {
+                  NextServo();
+               }
+            }
+            break;
+         }
+         default:
+         {
+            break;
+         }
+      }
+   }
+
+   // Holding ok down sends repeat frames every ~110ms, which would count as more presses. They are
+   // ignored, so every mark needs its own press.
+   void LoopRepeat( uint16_t ) override
+   {
+      Loop( (uint16_t)-1 );
+   }
+
+   bool CanShutdown() override
+   {
+      return state == CalibrationState::Waiting || state == CalibrationState::Done;
+   }
+
+   void Shutdown() override
+   {
+      hardware.Stop();
+      state = CalibrationState::Done;
+   }
+
+private:
+   TurretHardware& hardware; // servos that are lent to this program while it is running
+
+   uint16_t yawSpeeds[ROTATION_TABLE_SIZE];  // Tables being measured, starting from the ones in use
+   uint16_t rollSpeeds[ROTATION_TABLE_SIZE];
+   CalibrationState state = CalibrationState::Waiting;
+   uint8_t servoIndex = 0;          // 0 for yaw, 1 for roll
+   uint8_t offset = 0;              // How far away from the stop speed the servo is being run while sweeping
+   uint8_t tableIndex = 0;          // Entry of the table being timed
+   unsigned long stepStartTime = 0; // When the current sweep step or timed turn started
+
+   TurretServo& Servo()
+   {
+      return servoIndex == 0 ? hardware.yaw : hardware.roll;
+   }
+
+   uint16_t* Table()
+   {
+      return servoIndex == 0 ? yawSpeeds : rollSpeeds;
+   }
+
+   // Starts turning at the speed for tableIndex. The mark should be lined up when this is called.
+   void StartTiming( unsigned long now )
+   {
+      Servo().Write( Servo().Rotation()->StopValue() + tableIndex * ROTATION_TABLE_STEP );
+      stepStartTime = now;
+      state = CalibrationState::Timing;
+   }
+
+   void NextServo()
+   {
+      hardware.Stop();
+
+      if ( servoIndex == 0 )
+      {
+         servoIndex = 1;
+         state = CalibrationState::Waiting;
+         return;
+      }
+
+      memcpy( config.yawSpeeds, yawSpeeds, sizeof( yawSpeeds ) );
+      memcpy( config.rollSpeeds, rollSpeeds, sizeof( rollSpeeds ) );
+      config.servosCalibrated = 1;
+      config.Save();
+
+      hardware.yawHeading.SetTable( yawSpeeds );
+      hardware.rollRotation.SetTable( rollSpeeds );
+      state = CalibrationState::Done;
+   }
+};
@@ -2,53 +2,44 @@
 #include "TurretControl.h"
 #include "TurretRoulette.h"
 #include "TurretDance.h"
+#include "TurretCalibration.h"
 #include "Utils.h"
 #include "BaseProgram.h"
+#include "IrCommandQueue.h"
+#include "ConfigConsole.h"
+#include "DanceStream.h"
+#include "TurretConfig.h"
+#include "Telemetry.h"
+#include "ProgramRegistry.h"
+#include "TurretHardware.h"
 #include <IRremote.hpp>
 
-#define DECODE_NEC // Defines the type of IR transmission to decode based on the remote. See IRremote library for examples on how to decode other types of remote
+#define HOT_PROGRAM_SWITCH 1      // Set to 0 to only allow switching programs when the running one is idle
+#define HOT_SWITCH_STOP_TIME 50   // Max milliseconds spent slowing the servos down when switching away from a busy program
 
-enum ProgramType { TurretControl, TurretRoulette, TurretDance };
+#define DECODE_NEC // Defines the type of IR transmission to decode based on the remote. See IRremote library for examples on how to decode other types of remote
 
-struct ProgramPair {
-   ProgramType type;
-   BaseProgram* program;
-};
-
-ProgramPair programs[] =
-{
-   { TurretControl, new TurretControlProgram() },
-   { TurretRoulette, new TurretRouletteProgram() },
-   { TurretDance, new TurretDanceProgram() }
-};
+TurretHardware turret;
+ProgramRegistry programs( turret );
 
 bool isSelectingProgram = false;
 
 BaseProgram* currentProgram = nullptr;
+ProgramType currentProgramType = TurretControl;
 
 void setup()
 {
    Serial.begin( 115200 );
 
-   IrReceiver.begin( 9, ENABLE_LED_FEEDBACK );
-
-   currentProgram = GetProgram( TurretControl );
+   irCommands.Begin( 9 );
 
-   SetupProgram();
-}
+   config.Load();
+   turret.Begin();
 
-BaseProgram* GetProgram( ProgramType type )
-{
-   for ( int i = 0; i < sizeof( programs ) / sizeof( programs[0] ); i++ )
-   {
-      if ( programs[i].type == type )
-      {
-         return programs[i].program;
-         break;
-      }
-   }
+   currentProgramType = TurretControl;
+   currentProgram = programs.Create( currentProgramType );
 
-   return nullptr;
+   SetupProgram();
 }
 
 void SetupProgram()
@@ -57,6 +48,8 @@ void SetupProgram()
    {
       currentProgram->Setup();
    }
+
+   irCommands.SetAimPreemption( currentProgram != nullptr && currentProgram->PreemptsAim() );
 }
 
 bool CanShutdownProgram()
@@ -65,6 +58,7 @@ bool CanShutdownProgram()
    {
       return currentProgram->CanShutdown();
    }
+   return true;
 }
 
 void ShutdownProgram()
@@ -77,40 +71,69 @@ void ShutdownProgram()
 
 void ChangeProgram( ProgramType newProgramType )
 {
-   if ( CanShutdownProgram() )
+   if ( !HOT_PROGRAM_SWITCH && !CanShutdownProgram() )
    {
-      isSelectingProgram = false;
+      return;
+   }
 
-      auto newProgram = GetProgram( newProgramType );
+   isSelectingProgram = false;
 
-      if ( newProgram != nullptr )
-      {
-         currentProgram->Shutdown();
+   if ( !CanShutdownProgram() )
+   {
+      // The program is in the middle of something, so bring the servos to a quick stop before
+      // it cancels everything in Shutdown(). The new program starts from wherever the servos end up.
+      turret.StopWithin( HOT_SWITCH_STOP_TIME );
+   }
 
-         currentProgram = newProgram;
-         currentProgram->Setup();
-      }
+   ShutdownProgram();
 
-      isSelectingProgram = false;
+   currentProgram = programs.Create( newProgramType );
+   currentProgramType = newProgramType;
+   SetupProgram();
+}
+
+// Bytes from Serial either belong to a dance stream frame or are typed into the config console
+void ReadSerial()
+{
+   while ( Serial.available() > 0 )
+   {
+      uint8_t c = Serial.read();
+      if ( !danceStream.Receive( c ) )
+      {
+         configConsole.Receive( c );
+      }
    }
 }
 
-void ProgramLoop( uint16_t cmd )
+void ProgramLoop( uint16_t cmd, bool isRepeat )
 {
-   currentProgram->Loop( cmd );
+   telemetry.ProgramStart();
+   if ( isRepeat )
+   {
+      currentProgram->LoopRepeat( cmd );
+   }
+   else
+   {
+      currentProgram->Loop( cmd );
+   }
+   telemetry.ProgramEnd();
 }
 
 void loop()
 {
-   if ( IrReceiver.decode() )
+   telemetry.LoopStart();
+
+   // Commands are queued from the IR interrupt, so ones that arrive while a program is busy aren't lost
+   IrCommand irCommand;
+   if ( irCommands.Pop( irCommand ) )
    {
-      IrReceiver.resume();
+      telemetry.CommandReceived( irCommand.time );
 
-      switch ( IrReceiver.decodedIRData.command )
+      switch ( irCommand.command )
       {
          case cmd0:
          {
-            if ( !isSelectingProgram && CanShutdownProgram() )
+            if ( !isSelectingProgram && (HOT_PROGRAM_SWITCH || CanShutdownProgram()) )
             {
                isSelectingProgram = true;
             }
@@ -140,18 +163,30 @@ void loop()
             }
             break;
          }
+         case cmd9:
+         {
+            if ( isSelectingProgram )
+            {
+               ChangeProgram( TurretCalibration );
+            }
+            break;
+         }
          default:
          {
             break;
          }
       }
 
-      ProgramLoop( IrReceiver.decodedIRData.command );
+      ProgramLoop( irCommand.command, irCommand.isRepeat );
    }
    else
    {
-      ProgramLoop( -1 );
+      ProgramLoop( -1, false );
    }
 
+   telemetry.LoopEnd();
+   telemetry.Send( currentProgramType, irCommands.DroppedCount() );
+   ReadSerial();
+
    delay( 5 );
 }
\ No newline at end of file
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "Crc16.h"
+#include "RotationEstimator.h"
+
+#define YAW_SERVO_PIN    10   // Pin for yaw servo
+#define PITCH_SERVO_PIN  11   // Pin for pitch servo
+#define ROLL_SERVO_PIN   12   // Pin for roll servo
+
+#define YAW_STOP_SPEED   90   // Value that keeps the yaw servo stationary
+#define ROLL_STOP_SPEED  90   // Value that keeps the roll servo stationary
+#define PITCH_HOME_ANGLE 100  // Angle the pitch servo starts at when the turret powers on
+
+#define RECOIL_FIRE_AMOUNT 24 // Degrees the pitch servo kicks up by at the top of the recoil after each shot
+#define RECOIL_RISE_TIME  150 // Milliseconds the recoil takes to kick up
+#define RECOIL_DECAY_TIME 150 // Milliseconds the recoil takes to fall back to where the pitch servo is aimed
+
+#define BARREL_CHAMBERS 6     // Darts the barrel holds
+#define BURST_SIZE     6      // Darts fired by a burst (star), a burst stops early if the barrel runs out
+#define BURST_INTERVAL 0      // Milliseconds between the shots of a burst, anything shorter than one barrel turn fires them back to back
+
+#define ROLL_MIN_SPEED  45    // Minimum speed away from zero speed needed to get roll servo moving when dancing
+#define ROLL_MAX_SPEED  90    // Maximum speed away from zero speed allowed for roll servo when dancing
+#define YAW_MIN_SPEED   45    // Minimum speed away from zero speed needed to get yaw servo moving when dancing
+#define YAW_MAX_SPEED   90    // Maximum speed away from zero speed allowed for yaw servo when dancing
+#define YAW_TURN_SPEED  180   // Highest speed (degrees/sec) used to turn back to where the yaw servo started after a routine
+#define PITCH_MIN_ANGLE 35    // Lowest angle (degrees) allowed for pitch servo when dancing
+#define PITCH_MAX_ANGLE 170   // Highest angle (degrees) allowed for pitch servo when dancing
+#define PITCH_MAX_SPEED 300   // Highest speed (degrees/sec) allowed for pitch servo when dancing
+
+#define CONFIG_VERSION        3 // Bump whenever TurretConfig changes, so configs saved by older code are ignored instead of misread
+#define CONFIG_SLOT_COUNT     8 // Copies of the config kept in EEPROM. Saves go to the next slot in turn to spread out the wear.
+#define CONFIG_EEPROM_ADDRESS 0 // Where the first slot starts in EEPROM
+
+// Degrees/sec the yaw servo turns at for every ROTATION_TABLE_STEP away from YAW_STOP_SPEED (see RotationEstimator.h).
+// These are rough numbers for a stock turret, which doesn't turn until YAW_MIN_SPEED away from the stop speed.
+// Running the calibration program (0->9) measures them for your turret.
+const uint16_t yawDegreesPerSecond[ROTATION_TABLE_SIZE] PROGMEM = { 0, 0, 0, 0, 0, 90, 190, 270, 320, 340 };
+
+// Same as yawDegreesPerSecond for the roll servo. One dart is fired every 60 degrees.
+const uint16_t rollDegreesPerSecond[ROTATION_TABLE_SIZE] PROGMEM = { 0, 0, 70, 150, 220, 280, 320, 350, 370, 380 };
+
+// Tuning values shared by every program. They are loaded from EEPROM when the turret starts (falling back
+// to the defaults above if nothing valid has been saved) and can be changed over Serial (see ConfigConsole.h)
+// without reflashing. Programs read them when they are switched to and pins are only used at startup.
+struct TurretConfig
+{
+   // Hardware
+   uint8_t yawPin;
+   uint8_t pitchPin;
+   uint8_t rollPin;
+   uint8_t yawStopSpeed;
+   uint8_t rollStopSpeed;
+   uint8_t pitchHomeAngle;
+
+   // Aiming and firing (TurretControl and TurretRoulette, recoil is used by TurretDance too)
+   uint8_t pitchMin;
+   uint8_t pitchMax;
+   uint8_t pitchMoveSpeed;
+   uint8_t yawMoveSpeed;
+   uint8_t rollMoveSpeed;
+   uint16_t yawPrecision;
+   uint16_t rollPrecision;
+   uint8_t recoilAmount;
+   uint16_t recoilRiseTime;
+   uint16_t recoilDecayTime;
+   uint8_t burstSize;
+   uint16_t burstInterval;
+
+   // Dancing (TurretDance)
+   uint8_t rollMinSpeed;
+   uint8_t rollMaxSpeed;
+   uint8_t yawMinSpeed;
+   uint8_t yawMaxSpeed;
+   uint16_t yawTurnSpeed;
+   uint8_t pitchMinAngle;
+   uint8_t pitchMaxAngle;
+   uint16_t pitchMaxSpeed;
+
+   // Measured by the calibration program, only used when servosCalibrated is 1
+   uint8_t servosCalibrated;
+   uint16_t yawSpeeds[ROTATION_TABLE_SIZE];
+   uint16_t rollSpeeds[ROTATION_TABLE_SIZE];
+
+   void SetDefaults()
+   {
+      yawPin = YAW_SERVO_PIN;
+      pitchPin = PITCH_SERVO_PIN;
+      rollPin = ROLL_SERVO_PIN;
+      yawStopSpeed = YAW_STOP_SPEED;
+      rollStopSpeed = ROLL_STOP_SPEED;
+      pitchHomeAngle = PITCH_HOME_ANGLE;
+
+      pitchMin = 10;
+      pitchMax = 175;
+      pitchMoveSpeed = 8;
+      yawMoveSpeed = 90;
+      rollMoveSpeed = 90;
+      yawPrecision = 150;
+      rollPrecision = 158;
+      recoilAmount = RECOIL_FIRE_AMOUNT;
+      recoilRiseTime = RECOIL_RISE_TIME;
+      recoilDecayTime = RECOIL_DECAY_TIME;
+      burstSize = BURST_SIZE;
+      burstInterval = BURST_INTERVAL;
+
+      rollMinSpeed = ROLL_MIN_SPEED;
+      rollMaxSpeed = ROLL_MAX_SPEED;
+      yawMinSpeed = YAW_MIN_SPEED;
+      yawMaxSpeed = YAW_MAX_SPEED;
+      yawTurnSpeed = YAW_TURN_SPEED;
+      pitchMinAngle = PITCH_MIN_ANGLE;
+      pitchMaxAngle = PITCH_MAX_ANGLE;
+      pitchMaxSpeed = PITCH_MAX_SPEED;
+
+      servosCalibrated = 0;
+      memcpy_P( yawSpeeds, yawDegreesPerSecond, sizeof( yawSpeeds ) );
+      memcpy_P( rollSpeeds, rollDegreesPerSecond, sizeof( rollSpeeds ) );
+   }
+
+   // Whether the values make sense together: no min above its max, speeds that keep the servo values from 0
+   // to 180, a pin of its own for every servo (not the Serial pins 0 and 1) and a burst that fits in the barrel.
+   // Each value on its own only has to fit in its field, so this is checked before saving and when loading.
+   bool IsValid() const
+   {
+      return IsServoPin( yawPin ) && IsServoPin( pitchPin ) && IsServoPin( rollPin ) &&
+             yawPin != pitchPin && yawPin != rollPin && pitchPin != rollPin &&
+             pitchHomeAngle <= 180 && pitchMin <= pitchMax && pitchMax <= 180 && pitchMinAngle <= pitchMaxAngle && pitchMaxAngle <= 180 &&
+             rollMinSpeed <= rollMaxSpeed && FitsAround( rollStopSpeed, rollMaxSpeed ) && FitsAround( rollStopSpeed, rollMoveSpeed ) &&
+             yawMinSpeed <= yawMaxSpeed && FitsAround( yawStopSpeed, yawMaxSpeed ) && FitsAround( yawStopSpeed, yawMoveSpeed ) &&
+             burstSize >= 1 && burstSize <= BARREL_CHAMBERS;
+   }
+
+   // Loads the most recently saved config. Keeps the defaults and returns false if no slot holds a
+   // config of this version with a good CRC and valid values (see IsValid()).
+   bool Load()
+   {
+      SetDefaults();
+
+      // Only the small headers are read while looking for the newest slot. If its CRC turns out to
+      // be bad (e.g. power was lost while saving) the newest one before it is tried instead.
+      uint8_t rejected = 0;
+      for ( uint8_t attempt = 0; attempt < CONFIG_SLOT_COUNT; attempt++ )
+      {
+         int8_t newest = -1;
+         ConfigHeader newestHeader;
+
+         for ( uint8_t i = 0; i < CONFIG_SLOT_COUNT; i++ )
+         {
+            ConfigHeader header;
+            EEPROM.get( SlotAddress( i ), header );
+
+            if ( header.version == CONFIG_VERSION && !(rejected & (1 << i)) &&
+                 (newest < 0 || (int8_t)(header.sequence - newestHeader.sequence) > 0) )
+            {
+               newest = i;
+               newestHeader = header;
+            }
+         }
+
+         if ( newest < 0 )
+         {
+            return false;
+         }
+
+         if ( SlotCrc( newest, newestHeader ) == newestHeader.crc )
+         {
+            EEPROM.get( SlotAddress( newest ) + sizeof( ConfigHeader ), *this );
+            if ( IsValid() )
+            {
+               slot = newest;
+               sequence = newestHeader.sequence;
+               return true;
+            }
+            SetDefaults();
+         }
+
+         rejected |= 1 << newest;
+      }
+
+      return false;
+   }
+
+   // Saves the config to the slot after the one it was last loaded from or saved to.
+   // Only bytes that differ from what is already in that slot are written.
+   void Save()
+   {
+      slot = (slot + 1) % CONFIG_SLOT_COUNT;
+      sequence++;
+
+      ConfigHeader header;
+      header.version = CONFIG_VERSION;
+      header.sequence = sequence;
+      header.crc = 0;
+
+      // Write everything but the CRC first, so a save that is cut short is never picked up as valid
+      EEPROM.put( SlotAddress( slot ), header );
+      EEPROM.put( SlotAddress( slot ) + sizeof( ConfigHeader ), *this );
+
+      header.crc = SlotCrc( slot, header );
+      EEPROM.put( SlotAddress( slot ), header );
+   }
+
+private:
+   struct ConfigHeader
+   {
+      uint8_t version;
+      uint8_t sequence; // Goes up by one every save, so the newest slot can be found
+      uint16_t crc;     // CRC of the version, sequence and config
+   };
+
+   static bool IsServoPin( uint8_t pin )
+   {
+      return pin >= 2 && pin < NUM_DIGITAL_PINS;
+   }
+
+   // Whether stopSpeed plus or minus speed stays from 0 to 180
+   static bool FitsAround( uint8_t stopSpeed, uint8_t speed )
+   {
+      return speed <= stopSpeed && stopSpeed + speed <= 180;
+   }
+
+   static int SlotAddress( uint8_t slot )
+   {
+      return CONFIG_EEPROM_ADDRESS + slot * (sizeof( ConfigHeader ) + sizeof( TurretConfig ));
+   }
+
+   // CRC of the config stored in a slot, read straight out of EEPROM
+   static uint16_t SlotCrc( uint8_t slot, const ConfigHeader& header )
+   {
+      uint16_t crc = 0xFFFF;
+      crc = Crc16( crc, header.version );
+      crc = Crc16( crc, header.sequence );
+
+      int address = SlotAddress( slot ) + sizeof( ConfigHeader );
+      for ( uint8_t i = 0; i < sizeof( TurretConfig ); i++ )
+      {
+         crc = Crc16( crc, EEPROM.read( address + i ) );
+      }
+      return crc;
+   }
+
+   // Where the config was last loaded from or saved to. These aren't part of what is stored.
+   static uint8_t slot;
+   static uint8_t sequence;
+};
+
+uint8_t TurretConfig::slot = CONFIG_SLOT_COUNT - 1;
+uint8_t TurretConfig::sequence = 0;
+
+TurretConfig config;
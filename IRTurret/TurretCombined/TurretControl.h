@@ -1,30 +1,48 @@
+#pragma once
+
 #include <Arduino.h>
-#include <Servo.h>
 #include "PinDefinitionsAndMore.h"
 #include "Utils.h"
 #include "BaseProgram.h"
+#include "IrCommandQueue.h"
+#include "MotionScheduler.h"
+#include "RecoilLayer.h"
+#include "TurretConfig.h"
+#include "TurretHardware.h"
 #include <IRremote.hpp>
 
-#define RECOIL_FIRE_AMOUNT 8 // This is how much the pitch servo moves 3 times for recoil with a 50ms delay
-
 #define DECODE_NEC // Defines the type of IR transmission to decode based on the remote. See IRremote library for examples on how to decode other types of remote
 
+#define JOG_RELEASE_TIME 150        // Milliseconds without a repeat frame before a held direction button counts as released
+#define JOG_RAMP_TIME 1500          // Milliseconds a direction button has to be held for the jog to reach full speed
+#define JOG_YAW_START_SPEED 50      // Speed away from yawStopSpeed the YAW servo starts jogging at, just above where it starts turning (YAW_MIN_SPEED)
+#define JOG_YAW_MAX_SPEED 90        // Speed away from yawStopSpeed the YAW servo jogs at once JOG_RAMP_TIME has passed (full speed)
+#define JOG_PITCH_START_SPEED 20    // Degrees/sec the PITCH servo starts jogging at
+#define JOG_PITCH_MAX_SPEED 120     // Degrees/sec the PITCH servo jogs at once JOG_RAMP_TIME has passed
+
 class TurretControlProgram : public BaseProgram
 {
 public:
-   void Setup() override
+   TurretControlProgram( TurretHardware& turretHardware )
+      : hardware( turretHardware )
    {
-      yawServo.attach( 10 ); //attach YAW servo to pin 10
-      pitchServo.attach( 11 ); //attach PITCH servo to pin 11
-      rollServo.attach( 12 ); //attach ROLL servo to pin 12
+   }
 
+   void Setup() override
+   {
       homeServos();
    }
 
    void Loop( uint16_t cmd ) override
    {
-      if ( cmd != -1 )
+      if ( cmd != (uint16_t)-1 )
       {
+         // Any new press ends a jog. Direction buttons can start a new one if they are held down.
+         stopJog();
+         jogCommand = cmd;
+         jogPressTime = millis();
+         lastJogFrameTime = jogPressTime;
+
          switch ( cmd )
          {
             case up:
@@ -49,137 +67,276 @@ public:
             }
             case ok:
             {
+               dropAim(); // firing doesn't wait for aim presses that haven't been queued yet
                fire();
                break;
             }
             case star:
             {
                fireAll();
-               delay( 50 );
                break;
             }
             case hashtag:
             {
+               // Pressing it again starts the gestures over instead of queueing more than fits after them
+               motion.yaw.Clear();
+               motion.pitch.Clear();
+               motion.yaw.Set( yawStopSpeed ); // it might have been cut off in the middle of a move
                shakeHeadYes( 3 );
+               motion.yaw.PushWaitFor( motion.pitch, millis() ); // shake no after the nodding is done
                shakeHeadNo( 3 );
                break;
             }
+            case cmd6:
+            {
+               hardware.barrel.Reload(); // all 6 darts are back in
+               break;
+            }
          }
       }
-      delay( 5 );
+
+      update();
+   }
+
+   // Holding a direction button keeps the turret moving (jogging) for as long as the remote keeps sending
+   // repeat frames, speeding up the longer it is held. Other buttons repeat like normal presses.
+   void LoopRepeat( uint16_t cmd ) override
+   {
+      if ( cmd != jogCommand || !IsAimCommand( cmd ) )
+      {
+         Loop( cmd );
+         return;
+      }
+
+      lastJogFrameTime = millis();
+      if ( !jogging )
+      {
+         startJog();
+      }
+
+      update();
    }
 
    bool CanShutdown() override
+   {
+      return motion.IsIdle() && !jogging && yawAim == 0 && pitchAim == pitchServoVal && recoil.IsIdle() && !hardware.barrel.IsBursting();
+   }
+
+   // The direction buttons aim the shot, so ones still waiting when ok is pressed are no longer wanted
+   bool PreemptsAim() override
    {
       return true;
    }
 
    void Shutdown() override
    {
-      yawServo.detach();
-      pitchServo.detach();
-      rollServo.detach();
+      motion.Clear();
+      jogging = false;
+      dropAim();
+      hardware.barrel.StopBurst();
+
+      // Put the PITCH servo back where it was aimed if it is in the middle of a recoil
+      recoil.Clear();
+      motion.pitch.SetOffset( 0 );
+      motion.pitch.Update( millis() );
+
+      hardware.Stop();
    }
 
 private:
-   Servo yawServo; //names the servo responsible for YAW rotation, 360 spin around the base
-   Servo pitchServo; //names the servo responsible for PITCH rotation, up and down tilt
-   Servo rollServo; //names the servo responsible for ROLL rotation, spins the barrel to fire darts
+   TurretHardware& hardware; // servos that are lent to this program while it is running
+
+   MotionScheduler motion; // queued servo moves that get played back from Loop() instead of blocking in delay()
 
    int yawServoVal; //initialize variables to store the current value of each servo
    int pitchServoVal = 100;
    int rollServoVal;
 
-   int pitchMoveSpeed = 8; //this variable is the angle added to the pitch servo to control how quickly the PITCH servo moves - try values between 3 and 10
-   int yawMoveSpeed = 90; //this variable is the speed controller for the continuous movement of the YAW servo motor. It is added or subtracted from the yawStopSpeed, so 0 would mean full speed rotation in one direction, and 180 means full rotation in the other. Try values between 10 and 90;
-   int yawStopSpeed = 90; //value to stop the yaw motor - keep this at 90
-   int rollMoveSpeed = 90; //this variable is the speed controller for the continuous movement of the ROLL servo motor. It is added or subtracted from the rollStopSpeed, so 0 would mean full speed rotation in one direction, and 180 means full rotation in the other. Keep this at 90 for best performance / highest torque from the roll motor when firing.
-   int rollStopSpeed = 90; //value to stop the roll motor - keep this at 90
+   int pitchMoveSpeed = config.pitchMoveSpeed; //this variable is the angle added to the pitch servo to control how quickly the PITCH servo moves - try values between 3 and 10
+   int yawMoveSpeed = config.yawMoveSpeed; //this variable is the speed controller for the continuous movement of the YAW servo motor. It is added or subtracted from the yawStopSpeed, so 0 would mean full speed rotation in one direction, and 180 means full rotation in the other. Try values between 10 and 90;
+   int yawStopSpeed = config.yawStopSpeed; //value to stop the yaw motor - keep this at 90
+   int rollMoveSpeed = config.rollMoveSpeed; //this variable is the speed controller for the continuous movement of the ROLL servo motor. It is added or subtracted from the rollStopSpeed, so 0 would mean full speed rotation in one direction, and 180 means full rotation in the other. Keep this at 90 for best performance / highest torque from the roll motor when firing.
+   int rollStopSpeed = config.rollStopSpeed; //value to stop the roll motor - keep this at 90
+
+   int yawPrecision = config.yawPrecision; // this variable represents the time in milliseconds that the YAW motor will remain at it's set movement speed. Try values between 50 and 500 to start (500 milliseconds = 1/2 second)
+
+   int pitchMax = config.pitchMax; // this sets the maximum angle of the pitch servo to prevent it from crashing, it should remain below 180, and be greater than the pitchMin
+   int pitchMin = config.pitchMin; // this sets the minimum angle of the pitch servo to prevent it from crashing, it should remain above 0, and be less than the pitchMax
+
+   // Aim presses are collected here and only queued once the axis has finished its last move, so a burst
+   // of presses becomes one move to where they add up to (e.g. 5 taps of up is one move of 5 steps)
+   int yawAim = 0;  // YAW steps still to be moved, positive is left
+   int pitchAim = pitchServoVal; // PITCH angle still to be moved to
+
+
+   uint16_t jogCommand = 0;            // button that was last pressed, it is jogged if repeat frames for it arrive
+   bool jogging = false;               // repeat frames are arriving, so the servo is being driven directly instead of from motion
+   unsigned long jogPressTime = 0;     // when the jogged button was pressed
+   unsigned long lastJogFrameTime = 0; // when the last frame for the jogged button arrived
+   unsigned long lastJogUpdate = 0;
+   long jogPitch = 0;                  // PITCH angle in 1/1000 degrees while jogging, so slow speeds still move every tick
+
+   RecoilLayer recoil; // added on top of the PITCH servo, so aiming carries on during it and the next shot doesn't wait for it
+
+   int burstSize = config.burstSize;         // darts fired by star, if there are that many left
+   int burstInterval = config.burstInterval; // milliseconds between the shots of a burst
+
+   // Everything that runs every Loop(), whether or not a command arrived
+   void update()
+   {
+      if ( hardware.barrel.BurstShotDue( millis() ) )
+      {
+         fire();
+      }
+
+      sendAim();
+      updateJog();
+      updateRecoil();
+      motion.Update();
+   }
+
+   // Queues the aim presses collected so far on the axes that have finished moving
+   void sendAim()
+   {
+      if ( yawAim != 0 && motion.yaw.IsIdle() )
+      {
+         uint16_t duration = min( (unsigned long)abs( yawAim ) * yawPrecision, 0xFFFFUL );
+         motion.yaw.Push( yawAim > 0 ? yawStopSpeed + yawMoveSpeed : yawStopSpeed - yawMoveSpeed, duration ); // left is counterclockwise
+         motion.yaw.Push( yawStopSpeed, 5 ); // stop rotating
+         yawAim = 0;
+      }
+
+      if ( pitchAim != pitchServoVal && motion.pitch.IsIdle() )
+      {
+         pitchServoVal = pitchAim;
+         motion.pitch.Push( pitchServoVal, 50 );
+      }
+   }
+
+   // Forgets aim presses that haven't been queued yet
+   void dropAim()
+   {
+      yawAim = 0;
+      pitchAim = pitchServoVal;
+   }
+
+   // The first repeat frame arrives ~110ms after the press, by which time the normal single step has been
+   // played. The jog carries on from there, so a quick tap still moves exactly one step.
+   void startJog()
+   {
+      jogging = true;
+      lastJogUpdate = millis();
+
+      if ( jogCommand == left || jogCommand == right )
+      {
+         motion.yaw.Clear();
+         yawAim = 0;
+      }
+      else
+      {
+         motion.pitch.Clear();
+         pitchServoVal = pitchAim;
+         jogPitch = pitchServoVal * 1000L;
+      }
+   }
+
+   void stopJog()
+   {
+      if ( jogging && (jogCommand == left || jogCommand == right) )
+      {
+         motion.yaw.Set( yawStopSpeed );
+      }
+      jogging = false;
+   }
+
+   void updateJog()
+   {
+      if ( !jogging )
+      {
+         return;
+      }
+
+      auto now = millis();
+      if ( now - lastJogFrameTime > JOG_RELEASE_TIME )
+      {
+         stopJog(); // button was let go
+         return;
+      }
+
+      unsigned long held = min( now - jogPressTime, (unsigned long)JOG_RAMP_TIME );
 
-   int yawPrecision = 150; // this variable represents the time in milliseconds that the YAW motor will remain at it's set movement speed. Try values between 50 and 500 to start (500 milliseconds = 1/2 second)
-   int rollPrecision = 158; // this variable represents the time in milliseconds that the ROLL motor with remain at it's set movement speed. If this ROLL motor is spinning more or less than 1/6th of a rotation when firing a single dart (one call of the fire(); command) you can try adjusting this value down or up slightly, but it should remain around the stock value (160ish) for best results.
+      if ( jogCommand == left || jogCommand == right )
+      {
+         int speed = JOG_YAW_START_SPEED + (long)(JOG_YAW_MAX_SPEED - JOG_YAW_START_SPEED) * held / JOG_RAMP_TIME;
+         motion.yaw.Set( jogCommand == left ? yawStopSpeed + speed : yawStopSpeed - speed ); // left is counterclockwise like leftMove()
+      }
+      else
+      {
+         long rate = JOG_PITCH_START_SPEED + (long)(JOG_PITCH_MAX_SPEED - JOG_PITCH_START_SPEED) * held / JOG_RAMP_TIME;
+         jogPitch += (jogCommand == up ? -rate : rate) * (long)(now - lastJogUpdate); // up lowers the angle like upMove()
+         jogPitch = max( (long)pitchMin * 1000, min( (long)pitchMax * 1000, jogPitch ) );
+
+         pitchServoVal = (jogPitch + 500) / 1000;
+         pitchAim = pitchServoVal;
+         motion.pitch.Set( pitchServoVal ); // keeps any recoil on top
+      }
 
-   int pitchMax = 175; // this sets the maximum angle of the pitch servo to prevent it from crashing, it should remain below 180, and be greater than the pitchMin
-   int pitchMin = 10; // this sets the minimum angle of the pitch servo to prevent it from crashing, it should remain above 0, and be less than the pitchMax
+      lastJogUpdate = now;
+   }
 
    void shakeHeadYes( int moves = 3 )
    {
       int startAngle = pitchServoVal; // Current position of the pitch servo
-      int lastAngle = pitchServoVal;
       int nodAngle = startAngle + 20; // Angle for nodding motion
 
-      for ( int i = 0; i < moves; i++ )
+      if ( !motion.pitch.HasRoom( 4 * moves ) )
       {
-         // Nod up
-         for ( int angle = startAngle; angle <= nodAngle; angle++ )
-         {
-            pitchServo.write( angle );
-            delay( 7 );
-         }
-         delay( 50 );
-
-         // Nod down
-         for ( int angle = nodAngle; angle >= startAngle; angle-- )
-         {
-            pitchServo.write( angle );
-            delay( 7 );
-         }
+         return; // a half finished nod would leave the turret looking somewhere else
+      }
 
-         delay( 50 );
+      for ( int i = 0; i < moves; i++ )
+      {
+         motion.pitch.PushRamp( nodAngle, 7 * (nodAngle - startAngle) ); // Nod up
+         motion.pitch.PushWait( 50 );
+         motion.pitch.PushRamp( startAngle, 7 * (nodAngle - startAngle) ); // Nod down
+         motion.pitch.PushWait( 50 );
       }
    }
 
    void shakeHeadNo( int moves = 3 )
    {
-      int startAngle = pitchServoVal; // Current position of the pitch servo
-      int lastAngle = pitchServoVal;
-      int nodAngle = startAngle + 60; // Angle for nodding motion
+      if ( !motion.yaw.HasRoom( 4 * moves ) )
+      {
+         return; // a half finished shake could leave the YAW servo turning
+      }
 
       for ( int i = 0; i < moves; i++ )
       {
          // rotate right, stop, then rotate left, stop
-         yawServo.write( 140 );
-         delay( 190 ); // Adjust delay for smoother motion
-         yawServo.write( yawStopSpeed );
-         delay( 50 );
-         yawServo.write( 40 );
-         delay( 190 ); // Adjust delay for smoother motion
-         yawServo.write( yawStopSpeed );
-         delay( 50 ); // Pause at starting position
+         motion.yaw.Push( 140, 190 ); // Adjust time for smoother motion
+         motion.yaw.Push( yawStopSpeed, 50 );
+         motion.yaw.Push( 40, 190 ); // Adjust time for smoother motion
+         motion.yaw.Push( yawStopSpeed, 50 ); // Pause at starting position
       }
    }
 
    void leftMove( int moves )
    {
-      for ( int i = 0; i < moves; i++ )
-      {
-         yawServo.write( yawStopSpeed + yawMoveSpeed ); // adding the servo speed = 180 (full counterclockwise rotation speed)
-         delay( yawPrecision ); // stay rotating for a certain number of milliseconds
-         yawServo.write( yawStopSpeed ); // stop rotating
-         delay( 5 ); //delay for smoothness
-      }
+      yawAim += moves; // adding the servo speed = 180 (full counterclockwise rotation speed) for yawPrecision ms per move
    }
 
    void rightMove( int moves )
    {
-      for ( int i = 0; i < moves; i++ )
-      {
-         yawServo.write( yawStopSpeed - yawMoveSpeed ); //subtracting the servo speed = 0 (full clockwise rotation speed)
-         delay( yawPrecision );
-         yawServo.write( yawStopSpeed );
-         delay( 5 );
-      }
+      yawAim -= moves; //subtracting the servo speed = 0 (full clockwise rotation speed)
    }
 
    void upMove( int moves )
    {
       for ( int i = 0; i < moves; i++ )
       {
-         if ( pitchServoVal > pitchMin ) //make sure the servo is within rotation limits (greater than 10 degrees by default)
+         if ( pitchAim > pitchMin ) //make sure the servo is within rotation limits (greater than 10 degrees by default)
          {
-            pitchServoVal = pitchServoVal - pitchMoveSpeed; //decrement the current angle and update
-            pitchServo.write( pitchServoVal );
-            delay( 50 );
+            pitchAim = pitchAim - pitchMoveSpeed; //decrement the target angle, it is queued by sendAim()
          }
       }
    }
@@ -188,73 +345,49 @@ private:
    {
       for ( int i = 0; i < moves; i++ )
       {
-         if ( pitchServoVal < pitchMax ) //make sure the servo is within rotation limits (less than 175 degrees by default)
+         if ( pitchAim < pitchMax ) //make sure the servo is within rotation limits (less than 175 degrees by default)
          {
-            pitchServoVal = pitchServoVal + pitchMoveSpeed;//increment the current angle and update
-            pitchServo.write( pitchServoVal );
-            delay( 50 );
+            pitchAim = pitchAim + pitchMoveSpeed; //increment the target angle, it is queued by sendAim()
          }
       }
    }
 
-   void doRecoil()
+   void updateRecoil()
    {
-      if ( RECOIL_FIRE_AMOUNT != 0 )
-      {
-         auto origPitchVal = pitchServoVal;
-
-         for ( auto i = 0; i < 3; i++ )
-         {
-            pitchServoVal += RECOIL_FIRE_AMOUNT;
-            pitchServoVal = min( pitchServoVal, pitchMax );
-            pitchServoVal = max( pitchServoVal, pitchMin );
-            pitchServo.write( pitchServoVal );
-            delay( 50 );
-         }
-
-         for ( auto i = 0; i < 3; i++ )
-         {
-            pitchServoVal -= RECOIL_FIRE_AMOUNT;
-            pitchServoVal = min( pitchServoVal, pitchMax );
-            pitchServoVal = max( pitchServoVal, pitchMin );
-            pitchServo.write( pitchServoVal );
-            delay( 50 );
-         }
-
-         pitchServo.write( origPitchVal );
-      }
+      motion.pitch.SetOffset( recoil.Offset( millis(), motion.pitch.Position(), pitchMin, pitchMax ) );
    }
 
+   // Fires one dart, for ok and every shot of a burst (see RecoilLayer::FireDarts()). Shakes no if the barrel is empty.
    void fire()
    {
-      rollServo.write( rollStopSpeed + rollMoveSpeed );//start rotating the servo
-      delay( rollPrecision );//time for approximately 60 degrees of rotation
-      rollServo.write( rollStopSpeed );//stop rotating the servo
-
-      doRecoil();
-
-      delay( 5 ); //delay for smoothness
+      if ( recoil.FireDarts( hardware.barrel, motion.roll, 1, rollStopSpeed, rollMoveSpeed ) == FireResult::Empty )
+      {
+         shakeHeadNo( 1 );
+      }
    }
 
+   // Fires a burst of burstSize darts (or however many are left), paced by update()
    void fireAll()
    {
-      rollServo.write( rollStopSpeed + rollMoveSpeed );//start rotating the servo
-      delay( rollPrecision * 6 ); //time for 360 degrees of rotation
-      rollServo.write( rollStopSpeed );//stop rotating the servo
+      dropAim();
 
-      doRecoil();
-
-      delay( 5 ); // delay for smoothness
+      if ( !hardware.barrel.StartBurst( burstSize, burstInterval, millis() ) )
+      {
+         shakeHeadNo( 1 );
+      }
    }
 
    void homeServos()
    {
-      yawServo.write( yawStopSpeed ); //setup YAW servo to be STOPPED (90)
-      delay( 20 );
-      rollServo.write( rollStopSpeed ); //setup ROLL servo to be STOPPED (90)
-      delay( 100 );
-      pitchServo.write( 100 ); //set PITCH servo to 100 degree position
-      delay( 100 );
-      pitchServoVal = 100; // store the pitch servo value
+      motion.Clear();
+      motion.yaw.Attach( &hardware.yaw );
+      motion.pitch.Attach( &hardware.pitch );
+      motion.roll.Attach( &hardware.roll );
+
+      hardware.yaw.Write( yawStopSpeed ); //setup YAW servo to be STOPPED (90)
+      hardware.roll.Write( rollStopSpeed ); //setup ROLL servo to be STOPPED (90)
+      pitchServoVal = hardware.pitch.Position(); // keep the PITCH servo where the last program left it
+      dropAim();
+      recoil.Clear();
    }
 };
\ No newline at end of file
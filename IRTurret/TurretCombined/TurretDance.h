@@ -1,34 +1,43 @@
+#pragma once
+
 #include <Arduino.h>
-#include <Servo.h>
 #include "PinDefinitionsAndMore.h"
 #include "Utils.h"
 #include "BaseProgram.h"
 #include "DanceMove.h"
+#include "DanceRoutines.h"
+#include "DanceStream.h"
+#include "RecoilLayer.h"
 #include "ServoController.h"
+#include "TurretConfig.h"
+#include "TurretHardware.h"
 
-#define ROLL_SERVO_PIN  12    // Pin for roll servo
-#define ROLL_ZERO_SPEED 90    // Speed to keep roll servo stationary
-#define ROLL_MIN_SPEED  45    // Minimum speed away from zero speed needed to get roll servo moving
-#define ROLL_MAX_SPEED  90    // Maximum speed away from zero speed allowed for roll servo
-
-#define YAW_SERVO_PIN   10    // Pin for yaw servo
-#define YAW_ZERO_SPEED  90    // Speed to keep yaw servo stationary
-#define YAW_MIN_SPEED   45    // Minimum speed away from zero speed needed to get yaw servo moving
-#define YAW_MAX_SPEED   90    // Maximum speed away from zero speed allowed for yaw servo
+// Dance routines are packed tables stored in flash (PROGMEM), see DanceMove.h for the format.
+// The controllers read one move at a time and expand repeats while playing, so a routine doesn't
+// use any RAM no matter how long it is. Routines that don't move an axis pass nullptr and 0 to
+// SetDanceMoves() for that axis. Routines can also be streamed over Serial while they play (see DanceStream.h).
+// The built in routines are in DanceRoutines.h, which is generated from test/routines/ (see Dance Routines in README.md).
 
-#define PITCH_SERVO_PIN 11    // Pin for pitch servo
-#define PITCH_MIN_ANGLE 35    // Lowest angle (degrees) allowed for pitch servo
-#define PITCH_MAX_ANGLE 170   // Highest angle (degrees) allowed for pitch servo
-#define PITCH_MAX_SPEED 300   // Highest speed (degrees/sec) allowed for pitch servo
+#define DANCE_RECOIL 0 // Set to 1 to kick the pitch servo every time the barrel turns far enough to fire a dart while dancing
 
 class TurretDanceProgram : public BaseProgram
 {
 public:
+   TurretDanceProgram( TurretHardware& hardware )
+      : _rollServo( hardware.roll, config.rollStopSpeed, config.rollMinSpeed, config.rollMaxSpeed ),
+      _yawServo( hardware.yaw, hardware.yawHeading, config.yawStopSpeed, config.yawMinSpeed, config.yawMaxSpeed, config.yawTurnSpeed ),
+      _pitchServo( hardware.pitch, PitchMinAngle(), PitchMaxAngle(), config.pitchMaxSpeed ),
+      _barrel( hardware.rollRotation )
+   {
+   }
+
    void Setup() override
    {
-      _rollServo = new ServoSpeedController( ROLL_SERVO_PIN, ROLL_ZERO_SPEED, ROLL_MIN_SPEED, ROLL_MAX_SPEED );
-      _yawServo = new ServoSpeedController( YAW_SERVO_PIN, YAW_ZERO_SPEED, YAW_MIN_SPEED, YAW_MAX_SPEED );
-      _pitchServo = new ServoAngleController( PITCH_SERVO_PIN, PITCH_MIN_ANGLE, PITCH_MAX_ANGLE, PITCH_MAX_SPEED );
+#if DANCE_BENCHMARK
+      _rollServo.stats = &_rollStats;
+      _yawServo.stats = &_yawStats;
+      _pitchServo.stats = &_pitchStats;
+#endif
 
       // SetDanceRoutine1();
       // _playing = true;
@@ -38,14 +47,48 @@ public:
    {
       if ( _playing )
       {
-         auto donePlaying = _rollServo->Update();
-         donePlaying &= _yawServo->Update();
-         donePlaying &= _pitchServo->Update();
+         // Every axis is driven from the same clock sample so they can't drift apart
+         unsigned long routineTime = millis() - _routineStartTime;
+
+#if DANCE_BENCHMARK
+         auto donePlaying = BenchmarkUpdate( &_rollServo, _rollStats, routineTime );
+         donePlaying &= BenchmarkUpdate( &_yawServo, _yawStats, routineTime );
+         donePlaying &= BenchmarkUpdate( &_pitchServo, _pitchStats, routineTime );
+
+         if ( donePlaying )
+         {
+            PrintBenchmark();
+         }
+#else
+         auto donePlaying = _rollServo.Update( routineTime );
+         donePlaying &= _yawServo.Update( routineTime );
+         donePlaying &= _pitchServo.Update( routineTime );
+#endif
 
          _playing = !donePlaying;
+
+#if DANCE_RECOIL
+         // A dart is fired every 60 degrees the barrel turns, either way
+         int32_t turned = _barrel.Heading() - _lastShotHeading;
+         if ( abs( turned ) >= 60 )
+         {
+            _lastShotHeading += turned > 0 ? 60 : -60;
+            _recoil.Trigger( millis() );
+         }
+#endif
       }
 
-      if ( cmd != -1 )
+      // Recoil carries on after a routine has finished until it has settled
+      _pitchServo.SetOffset( _recoil.Offset( millis(), _pitchServo.Angle(), PitchMinAngle(), PitchMaxAngle() ) );
+
+      if ( danceStream.TakePlay() && !_playing )
+      {
+         SetStreamedRoutine();
+         StartPlaying();
+         danceStream.SetPlaying( true );
+      }
+
+      if ( cmd != (uint16_t)-1 )
       {
          switch ( cmd )
          {
@@ -54,7 +97,7 @@ public:
                if ( !_playing )
                {
                   SetDanceRoutine1();
-                  _playing = true;
+                  StartPlaying();
                }
                break;
             }
@@ -63,7 +106,7 @@ public:
                if ( !_playing )
                {
                   SetDanceRoutine2();
-                  _playing = true;
+                  StartPlaying();
                }
                break;
             }
@@ -72,242 +115,133 @@ public:
                if ( !_playing )
                {
                   SetDanceRoutine4();
-                  _playing = true;
+                  StartPlaying();
                }
                break;
             }
             case ok:
             {
                _playing = false;
-               _rollServo->Reset();
-               _yawServo->Reset();
-               _pitchServo->Reset();
+               _rollServo.Reset();
+               _yawServo.Reset();
+               _pitchServo.Reset();
+               _recoil.Clear();
+               _pitchServo.SetOffset( 0 );
             }
          }
       }
 
+      if ( !_playing )
+      {
+         danceStream.SetPlaying( false );
+      }
+
       delay( 10 );
    }
 
    bool CanShutdown() override
    {
-      return !_playing;
+      return !_playing && _recoil.IsIdle();
    }
 
    void Shutdown() override
    {
-      delete _rollServo;
-      delete _yawServo;
-      delete _pitchServo;
+      _playing = false;
+      danceStream.SetPlaying( false );
+      _rollServo.Reset();
+      _yawServo.Reset();
+      _pitchServo.Reset();
+      _recoil.Clear();
+      _pitchServo.SetOffset( 0 );
    }
 
 private:
-   ServoSpeedController* _rollServo;
-   ServoSpeedController* _yawServo;
-   ServoAngleController* _pitchServo;
+   ServoSpeedController _rollServo;
+   ServoYawPositionController _yawServo; // Turns back to where it started once a routine is done
+   ServoAngleController _pitchServo;
+   RotationEstimator& _barrel; // Tracks how far the barrel has turned, so recoil can be added for every dart fired
+   RecoilLayer _recoil;
+
+   int32_t _lastShotHeading = 0; // Barrel angle of the last dart fired
 
    bool _playing = false;
+   unsigned long _routineStartTime = 0;
 
-   void SetDanceRoutine1()
+   // The routines are only checked against PITCH_MIN_ANGLE to PITCH_MAX_ANGLE when compiling, so the
+   // angles in config can narrow that range but not widen it
+   static uint8_t PitchMinAngle()
    {
-      _rollServo->Reset();
-      _yawServo->Reset();
-      _pitchServo->Reset();
-
-      uint8_t topPitch = 110;
-      uint8_t bottomPitch = 90;
-      uint8_t yu = 20;
-      uint8_t ru = 10;
-      uint16_t du = 100;
-
-      DanceSpeedMove rollMoves[] =
-      {
-         DanceSpeedMove( 108 * du ),      // 10.8
-         DanceSpeedMove( 40 * du, 50 ),
-         DanceSpeedMove( 40 * du, -50 ),
-         DanceSpeedMove( 40 * du, 50 ),
-         DanceSpeedMove( 40 * du, -50 ),
-      };
-
-      DanceSpeedMove yawMoves[] =
-      {
-         DanceSpeedMove( 40 * du ),          // 4
-         DanceSpeedMove( 4 * du ),           // 4.4
-         DanceSpeedMove( 2 * du, 4 * yu ),   // 4.8
-         DanceSpeedMove( 8 * du ),           // 5.7
-         DanceSpeedMove( 2 * du, -4 * yu ),  // 5.8
-         DanceSpeedMove( 8 * du ),           // 6.7
-         DanceSpeedMove( 2 * du, 4 * yu ),   // 6.8
-         DanceSpeedMove( 8 * du ),
-         DanceSpeedMove( 2 * du, -4 * yu ),  // 7.8
-         DanceSpeedMove( 8 * du ),
-         DanceSpeedMove( 2 * du, 4 * yu ),   // 8.8
-         DanceSpeedMove( 8 * du ),
-         DanceSpeedMove( 2 * du, -4 * yu ),  // 9.8
-         DanceSpeedMove( 8 * du ),
-         DanceSpeedMove( 2 * du, 4 * yu ),   // 10.8
-      };
-
-      DanceAngleMove pitchMoves[] =
-      {
-         DanceAngleMove( topPitch, 10 * du ),
-         DanceAngleMove( 30 * du ),                // 4
-         DanceAngleMove( bottomPitch, 4 * du ),    // 4.4
-         DanceAngleMove( topPitch, du ),           // 4.5
-         DanceAngleMove( 5 * du ),                 // 5
-         DanceAngleMove( bottomPitch, 4 * du ),
-         DanceAngleMove( topPitch, du ),
-         DanceAngleMove( 5 * du ),                 // 6
-         DanceAngleMove( bottomPitch, 4 * du ),
-         DanceAngleMove( topPitch, du ),
-         DanceAngleMove( 5 * du ),                 // 7
-         DanceAngleMove( bottomPitch, 4 * du ),
-         DanceAngleMove( topPitch, du ),
-         DanceAngleMove( 5 * du ),                 // 8
-         DanceAngleMove( bottomPitch, 4 * du ),
-         DanceAngleMove( topPitch, du ),
-         DanceAngleMove( 5 * du ),                 // 9
-         DanceAngleMove( bottomPitch, 4 * du ),
-         DanceAngleMove( topPitch, du ),
-         DanceAngleMove( 5 * du ),                 // 10
-         DanceAngleMove( bottomPitch, 8 * du ),  // 10.8
-      };
-
-      _rollServo->SetDanceMoves( rollMoves, sizeof( rollMoves ) / sizeof( DanceSpeedMove ) );
-      _yawServo->SetDanceMoves( yawMoves, sizeof( yawMoves ) / sizeof( DanceSpeedMove ) );
-      _pitchServo->SetDanceMoves( pitchMoves, sizeof( pitchMoves ) / sizeof( DanceAngleMove ) );
+      return max( config.pitchMinAngle, (uint8_t)PITCH_MIN_ANGLE );
    }
 
-   void SetDanceRoutine2()
+   static uint8_t PitchMaxAngle()
    {
-      _rollServo->Reset();
-      _yawServo->Reset();
-      _pitchServo->Reset();
+      return min( config.pitchMaxAngle, (uint8_t)PITCH_MAX_ANGLE );
+   }
 
-      uint8_t topPitch = 120;
-      uint8_t bottomPitch = 80;
-      uint8_t yu = 20;
-      uint8_t ru = 10;
-      uint16_t du = 100;
+#if DANCE_BENCHMARK
+   DanceStats _rollStats;
+   DanceStats _yawStats;
+   DanceStats _pitchStats;
 
-      DanceSpeedMove rollMoves[] =
-      {
-      };
-
-      DanceSpeedMove yawMoves[] =
+   template<typename T>
+   bool BenchmarkUpdate( T* controller, DanceStats& stats, unsigned long routineTime )
+   {
+      auto startTime = micros();
+      auto done = controller->Update( routineTime );
+      if ( !done )
       {
-      };
+         stats.AddTick( micros() - startTime );
+      }
+      return done;
+   }
 
-      DanceAngleMove pitchMoves[] =
-      {
-         DanceAngleMove( topPitch, 10 * du ),
-         DanceAngleMove( 30 * du ),
-         DanceAngleMove( bottomPitch, 2 * du ),
-         DanceAngleMove( topPitch, du ),
-         DanceAngleMove( 2 * du ),
-         DanceAngleMove( bottomPitch, 2 * du ),
-         DanceAngleMove( topPitch, du ),
-         DanceAngleMove( 2 * du ),
-         DanceAngleMove( bottomPitch, 2 * du ),
-         DanceAngleMove( topPitch, du ),
-         DanceAngleMove( 2 * du ),
-         DanceAngleMove( bottomPitch, 2 * du ),
-         DanceAngleMove( topPitch, du ),
-         DanceAngleMove( 2 * du ),
-         DanceAngleMove( bottomPitch, 2 * du ),
-         DanceAngleMove( topPitch, du ),
-         DanceAngleMove( 2 * du ),
-         DanceAngleMove( bottomPitch, 2 * du ),
-         DanceAngleMove( topPitch, du ),
-         DanceAngleMove( 2 * du ),
-         DanceAngleMove( bottomPitch, 2 * du ),
-         DanceAngleMove( topPitch, du ),
-         DanceAngleMove( 2 * du ),
-         DanceAngleMove( bottomPitch, 2 * du ),
-         DanceAngleMove( topPitch, du ),
-         DanceAngleMove( 2 * du ),
-         DanceAngleMove( bottomPitch, 2 * du ),
-         DanceAngleMove( topPitch, du ),
-         DanceAngleMove( 2 * du ),
-         DanceAngleMove( bottomPitch, 2 * du ),
-         DanceAngleMove( topPitch, du ),
-         DanceAngleMove( 2 * du ),
-         DanceAngleMove( bottomPitch, 2 * du ),
-         DanceAngleMove( topPitch, du ),
-         DanceAngleMove( 2 * du ),
-         DanceAngleMove( bottomPitch, 2 * du ),
-         DanceAngleMove( topPitch, du ),
-         DanceAngleMove( 2 * du ),
-         DanceAngleMove( bottomPitch, 2 * du ),
-         DanceAngleMove( topPitch, du ),
-         DanceAngleMove( 2 * du ),
-         DanceAngleMove( bottomPitch, 2 * du ),
-         DanceAngleMove( topPitch, du ),
-      };
-
-      _rollServo->SetDanceMoves( rollMoves, sizeof( rollMoves ) / sizeof( DanceSpeedMove ) );
-      _yawServo->SetDanceMoves( yawMoves, sizeof( yawMoves ) / sizeof( DanceSpeedMove ) );
-      _pitchServo->SetDanceMoves( pitchMoves, sizeof( pitchMoves ) / sizeof( DanceAngleMove ) );
+   void PrintBenchmark()
+   {
+      _rollStats.Print( F( "roll" ) );
+      _yawStats.Print( F( "yaw" ) );
+      _pitchStats.Print( F( "pitch" ) );
    }
+#endif
 
-   void SetDanceRoutine4()
+   void StartPlaying()
    {
-      _rollServo->Reset();
-      _yawServo->Reset();
-      _pitchServo->Reset();
+#if DANCE_BENCHMARK
+      _rollStats.Reset();
+      _yawStats.Reset();
+      _pitchStats.Reset();
+#endif
+
+      _routineStartTime = millis();
+      _lastShotHeading = _barrel.Heading();
+      _playing = true;
+   }
 
-      uint8_t topPitch = 110;
-      uint8_t bottomPitch = 80;
-      uint8_t yu = 20;
-      uint8_t ru = 10;
-      uint16_t du = 100;
+   void SetDanceRoutine1()
+   {
+      _rollServo.SetDanceMoves( DANCE_MOVES( DanceRoutine1::rollMoves ) );
+      _yawServo.SetDanceMoves( DANCE_MOVES( DanceRoutine1::yawMoves ) );
+      _pitchServo.SetDanceMoves( DANCE_MOVES( DanceRoutine1::pitchMoves ) );
+   }
 
-      DanceSpeedMove rollMoves[] =
-      {
-      };
+   void SetDanceRoutine2()
+   {
+      _rollServo.SetDanceMoves( nullptr, 0 );
+      _yawServo.SetDanceMoves( nullptr, 0 );
+      _pitchServo.SetDanceMoves( DANCE_MOVES( DanceRoutine2::pitchMoves ) );
+   }
 
-      DanceSpeedMove yawMoves[] =
-      {
-         DanceSpeedMove( 40 * du ),
-         DanceSpeedMove( 6 * du, 4 * yu ),
-         DanceSpeedMove( du, 4 * yu ),
-         DanceSpeedMove( du, -4 * yu ),
-         DanceSpeedMove( du, 4 * yu ),
-         DanceSpeedMove( du, -4 * yu ),
-         DanceSpeedMove( du, 4 * yu ),
-         DanceSpeedMove( du, -4 * yu ),
-         DanceSpeedMove( du, 4 * yu ),
-         DanceSpeedMove( du, -4 * yu ),
-         DanceSpeedMove( du, 4 * yu ),
-         DanceSpeedMove( du, -4 * yu ),
-         DanceSpeedMove( du, 4 * yu ),
-         DanceSpeedMove( du, -4 * yu ),
-         DanceSpeedMove( du, 4 * yu ),
-         DanceSpeedMove( du, -4 * yu ),
-         DanceSpeedMove( du, 4 * yu ),
-         DanceSpeedMove( du, -4 * yu ),
-         DanceSpeedMove( du, 4 * yu ),
-         DanceSpeedMove( du, -4 * yu ),
-         DanceSpeedMove( du, 4 * yu ),
-         DanceSpeedMove( du, -4 * yu ),
-         DanceSpeedMove( du, 4 * yu ),
-         DanceSpeedMove( du, -4 * yu ),
-         DanceSpeedMove( du, 4 * yu ),
-         DanceSpeedMove( du, -4 * yu ),
-         DanceSpeedMove( du, 4 * yu ),
-         DanceSpeedMove( du, -4 * yu ),
-         DanceSpeedMove( du, 4 * yu ),
-         DanceSpeedMove( du, -4 * yu ),
-      };
-
-      DanceAngleMove pitchMoves[] =
-      {
-         DanceAngleMove( topPitch, 10 * du ),
-         DanceAngleMove( 30 * du ),
-      };
+   void SetDanceRoutine4()
+   {
+      _rollServo.SetDanceMoves( nullptr, 0 );
+      _yawServo.SetDanceMoves( DANCE_MOVES( DanceRoutine4::yawMoves ) );
+      _pitchServo.SetDanceMoves( DANCE_MOVES( DanceRoutine4::pitchMoves ) );
+   }
 
-      _rollServo->SetDanceMoves( rollMoves, sizeof( rollMoves ) / sizeof( DanceSpeedMove ) );
-      _yawServo->SetDanceMoves( yawMoves, sizeof( yawMoves ) / sizeof( DanceSpeedMove ) );
-      _pitchServo->SetDanceMoves( pitchMoves, sizeof( pitchMoves ) / sizeof( DanceAngleMove ) );
+   void SetStreamedRoutine()
+   {
+      _rollServo.SetDanceStream( DanceAxisRoll );
+      _yawServo.SetDanceStream( DanceAxisYaw );
+      _pitchServo.SetDanceStream( DanceAxisPitch );
    }
 };
\ No newline at end of file
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Servo.h>
+#include "Barrel.h"
+#include "RotationEstimator.h"
+#include "Telemetry.h"
+#include "TurretConfig.h"
+
+// A servo that remembers the last value written to it
+class TurretServo
+{
+public:
+   void Attach( uint8_t pin, uint8_t startValue )
+   {
+      servo.attach( pin );
+      servo.write( startValue );
+      position = startValue;
+
+      if ( rotation != nullptr )
+      {
+         rotation->SpeedChanged( startValue );
+      }
+   }
+
+   // Keeps rotation up to date with every speed this (continuous rotation) servo is given
+   void TrackRotation( RotationEstimator* estimator )
+   {
+      rotation = estimator;
+   }
+
+   // Writes value to the servo if it is different from what was last written
+   void Write( uint8_t value )
+   {
+      if ( value != position )
+      {
+         if ( rotation != nullptr )
+         {
+            rotation->SpeedChanged( value );
+         }
+
+         servo.write( value );
+         position = value;
+         telemetry.ServoWritten();
+      }
+   }
+
+   // Estimator that tracks this servo, nullptr if it isn't a continuous rotation servo
+   RotationEstimator* Rotation() const
+   {
+      return rotation;
+   }
+
+   // Last value written to the servo. This is the angle for the pitch servo and the speed for the others.
+   uint8_t Position() const
+   {
+      return position;
+   }
+
+private:
+   Servo servo;
+   uint8_t position = 0;
+   RotationEstimator* rotation = nullptr;
+};
+
+// The turret's three servos. They are attached once at startup and lent to whichever program
+// is running, so switching programs doesn't re-attach or re-home them and the pitch angle
+// carries over from one program to the next.
+class TurretHardware
+{
+public:
+   TurretServo yaw;   // Continuous servo responsible for YAW rotation, 360 spin around the base
+   TurretServo pitch; // Servo responsible for PITCH rotation, up and down tilt
+   TurretServo roll;  // Continuous servo responsible for ROLL rotation, spins the barrel to fire darts
+
+   RotationEstimator yawHeading;   // Dead reckoned heading of the yaw servo (degrees, positive is counterclockwise)
+   RotationEstimator rollRotation; // Dead reckoned angle of the barrel (degrees)
+   Barrel barrel;                  // Darts left in the barrel, shared by every program that fires
+
+   TurretHardware()
+      : yawHeading( yawDegreesPerSecond, YAW_STOP_SPEED ), rollRotation( rollDegreesPerSecond, ROLL_STOP_SPEED ), barrel( rollRotation )
+   {
+      yaw.TrackRotation( &yawHeading );
+      roll.TrackRotation( &rollRotation );
+   }
+
+   // Attaches the servos using the pins and speeds in config, so config should be loaded first
+   void Begin()
+   {
+      yawHeading.SetStopValue( config.yawStopSpeed );
+      rollRotation.SetStopValue( config.rollStopSpeed );
+
+      // Use the speeds measured by the calibration program if it has been run
+      if ( config.servosCalibrated )
+      {
+         yawHeading.SetTable( config.yawSpeeds );
+         rollRotation.SetTable( config.rollSpeeds );
+      }
+
+      yaw.Attach( config.yawPin, config.yawStopSpeed );
+      roll.Attach( config.rollPin, config.rollStopSpeed );
+      pitch.Attach( config.pitchPin, config.pitchHomeAngle );
+   }
+
+   // Stops the yaw and roll servos. The pitch servo is left where it is.
+   void Stop()
+   {
+      yaw.Write( config.yawStopSpeed );
+      roll.Write( config.rollStopSpeed );
+   }
+
+   // Slows the yaw and roll servos down to a stop over at most budget ms instead of stopping them
+   // instantly, so reversing a spinning servo doesn't pull too much current. The pitch servo is left where it is.
+   void StopWithin( uint16_t budget )
+   {
+      const uint8_t stepTime = 10;
+      int steps = budget / stepTime;
+      int yawStart = yaw.Position();
+      int rollStart = roll.Position();
+
+      for ( int i = 1; i < steps && (yaw.Position() != config.yawStopSpeed || roll.Position() != config.rollStopSpeed); i++ )
+      {
+         yaw.Write( yawStart + (config.yawStopSpeed - yawStart) * i / steps );
+         roll.Write( rollStart + (config.rollStopSpeed - rollStart) * i / steps );
+         delay( stepTime );
+      }
+
+      Stop();
+   }
+};
@@ -1,286 +1,347 @@
+#pragma once
+
 #include <Arduino.h>
 #include "PinDefinitionsAndMore.h"
 #include "Utils.h"
 #include "BaseProgram.h"
-#include <Servo.h>
+#include "MotionScheduler.h"
+#include "RecoilLayer.h"
+#include "TurretConfig.h"
+#include "TurretHardware.h"
+
+#define ROULETTE_SPIN_TIME 10000 // Milliseconds the turret spins before deciding whether to shoot
+#define ROULETTE_PITCH_ANGLE 90   // Angle the PITCH servo is aimed at while playing (kept within pitchMin to pitchMax)
 
-#define RECOIL_FIRE_AMOUNT2 8 // This is how much the pitch servo moves 3 times for recoil with a 50ms delay
+// Steps of a game of roulette. The game is stepped a little bit every Loop() instead of
+// blocking until it is over, so commands like ok can still stop it at any point.
+enum class RouletteState : uint8_t
+{
+   Idle,       // Not playing
+   Spinning,   // Spinning around and slowing down
+   Revealing,  // Shaking head and firing (or not), waiting for the queued motion to finish
+};
 
 class TurretRouletteProgram : public BaseProgram
 {
 public:
+   TurretRouletteProgram( TurretHardware& turretHardware )
+      : hardware( turretHardware )
+   {
+   }
+
    void Setup() override
    {
-      yawServo.attach( 10 ); //attach YAW servo to pin 3
-      pitchServo.attach( 11 ); //attach PITCH servo to pin 4
-      rollServo.attach( 12 ); //attach ROLL servo to pin 5
-
-      yawServo.write( 90 ); //setup YAW servo to be STOPPED (90)
-      delay( 20 );
-      rollServo.write( 90 ); //setup ROLL servo to be STOPPED (90)
-      delay( 100 );
-      pitchServo.write( 100 ); //set PITCH servo to 100 degree position
-      delay( 100 );
-      pitchServoVal = 100;
+      motion.Clear();
+      motion.yaw.Attach( &hardware.yaw );
+      motion.pitch.Attach( &hardware.pitch );
+      motion.roll.Attach( &hardware.roll );
+
+      hardware.yaw.Write( yawStopSpeed ); //setup YAW servo to be STOPPED (90)
+      hardware.roll.Write( rollStopSpeed ); //setup ROLL servo to be STOPPED (90)
+      pitchServoVal = hardware.pitch.Position(); // keep the PITCH servo where the last program left it
+
+      state = RouletteState::Idle;
+      shootAnyway = false;
+      recoil.Clear();
 
       randomSeed( analogRead( 0 ) );
    }
 
    void Loop( uint16_t cmd ) override
    {
-      if ( cmd != -1 )
+      if ( cmd != (uint16_t)-1 )
       {
          switch ( cmd )
          {
             case up:
             {
-               if ( pitchServoVal > 10 )
+               if ( !isPlaying() && pitchServoVal > pitchMin && motion.pitch.Push( pitchServoVal - pitchMoveSpeed, 50 ) )
                {
-                  pitchServoVal = pitchServoVal - 8;
-                  pitchServo.write( pitchServoVal );
-                  delay( 50 );
+                  pitchServoVal = pitchServoVal - pitchMoveSpeed;
                }
                break;
             }
             case down:
             {
-               if ( pitchServoVal < 175 )
+               if ( !isPlaying() && pitchServoVal < pitchMax && motion.pitch.Push( pitchServoVal + pitchMoveSpeed, 50 ) )
                {
-                  pitchServoVal = pitchServoVal + 8;
-                  pitchServo.write( pitchServoVal );
-                  delay( 50 );
+                  pitchServoVal = pitchServoVal + pitchMoveSpeed;
                }
                break;
             }
             case left:
             {
-               yawServo.write( 180 );
-               delay( 200 );
-               yawServo.write( 90 );
-               delay( 5 );
+               if ( !isPlaying() )
+               {
+                  motion.yaw.PushPulse( yawStopSpeed + yawMoveSpeed, 200, yawStopSpeed, 5 ); // turns for longer instead of being cut off when pressed a lot
+               }
                break;
             }
             case right:
             {
-               yawServo.write( 0 );
-               delay( 200 );
-               yawServo.write( 90 );
-               delay( 5 );
+               if ( !isPlaying() )
+               {
+                  motion.yaw.PushPulse( yawStopSpeed - yawMoveSpeed, 200, yawStopSpeed, 5 );
+               }
                break;
             }
             case ok:
             {
-               if ( !isPlaying )
+               if ( isPlaying() )
+               {
+                  stopGame();
+               }
+               else
                {
-                  isPlaying = true;
                   fire();
-                  isPlaying = false;
                }
                break;
             }
             case star:
             {
-               if ( !isPlaying )
+               if ( !isPlaying() )
                {
-                  isPlaying = true;
                   fireAll();
-                  delay( 50 );
-                  isPlaying = false;
                }
                break;
             }
             case hashtag:
             {
-               if ( !isPlaying )
+               if ( !isPlaying() && motion.IsIdle() )
                {
-                  isPlaying = true;
-                  spinAndFire();
-                  isPlaying = false;
+                  startSpin();
                }
                break;
             }
+            case cmd6:
+            {
+               hardware.barrel.Reload(); // all 6 darts are back in
+               break;
+            }
             default:
             {
                break;
             }
          }
       }
-      delay( 5 );
+
+      updateGame();
+      motion.pitch.SetOffset( recoil.Offset( millis(), motion.pitch.Position(), pitchMin, pitchMax ) );
+      motion.Update();
    }
 
    bool CanShutdown() override
    {
-      return !isPlaying;
+      return !isPlaying() && motion.IsIdle() && recoil.IsIdle();
    }
 
    void Shutdown() override
    {
-      yawServo.detach();
-      pitchServo.detach();
-      rollServo.detach();
+      motion.Clear();
+
+      // Put the PITCH servo back where it was aimed if it is in the middle of a recoil
+      recoil.Clear();
+      motion.pitch.SetOffset( 0 );
+      motion.pitch.Update( millis() );
+
+      hardware.Stop();
    }
 
 private:
-   Servo yawServo; //names the servo responsible for YAW rotation, 360 spin around the base
-   Servo pitchServo; //names the servo responsible for PITCH rotation, up and down tilt
-   Servo rollServo; //names the servo responsible for ROLL rotation, spins the barrel to fire2 darts
+   TurretHardware& hardware; // servos that are lent to this program while it is running
 
    int yawServoVal; //initialize variables to store the current value of each servo
    int pitchServoVal = 100;
    int rollServoVal;
 
-   int pitchMoveSpeed = 8; //this variable is the angle added to the pitch servo to control how quickly the PITCH servo moves - try values between 3 and 10
-   int yawMoveSpeed = 90; //this variable is the speed controller for the continuous movement of the YAW servo motor. It is added or subtracted from the yaw2StopSpeed, so 0 would mean full speed rotation in one direction, and 180 means full rotation in the other. Try values between 10 and 90;
-   int yawStopSpeed = 90; //value to stop the yaw motor - keep this at 90
-   int rollMoveSpeed = 90; //this variable is the speed controller for the continuous movement of the ROLL servo motor. It is added or subtracted from the roll2StopSpeed, so 0 would mean full speed rotation in one direction, and 180 means full rotation in the other. Keep this at 90 for best performance / highest torque from the roll motor when firing.
-   int rollStopSpeed = 90; //value to stop the roll motor - keep this at 90
+   int pitchMoveSpeed = config.pitchMoveSpeed; //this variable is the angle added to the pitch servo to control how quickly the PITCH servo moves - try values between 3 and 10
+   int yawMoveSpeed = config.yawMoveSpeed; //this variable is the speed controller for the continuous movement of the YAW servo motor. It is added or subtracted from the yaw2StopSpeed, so 0 would mean full speed rotation in one direction, and 180 means full rotation in the other. Try values between 10 and 90;
+   int yawStopSpeed = config.yawStopSpeed; //value to stop the yaw motor - keep this at 90
+   int rollMoveSpeed = config.rollMoveSpeed; //this variable is the speed controller for the continuous movement of the ROLL servo motor. It is added or subtracted from the roll2StopSpeed, so 0 would mean full speed rotation in one direction, and 180 means full rotation in the other. Keep this at 90 for best performance / highest torque from the roll motor when firing.
+   int rollStopSpeed = config.rollStopSpeed; //value to stop the roll motor - keep this at 90
+
+   int pitchMax = config.pitchMax; // this sets the maximum angle of the pitch servo to prevent it from crashing, it should remain below 180, and be greater than the pitch2Min
+   int pitchMin = config.pitchMin; // this sets the minimum angle of the pitch servo to prevent it from crashing, it should remain above 0, and be less than the pitch2Max
+
+   MotionScheduler motion; // queued servo moves that get played back from Loop() instead of blocking in delay()
+   RecoilLayer recoil;     // added on top of the PITCH servo instead of being queued on it
 
-   int pitchMax = 175; // this sets the maximum angle of the pitch servo to prevent it from crashing, it should remain below 180, and be greater than the pitch2Min
-   int pitchMin = 10; // this sets the minimum angle of the pitch servo to prevent it from crashing, it should remain above 0, and be less than the pitch2Max
+   RouletteState state = RouletteState::Idle;
+   unsigned long spinStartTime = 0;
+   bool spinAgain = false;   // set when the turret decided not to shoot and the game keeps going
+   bool shootAnyway = false; // set when the turret shook its head no but is going to shoot after all
 
-   bool isPlaying = false;
+   bool isPlaying()
+   {
+      return state != RouletteState::Idle;
+   }
 
    void shakeHeadYes( int moves = 3 )
    {
       int startAngle = pitchServoVal; // Current position of the pitch servo
-      int lastAngle = pitchServoVal;
       int nodAngle = startAngle + 20; // Angle for nodding motion
 
-      for ( int i = 0; i < moves; i++ )
+      if ( !motion.pitch.HasRoom( 4 * moves ) )
       {
-         // Nod up
-         for ( int angle = startAngle; angle <= nodAngle; angle++ )
-         {
-            pitchServo.write( angle );
-            delay( 7 );
-         }
-         delay( 50 );
-
-         // Nod down
-         for ( int angle = nodAngle; angle >= startAngle; angle-- )
-         {
-            pitchServo.write( angle );
-            delay( 7 );
-         }
+         return; // a half finished nod would leave the turret looking somewhere else
+      }
 
-         delay( 50 );
+      for ( int i = 0; i < moves; i++ )
+      {
+         motion.pitch.PushRamp( nodAngle, 7 * (nodAngle - startAngle) ); // Nod up
+         motion.pitch.PushWait( 50 );
+         motion.pitch.PushRamp( startAngle, 7 * (nodAngle - startAngle) ); // Nod down
+         motion.pitch.PushWait( 50 );
       }
    }
 
    void shakeHeadNo( int moves = 3 )
    {
-      int startAngle = pitchServoVal; // Current position of the pitch servo
-      int lastAngle = pitchServoVal;
-      int nodAngle = startAngle + 60; // Angle for nodding motion
+      if ( !motion.yaw.HasRoom( 4 * moves ) )
+      {
+         return; // a half finished shake could leave the YAW servo turning
+      }
 
       for ( int i = 0; i < moves; i++ )
       {
          // rotate right, stop, then rotate left, stop
-         yawServo.write( 140 );
-         delay( 190 ); // Adjust delay for smoother motion
-         yawServo.write( yawStopSpeed );
-         delay( 50 );
-         yawServo.write( 40 );
-         delay( 190 ); // Adjust delay for smoother motion
-         yawServo.write( yawStopSpeed );
-         delay( 50 ); // Pause at starting position
+         motion.yaw.Push( yawStopSpeed + 50, 190 ); // Adjust time for smoother motion
+         motion.yaw.Push( yawStopSpeed, 50 );
+         motion.yaw.Push( yawStopSpeed - 50, 190 ); // Adjust time for smoother motion
+         motion.yaw.Push( yawStopSpeed, 50 ); // Pause at starting position
       }
    }
 
-   void doRecoil()
+   // Fires shots darts (however many are left) in one turn of the barrel, or shakes no if the barrel is empty
+   void fire( uint8_t shots = 1 )
    {
-      if ( RECOIL_FIRE_AMOUNT2 != 0 )
+      if ( recoil.FireDarts( hardware.barrel, motion.roll, shots, rollStopSpeed, rollMoveSpeed ) == FireResult::Empty )
       {
-         auto origPitchVal = pitchServoVal;
-
-         for ( auto i = 0; i < 3; i++ )
-         {
-            pitchServoVal += RECOIL_FIRE_AMOUNT2;
-            pitchServoVal = min( pitchServoVal, pitchMax );
-            pitchServoVal = max( pitchServoVal, pitchMin );
-            pitchServo.write( pitchServoVal );
-            delay( 50 );
-         }
-
-         for ( auto i = 0; i < 3; i++ )
-         {
-            pitchServoVal -= RECOIL_FIRE_AMOUNT2;
-            pitchServoVal = min( pitchServoVal, pitchMax );
-            pitchServoVal = max( pitchServoVal, pitchMin );
-            pitchServo.write( pitchServoVal );
-            delay( 50 );
-         }
-
-         pitchServo.write( origPitchVal );
+         shakeHeadNo( 1 );
       }
    }
 
-   void fire()
+   // Fires every dart that is left. Unlike TurretControl this is queued like the rest of the game's moves
+   // (so it can wait for them) instead of being paced as a burst.
+   void fireAll()
    {
-      rollServo.write( 180 );//start rotating the servo
-      delay( 150 );//time for approximately 60 degrees of rotation
-      rollServo.write( 90 );//stop rotating the servo
+      fire( BARREL_CHAMBERS );
+   }
 
-      doRecoil();
+   void startSpin()
+   {
+      state = RouletteState::Spinning;
+      spinStartTime = millis();
 
-      delay( 5 );
+      pitchServoVal = constrain( ROULETTE_PITCH_ANGLE, pitchMin, pitchMax );
+      motion.pitch.Push( pitchServoVal, 20 ); // Adjust time for smoother movement
+      yawServoVal = yawStopSpeed + yawMoveSpeed;
+      motion.yaw.Push( yawServoVal, 20 );
    }
 
-   void fireAll()
+   void stopGame()
    {
-      rollServo.write( 180 );//start rotating the servo
-      delay( 1500 );//time for 360 degrees of rotation
-      rollServo.write( 90 );//stop rotating the servo
-
-      doRecoil();
+      state = RouletteState::Idle;
+      shootAnyway = false;
 
-      delay( 5 );
+      motion.Clear();
+      motion.yaw.Push( yawStopSpeed, 5 );
+      motion.roll.Push( rollStopSpeed, 5 );
    }
 
-   void spinAndFire()
+   // Steps the game forward. Called every Loop() so it never blocks.
+   void updateGame()
    {
-      unsigned long startTime = millis();
-      pitchServo.write( 90 );
-      yawServoVal = 180;
-      yawServo.write( yawServoVal );
-      delay( 20 ); // Adjust delay for smoother movement
-      while ( millis() - startTime < 10000 )
+      switch ( state )
       {
-         if ( millis() % 1000 == 0 && yawServoVal > 90 )
+         case RouletteState::Spinning:
          {
-            yawServoVal--;
-            yawServo.write( yawServoVal );
+            auto elapsed = millis() - spinStartTime;
+            if ( elapsed < ROULETTE_SPIN_TIME )
+            {
+               // Slow down by one step for every second that has passed
+               int spinSpeed = max( yawStopSpeed, yawStopSpeed + yawMoveSpeed - (int)(elapsed / 1000) );
+               if ( spinSpeed != yawServoVal )
+               {
+                  yawServoVal = spinSpeed;
+                  motion.yaw.Push( yawServoVal, 0 );
+               }
+               break;
+            }
+
+            motion.yaw.Clear(); // only the spin is queued, and it is stopped here
+            motion.yaw.Set( yawStopSpeed );
+            decide();
+            state = RouletteState::Revealing;
+            break;
+         }
+         case RouletteState::Revealing:
+         {
+            if ( motion.IsIdle() && recoil.IsIdle() )
+            {
+               if ( shootAnyway )
+               {
+                  surprise();
+               }
+               else if ( spinAgain )
+               {
+                  startSpin();
+               }
+               else
+               {
+                  state = RouletteState::Idle;
+               }
+            }
+            break;
+         }
+         default:
+         {
+            break;
          }
       }
-      yawServo.write( 90 );
+   }
+
+   // Picks whether to shoot and queues the reaction
+   void decide()
+   {
+      spinAgain = false;
 
       bool shoot = random( 2 ) == 1;
       if ( shoot )
       {
          shakeHeadYes();
-         delay( 1000 );
+         motion.WaitForAll();
+         motion.roll.PushWait( 1000 );
          fire();
       }
       else
       {
          shakeHeadNo();
-         delay( 1000 );
+         motion.WaitForAll();
 
-         shoot = random( 1, 11 ) == 1;
-         if ( shoot )
-         {
-            yawServo.write( 150 );
-            delay( 500 );
-            yawServo.write( 30 );
-            delay( 450 );
-            yawServo.write( 90 );
-            pitchServo.write( 90 );
-            fireAll();
-         }
-         else
+         shootAnyway = random( 1, 11 ) == 1;
+         if ( !shootAnyway )
          {
-            spinAndFire();
+            motion.yaw.PushWait( 1000 );
+            spinAgain = true;
          }
       }
    }
+
+   // Turns back around and fires after shaking head no. Queued on its own once the shaking has finished,
+   // since the shaking already takes up most of the YAW queue.
+   void surprise()
+   {
+      shootAnyway = false;
+
+      motion.yaw.PushWait( 1000 );
+      motion.yaw.Push( yawStopSpeed + 60, 500 );
+      motion.yaw.Push( yawStopSpeed - 60, 450 );
+      motion.yaw.Push( yawStopSpeed, 0 );
+      pitchServoVal = constrain( ROULETTE_PITCH_ANGLE, pitchMin, pitchMax );
+      motion.pitch.PushWaitFor( motion.yaw, millis() );
+      motion.pitch.Push( pitchServoVal, 0 );
+      motion.roll.PushWaitFor( motion.yaw, millis() );
+      fireAll();
+   }
 };
\ No newline at end of file
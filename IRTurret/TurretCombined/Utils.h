@@ -1,3 +1,5 @@
+#pragma once
+
 // Codes for buttons on remote
 #define left 0x8
 #define right 0x5A
@@ -0,0 +1,225 @@
+#include <Arduino.h>
+#include "ServoController.h"
+#include "TestCheck.h"
+
+// Compares the pitch angles ServoAngleController writes with its fixed point interpolation against the
+// floating point Update() it replaced (FloatAngleController below) and against the ideal straight line
+// from each move's start angle to its target. Both controllers are ticked every TICK_TIME ms like TurretDance.
+//
+// The float version only moved once a tick added up to at least a whole degree, so slow moves stepped
+// unevenly, and that test was never true for moves to a lower angle (the amount is negative), so those sat
+// still and jumped to the target when the move ended. The fixed point version keeps the fraction of a degree
+// between ticks, so it stays within half a degree of the ideal line in both directions.
+
+#define TICK_TIME 15
+
+struct Move
+{
+   uint16_t duration;
+   uint8_t targetAngle;
+};
+
+// Slow and fast moves both ways, with a wait in between
+static const Move routine[] =
+{
+   { 1000, 110 },
+   { 500, 0 }, // wait
+   { 400, 90 },
+   { 100, 110 },
+   { 2000, 60 },
+   { 300, 100 },
+};
+
+static constexpr uint8_t routineMoves[] PROGMEM =
+{
+   DANCE_MOVE( 1000, 110 ),
+   DANCE_WAIT( 500 ),
+   DANCE_MOVE( 400, 90 ),
+   DANCE_MOVE( 100, 110 ),
+   DANCE_MOVE( 2000, 60 ),
+   DANCE_MOVE( 300, 100 ),
+};
+
+#define START_ANGLE 100
+#define MOVE_COUNT (sizeof( routine ) / sizeof( routine[0] ))
+
+// ServoAngleController::Update() as it was before the fixed point math, apart from taking the time as an
+// argument and keeping the move end times based on the routine start like the current controllers do
+class FloatAngleController
+{
+public:
+   FloatAngleController( uint8_t startAngle, uint16_t maxSpd )
+      : currentPosition( startAngle ), maxSpeed( maxSpd )
+   {
+   }
+
+   uint8_t Angle() const
+   {
+      return currentPosition;
+   }
+
+   bool Update( unsigned long currentTime )
+   {
+      while ( currentMoveIndex < MOVE_COUNT )
+      {
+         const Move& move = routine[currentMoveIndex];
+         bool isWaitMove = move.targetAngle == 0;
+         unsigned long timeElapsed = currentTime - lastTime;
+         double secsElapsed = (double)timeElapsed / 1000.0;
+         unsigned long animTimeElapsed = currentTime - startMoveTime;
+
+         if ( !started )
+         {
+            started = true;
+            speed = ((double)move.targetAngle - currentPosition) / ((double)move.duration / 1000.0);
+            speed = speed < 0 ? max( -(int)maxSpeed, speed ) : min( (int)maxSpeed, speed );
+         }
+
+         double amtToMove = (double)speed * secsElapsed;
+         if ( (amtToMove >= 1) || (animTimeElapsed >= move.duration) )
+         {
+            double newPosition = currentPosition + amtToMove;
+            newPosition = speed < 0 ? max( (double)move.targetAngle, newPosition ) : min( (double)move.targetAngle, newPosition );
+
+            if ( !isWaitMove )
+            {
+               currentPosition = newPosition;
+            }
+            lastTime = currentTime;
+         }
+
+         if ( animTimeElapsed < move.duration )
+         {
+            return false;
+         }
+
+         currentMoveIndex++;
+         startMoveTime += move.duration;
+         started = false;
+         lastTime = currentTime;
+      }
+      return true;
+   }
+
+private:
+   uint8_t currentPosition;
+   uint16_t maxSpeed;
+   size_t currentMoveIndex = 0;
+   unsigned long startMoveTime = 0;
+   unsigned long lastTime = 0;
+   bool started = false;
+   int8_t speed = 0; // DanceMove::speed was an int8_t, so fast moves were cut short here too
+};
+
+// Where the servo should be at time on a straight line from each move's start to its target
+static double IdealAngle( unsigned long time )
+{
+   double angle = START_ANGLE;
+   unsigned long moveStart = 0;
+
+   for ( const Move& move : routine )
+   {
+      if ( time < moveStart + move.duration )
+      {
+         return move.targetAngle == 0 ? angle : angle + (move.targetAngle - angle) * (time - moveStart) / move.duration;
+      }
+
+      if ( move.targetAngle != 0 )
+      {
+         angle = move.targetAngle;
+      }
+      moveStart += move.duration;
+   }
+   return angle;
+}
+
+// Whether the move that is playing at time goes to a lower angle
+static bool IsDownwardMove( unsigned long time )
+{
+   double angle = START_ANGLE;
+   unsigned long moveStart = 0;
+
+   for ( const Move& move : routine )
+   {
+      if ( time < moveStart + move.duration )
+      {
+         return move.targetAngle != 0 && move.targetAngle < angle;
+      }
+      if ( move.targetAngle != 0 )
+      {
+         angle = move.targetAngle;
+      }
+      moveStart += move.duration;
+   }
+   return false;
+}
+
+int main()
+{
+   Host::Reset();
+
+   TurretServo pitch;
+   pitch.Attach( PITCH_SERVO_PIN, START_ANGLE );
+
+   ServoAngleController fixedController( pitch, PITCH_MIN_ANGLE, PITCH_MAX_ANGLE, PITCH_MAX_SPEED );
+   fixedController.SetDanceMoves( DANCE_MOVES( routineMoves ) );
+   FloatAngleController floatController( START_ANGLE, PITCH_MAX_SPEED );
+
+   double fixedMaxError = 0;
+   double floatMaxError = 0;
+   double floatMaxDownwardError = 0;
+   unsigned long fixedWrites = 0;
+   unsigned long floatWrites = 0;
+
+   bool fixedDone = false;
+   bool floatDone = false;
+   uint8_t lastFloatAngle = START_ANGLE;
+   unsigned long lastFixedWriteCount = Host::ServoWrites().size();
+
+   printf( "time,ideal,fixed,float\n" );
+   for ( unsigned long time = 0; !fixedDone || !floatDone; time += TICK_TIME )
+   {
+      fixedDone = fixedController.Update( time );
+      floatDone = floatController.Update( time );
+
+      double ideal = IdealAngle( time );
+      double fixedError = fabs( fixedController.Angle() - ideal );
+      double floatError = fabs( floatController.Angle() - ideal );
+
+      fixedMaxError = max( fixedMaxError, fixedError );
+      floatMaxError = max( floatMaxError, floatError );
+      if ( IsDownwardMove( time ) )
+      {
+         floatMaxDownwardError = max( floatMaxDownwardError, floatError );
+      }
+
+      fixedWrites += Host::ServoWrites().size() - lastFixedWriteCount;
+      lastFixedWriteCount = Host::ServoWrites().size();
+      floatWrites += floatController.Angle() != lastFloatAngle;
+      lastFloatAngle = floatController.Angle();
+
+      printf( "%lu,%.1f,%d,%d\n", time, ideal, fixedController.Angle(), floatController.Angle() );
+
+      CHECK( time < 10000 );
+      if ( time >= 10000 )
+      {
+         break;
+      }
+   }
+
+   printf( "max error from ideal: fixed %.2f, float %.2f (%.2f on downward moves)\n", fixedMaxError, floatMaxError, floatMaxDownwardError );
+   printf( "servo writes: fixed %lu, float %lu\n", fixedWrites, floatWrites );
+
+   // Rounding to whole degrees is the only error left
+   CHECK( fixedMaxError <= 0.5 );
+
+   // Both end up at the last target
+   CHECK_EQUAL( routine[MOVE_COUNT - 1].targetAngle, fixedController.Angle() );
+   CHECK_EQUAL( routine[MOVE_COUNT - 1].targetAngle, floatController.Angle() );
+
+   // The float version sat still on the way down, which is what the fixed point version changed
+   CHECK( floatMaxDownwardError > 10 );
+   CHECK( fixedMaxError < floatMaxError );
+
+   return TestResult();
+}
@@ -0,0 +1,165 @@
+#include "HostSketch.h"
+#include "TestCheck.h"
+#include <time.h>
+
+// Plays the built in dance routines on the virtual clock with DANCE_BENCHMARK turned on and prints the
+// report TurretDance sends over Serial for each one. micros() reads the machine's clock (see
+// Host::UseRealMicros()), so avgUs/maxUs are how long Update() really took on this machine. Everything else in
+// the report comes out the same on every run, so changes to the controllers can be compared write for write.
+// hostNsPerLoop is how long loop() took while the routine played. The times are only useful for comparing
+// builds on the same machine, so they are only reported. They depend on how busy the machine is (and on
+// sanitizers or valgrind), so they are only checked against the budgets below with --check-budget.
+//
+// dance_bench [--check-budget]
+
+#define LOOP_TIME 15 // ms of virtual time every loop() takes while dancing: 10ms in TurretDance and 5ms in loop()
+#define AVG_UPDATE_BUDGET 5  // With --check-budget, most microseconds one Update() can take on average on the host. The board is ~50x slower.
+#define MAX_UPDATE_BUDGET 200 // With --check-budget, most microseconds the slowest Update() can take on the host, ~10ms on the board
+
+// The report's maxStep is in servo values, which jump across the speeds around stopSpeed where the servo
+// doesn't turn. speedStep is the biggest change in speed (percent of the max speed, -100 to 100) from one
+// write to the next, which is what ramped moves limit. A full speed reversal is 200.
+
+static const char* const axisNames[] = { "roll", "yaw", "pitch" };
+
+// Value of name=value in the line of text that starts with line, -1 if it isn't there
+static double Field( const std::string& text, const char* line, const char* name )
+{
+   size_t start = text.find( std::string( line ) + " " );
+   if ( start == std::string::npos )
+   {
+      return -1;
+   }
+
+   size_t end = text.find( '\n', start );
+   size_t position = text.find( std::string( " " ) + name + "=", start );
+   return position < end ? atof( text.c_str() + position + strlen( name ) + 2 ) : -1;
+}
+
+// text without the Update() times, which are different on every run
+static std::string WithoutTimes( std::string text )
+{
+   for ( const char* name : { " avgUs=", " maxUs=" } )
+   {
+      for ( size_t position = text.find( name ); position != std::string::npos; position = text.find( name, position ) )
+      {
+         text.erase( position, text.find( ' ', position + 1 ) - position );
+      }
+   }
+   return text;
+}
+
+// Speed (-100 to 100) of a continuous rotation servo value, the way ServoSpeedController maps it
+static int SpeedPercent( int value, int stopSpeed, int minSpeed, int maxSpeed )
+{
+   int offset = value - stopSpeed;
+   if ( abs( offset ) <= minSpeed )
+   {
+      return 0;
+   }
+   int percent = (abs( offset ) - minSpeed) * 100 / (maxSpeed - minSpeed);
+   return offset < 0 ? -percent : percent;
+}
+
+// Biggest speed change between writes to pin from the write at index on
+static int SpeedStep( uint8_t pin, size_t index, int stopSpeed, int minSpeed, int maxSpeed )
+{
+   const std::vector<Host::ServoWrite>& writes = Host::ServoWrites();
+   int last = 0;
+   int step = 0;
+
+   for ( ; index < writes.size(); index++ )
+   {
+      if ( writes[index].pin == pin )
+      {
+         int speed = SpeedPercent( writes[index].value, stopSpeed, minSpeed, maxSpeed );
+         step = max( step, abs( speed - last ) );
+         last = speed;
+      }
+   }
+   return step;
+}
+
+// Switches to the dance program and plays a routine until it is done, in a process of its own so every
+// routine starts from the same state. Returns "routine length=<ms> hostNsPerLoop=<ns> rollSpeedStep=<percent>
+// yawSpeedStep=<percent>" followed by the report.
+static std::string PlayRoutine( uint16_t button )
+{
+   return RunIsolated( [button]()
+   {
+      Host::Reset();
+      Host::UseRealMicros( true );
+      setup();
+
+      Host::PressButton( 100, cmd0 );
+      Host::PressButton( 200, cmd3 );
+      Host::PressButton( 300, button );
+      RunUntil( 500 );
+      Host::TakeSerialOutput();
+      size_t firstWrite = Host::ServoWrites().size();
+
+      timespec start, end;
+      unsigned long loops = 0;
+
+      clock_gettime( CLOCK_MONOTONIC, &start );
+      while ( !CanShutdownProgram() && millis() < 300000 )
+      {
+         loop();
+         loops++;
+      }
+      clock_gettime( CLOCK_MONOTONIC, &end );
+
+      long nsPerLoop = ((end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec)) / max( loops, 1UL );
+      int rollStep = SpeedStep( ROLL_SERVO_PIN, firstWrite, config.rollStopSpeed, config.rollMinSpeed, config.rollMaxSpeed );
+      int yawStep = SpeedStep( YAW_SERVO_PIN, firstWrite, config.yawStopSpeed, config.yawMinSpeed, config.yawMaxSpeed );
+
+      return "routine length=" + std::to_string( millis() - 300 ) + " hostNsPerLoop=" + std::to_string( nsPerLoop ) +
+         " rollSpeedStep=" + std::to_string( rollStep ) + " yawSpeedStep=" + std::to_string( yawStep ) + "\n" +
+         Host::TakeSerialOutput();
+   } );
+}
+
+static void BenchmarkRoutine( const char* name, uint16_t button, bool checkBudget )
+{
+   std::string report = PlayRoutine( button );
+   printf( "dance routine %s\n%s", name, report.c_str() );
+
+   // A move is noticed by the first tick at or after when it ends, never before it and never a whole tick late
+   for ( const char* axis : axisNames )
+   {
+      long drift = Field( report, axis, "maxDriftMs" );
+      CHECK( drift >= 0 );
+      CHECK( drift < LOOP_TIME );
+   }
+
+   // The same routine plays out exactly the same way every time
+   std::string again = PlayRoutine( button );
+   CHECK( WithoutTimes( again.substr( again.find( '\n' ) ) ) == WithoutTimes( report.substr( report.find( '\n' ) ) ) );
+   CHECK_EQUAL( Field( report, "routine", "length" ), Field( again, "routine", "length" ) );
+
+   // With --check-budget, Update() fits in its budget. The slowest tick is taken from the better of the two
+   // runs, so a tick the machine happened to interrupt on one of them doesn't count.
+   if ( checkBudget )
+   {
+      for ( const char* axis : axisNames )
+      {
+         CHECK( Field( report, axis, "avgUs" ) <= AVG_UPDATE_BUDGET );
+         CHECK( min( Field( report, axis, "maxUs" ), Field( again, axis, "maxUs" ) ) <= MAX_UPDATE_BUDGET );
+      }
+   }
+}
+
+int main( int argc, char** argv )
+{
+   bool checkBudget = argc > 1 && strcmp( argv[1], "--check-budget" ) == 0;
+
+   BenchmarkRoutine( "1", cmd1, checkBudget );
+   BenchmarkRoutine( "2", cmd2, checkBudget );
+   BenchmarkRoutine( "4", cmd4, checkBudget );
+
+   // Routine 4 reverses the yaw servo every 100ms with a Trapezoid profile of 4000 degrees/sec^2, which ramps
+   // by 4 percent per ms, so it never changes speed by more than a tick's worth of ramp
+   CHECK( Field( PlayRoutine( cmd4 ), "routine", "yawSpeedStep" ) <= 4 * LOOP_TIME + 1 );
+
+   return TestResult();
+}
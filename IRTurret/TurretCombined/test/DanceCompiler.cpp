@@ -0,0 +1,82 @@
+#include "DanceCompiler.h"
+
+// Compiles choreographies (see DanceCompiler.h for the format) into DanceRoutines.h. The built in routines
+// are regenerated with `cmake --build build --target dance_routines`.
+//
+// dance_compiler [--check] -o <header> <choreography>...
+//   --check: don't write the header, just fail if it isn't what the choreographies compile to
+
+static void PrintUsage()
+{
+   fprintf( stderr, "usage: dance_compiler [--check] -o <header> <choreography>...\n" );
+}
+
+int main( int argc, char** argv )
+{
+   bool check = false;
+   std::string outputPath;
+   std::vector<std::string> inputs;
+
+   for ( int i = 1; i < argc; i++ )
+   {
+      std::string argument = argv[i];
+      if ( argument == "--check" )
+      {
+         check = true;
+      }
+      else if ( argument == "-o" && i + 1 < argc )
+      {
+         outputPath = argv[++i];
+      }
+      else
+      {
+         inputs.push_back( argument );
+      }
+   }
+
+   if ( outputPath.empty() || inputs.empty() )
+   {
+      PrintUsage();
+      return 2;
+   }
+
+   DanceCompiler compiler;
+   bool compiled = true;
+   for ( const std::string& input : inputs )
+   {
+      compiled = compiler.CompileFile( input ) && compiled;
+   }
+   if ( !compiled )
+   {
+      fprintf( stderr, "%s", compiler.Errors().c_str() );
+      return 1;
+   }
+
+   std::string header = compiler.Header();
+   std::string existing;
+   bool current = DanceReadFile( outputPath, existing ) && existing == header;
+
+   if ( check )
+   {
+      if ( !current )
+      {
+         fprintf( stderr, "%s isn't up to date, run `cmake --build build --target dance_routines`\n", outputPath.c_str() );
+         return 1;
+      }
+      printf( "%s is up to date\n", outputPath.c_str() );
+      return 0;
+   }
+
+   if ( !current )
+   {
+      FILE* output = fopen( outputPath.c_str(), "wb" );
+      if ( output == nullptr || fwrite( header.data(), 1, header.size(), output ) != header.size() )
+      {
+         fprintf( stderr, "%s can't be written\n", outputPath.c_str() );
+         return 1;
+      }
+      fclose( output );
+   }
+   printf( "%u routine(s) written to %s\n", (unsigned)compiler.Routines().size(), outputPath.c_str() );
+   return 0;
+}
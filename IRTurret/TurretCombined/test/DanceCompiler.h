@@ -0,0 +1,844 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <Arduino.h>
+#include "DanceMove.h"
+#include "DanceStream.h"
+#include "TurretConfig.h"
+
+// Routine compiler: turns text choreographies into the packed tables in DanceRoutines.h, so routines can be
+// written in beats at a tempo instead of working out durations by hand. Every routine is checked the way the
+// turret will play it, with repeats expanded:
+// - roll/yaw speeds are from -100 to 100, and pitch angles from PITCH_MIN_ANGLE to PITCH_MAX_ANGLE
+// - no pitch move has to go faster than PITCH_MAX_SPEED to reach its target in time, including the loop
+//   back to the start of a repeat
+// - durations fit in the packed format, and `at` and `length` line up the axes (see below)
+// The speed of every pitch move that always starts from the same angle is worked out here and stored with it
+// (DANCE_SPEED), so ServoAngleController doesn't have to divide for it while playing. That takes 3 bytes of
+// flash per pitch move, so the size of each routine and how much of it is speeds is written above it.
+//
+// A choreography is a text file with one statement per line. Everything after # is a comment.
+//   routine <name>          Starts a routine, written to namespace <name>
+//   tempo <bpm>             Beats per minute of the durations after it
+//   const <name> <value>    Names a value, which can be used (or negated with -) wherever a value goes
+//   length <beats>          The longest axis of the routine takes exactly this long
+//   roll | yaw | pitch      The moves after it are for this axis. Each axis can only be given once.
+//   wait <beats>            Holds still
+//   move <beats> <value>    Moves at a speed (-100 to 100) for roll/yaw, or to an angle for pitch
+//   repeat <count> ... end  Plays the moves in between count (1-63) times
+//   profile constant | trapezoid <accel> | scurve <accel> <jerk>
+//                           How the moves after it speed up and slow down (see DANCE_PROFILE)
+//   at <beats>              The moves so far on this axis take exactly this long. Not allowed in a repeat.
+// Beats can have decimals, e.g. 0.5, as long as they come to a whole number of DANCE_TIME_UNIT ms.
+
+#define DANCE_MAX_DURATION 65000 // Longest wait or move (ms) that a DanceMove can hold
+
+// Appends the contents of a file to text
+inline bool DanceReadFile( const std::string& path, std::string& text )
+{
+   FILE* input = fopen( path.c_str(), "rb" );
+   if ( input == nullptr )
+   {
+      return false;
+   }
+
+   char buffer[4096];
+   size_t count;
+   while ( (count = fread( buffer, 1, sizeof( buffer ), input )) > 0 )
+   {
+      text.append( buffer, count );
+   }
+   fclose( input );
+   return true;
+}
+
+// One entry of a compiled axis, in the order it is stored
+struct DanceEntry
+{
+   enum Kind { Wait, Move, Repeat, EndRepeat, Profile };
+
+   Kind kind;
+   int line;
+   uint16_t duration = 0;  // ms of a Wait or Move
+   int value = 0;          // Speed or angle of a Move, count of a Repeat
+   MotionProfile profile = MotionProfile::Constant;
+   uint32_t acceleration = 0;
+   uint32_t jerk = 0;
+   bool hasSpeed = false;  // Pitch move that always starts from the same angle, see DANCE_SPEED
+   int16_t speed = 0;
+};
+
+struct DanceCompiledRoutine
+{
+   std::string name;
+   std::string file;
+   std::vector<DanceEntry> axes[DanceAxisCount];
+   bool hasAxis[DanceAxisCount] = {};
+   uint32_t axisLength[DanceAxisCount] = {}; // ms with repeats expanded
+};
+
+class DanceCompiler
+{
+public:
+   // Compiles the choreography in text, adding its routines to Routines(). Returns false if there were errors.
+   bool Compile( const std::string& text, const std::string& fileName )
+   {
+      size_t errorCount = errors.size();
+      file = fileName;
+      tempo = 0;
+      consts.clear();
+      routine = nullptr;
+
+      int lineNumber = 0;
+      for ( size_t start = 0; start < text.size(); )
+      {
+         size_t end = text.find( '\n', start );
+         if ( end == std::string::npos )
+         {
+            end = text.size();
+         }
+         lineNumber++;
+         CompileLine( text.substr( start, end - start ), lineNumber );
+         start = end + 1;
+      }
+
+      FinishRoutine( lineNumber );
+      return errors.size() == errorCount;
+   }
+
+   // Reads and compiles a choreography file
+   bool CompileFile( const std::string& path )
+   {
+      std::string text;
+      if ( !DanceReadFile( path, text ) )
+      {
+         errors.push_back( path + ": can't be read" );
+         return false;
+      }
+
+      size_t slash = path.find_last_of( '/' );
+      return Compile( text, slash == std::string::npos ? path : path.substr( slash + 1 ) );
+   }
+
+   const std::vector<DanceCompiledRoutine>& Routines() const
+   {
+      return routines;
+   }
+
+   // Every error so far, one per line as <file>:<line>: <message>
+   std::string Errors() const
+   {
+      std::string text;
+      for ( const std::string& error : errors )
+      {
+         text += error + "\n";
+      }
+      return text;
+   }
+
+   // DanceRoutines.h for every routine compiled so far
+   std::string Header() const
+   {
+      std::string text =
+         "#pragma once\n"
+         "\n"
+         "// Generated by the routine compiler (test/DanceCompiler.h) from the choreographies in test/routines/. Change\n"
+         "// those and run `cmake --build build --target dance_routines` instead of editing this file.\n"
+         "\n"
+         "#include <Arduino.h>\n"
+         "#include \"DanceMove.h\"\n"
+         "#include \"TurretConfig.h\"\n";
+
+      for ( const DanceCompiledRoutine& compiled : routines )
+      {
+         size_t size = 0;
+         size_t speedSize = 0;
+         for ( uint8_t axis = 0; axis < DanceAxisCount; axis++ )
+         {
+            size += Bytes( compiled.axes[axis] ).size();
+            for ( const DanceEntry& entry : compiled.axes[axis] )
+            {
+               speedSize += entry.hasSpeed ? DanceEntrySize( DANCE_OP_SPEED ) : 0;
+            }
+         }
+
+         text += "\n// " + compiled.file + ": " + std::to_string( size ) + " bytes, " + std::to_string( speedSize ) +
+            " of them planned pitch speeds (DANCE_SPEED)\nnamespace " + compiled.name + "\n{\n";
+
+         for ( uint8_t axis = 0; axis < DanceAxisCount; axis++ )
+         {
+            if ( !compiled.hasAxis[axis] )
+            {
+               continue;
+            }
+
+            text += std::string( "   constexpr uint8_t " ) + axisNames[axis] + "Moves[] PROGMEM =\n   {\n";
+            int depth = 0;
+            for ( const DanceEntry& entry : compiled.axes[axis] )
+            {
+               depth -= entry.kind == DanceEntry::EndRepeat;
+               text += std::string( 6 + 3 * depth, ' ' ) + EntryText( entry ) + ",\n";
+               depth += entry.kind == DanceEntry::Repeat;
+            }
+            text += "   };\n\n";
+         }
+
+         for ( uint8_t axis = 0; axis < DanceAxisCount; axis++ )
+         {
+            if ( compiled.hasAxis[axis] )
+            {
+               text += axis == DanceAxisPitch ?
+                  "   DANCE_CHECK_ANGLES( pitchMoves, PITCH_MIN_ANGLE, PITCH_MAX_ANGLE, PITCH_MAX_SPEED );\n" :
+                  std::string( "   DANCE_CHECK_SPEEDS( " ) + axisNames[axis] + "Moves );\n";
+            }
+         }
+         text += "}\n";
+      }
+
+      return text;
+   }
+
+   // Packed bytes of an axis, the same as the macros in Header() produce
+   static std::vector<uint8_t> Bytes( const std::vector<DanceEntry>& entries )
+   {
+      std::vector<uint8_t> bytes;
+      for ( const DanceEntry& entry : entries )
+      {
+         uint16_t steps = entry.duration / DANCE_TIME_UNIT;
+         switch ( entry.kind )
+         {
+            case DanceEntry::Wait:
+               bytes.push_back( DANCE_OP_WAIT | (steps >> 8) );
+               bytes.push_back( steps & 0xFF );
+               break;
+            case DanceEntry::Move:
+               if ( entry.hasSpeed )
+               {
+                  bytes.push_back( DANCE_OP_SPEED );
+                  bytes.push_back( (uint16_t)entry.speed & 0xFF );
+                  bytes.push_back( (uint16_t)entry.speed >> 8 );
+               }
+               bytes.push_back( DANCE_OP_MOVE | (steps >> 8) );
+               bytes.push_back( steps & 0xFF );
+               bytes.push_back( (uint8_t)entry.value );
+               break;
+            case DanceEntry::Repeat:
+               bytes.push_back( DANCE_OP_REPEAT | entry.value );
+               break;
+            case DanceEntry::EndRepeat:
+               bytes.push_back( DANCE_OP_END_REPEAT );
+               break;
+            case DanceEntry::Profile:
+               bytes.push_back( DANCE_OP_PROFILE | (uint8_t)entry.profile );
+               bytes.push_back( entry.profile == MotionProfile::Constant ? 0 : entry.acceleration / DANCE_ACCEL_UNIT );
+               bytes.push_back( entry.profile == MotionProfile::SCurve ? entry.jerk / DANCE_JERK_UNIT : 0 );
+               break;
+         }
+      }
+      return bytes;
+   }
+
+private:
+   struct Const
+   {
+      std::string name;
+      int value;
+   };
+
+   // Where a repeat that hasn't been ended yet started
+   struct OpenRepeat
+   {
+      int count;
+      uint32_t timeBefore; // ms played on the axis before the repeat
+   };
+
+   static constexpr const char* axisNames[DanceAxisCount] = { "roll", "yaw", "pitch" };
+
+   std::vector<DanceCompiledRoutine> routines;
+   std::vector<std::string> errors;
+
+   std::string file;
+   uint32_t tempo;
+   std::vector<Const> consts;
+   DanceCompiledRoutine* routine;
+   uint32_t length;            // ms the routine's longest axis has to take, 0 if not given
+   int lengthLine;
+   int axis;                   // Axis the moves are for, -1 before the first one
+   uint32_t time;              // ms played on the axis so far, not counting repeats that haven't been ended
+   std::vector<OpenRepeat> repeats;
+
+   void Error( int line, const std::string& message )
+   {
+      errors.push_back( file + ":" + std::to_string( line ) + ": " + message );
+   }
+
+   static std::vector<std::string> Split( const std::string& line )
+   {
+      std::vector<std::string> words;
+      std::string text = line.substr( 0, line.find( '#' ) );
+      size_t start = 0;
+      while ( (start = text.find_first_not_of( " \t\r", start )) != std::string::npos )
+      {
+         size_t end = text.find_first_of( " \t\r", start );
+         words.push_back( text.substr( start, end - start ) );
+         start = end;
+      }
+      return words;
+   }
+
+   static bool IsName( const std::string& word )
+   {
+      if ( word.empty() || isdigit( (unsigned char)word[0] ) )
+      {
+         return false;
+      }
+      for ( char c : word )
+      {
+         if ( !isalnum( (unsigned char)c ) && c != '_' )
+         {
+            return false;
+         }
+      }
+      return true;
+   }
+
+   static bool ParseInteger( const std::string& word, long& value )
+   {
+      char* end = nullptr;
+      value = strtol( word.c_str(), &end, 10 );
+      return !word.empty() && *end == '\0';
+   }
+
+   // A number, or a const name, either of which can have a - in front of it
+   bool ParseValue( const std::string& word, int line, int& value )
+   {
+      bool negative = !word.empty() && word[0] == '-';
+      std::string text = negative ? word.substr( 1 ) : word;
+
+      long number;
+      if ( ParseInteger( text, number ) && text[0] != '-' && text[0] != '+' )
+      {
+         value = negative ? -number : number;
+         return true;
+      }
+
+      for ( const Const& named : consts )
+      {
+         if ( named.name == text )
+         {
+            value = negative ? -named.value : named.value;
+            return true;
+         }
+      }
+
+      Error( line, "'" + word + "' isn't a number or a const" );
+      return false;
+   }
+
+   // ms of a number of beats (which can have decimals) at the current tempo
+   bool ParseBeats( const std::string& word, int line, uint32_t& duration )
+   {
+      if ( tempo == 0 )
+      {
+         Error( line, "durations need a tempo first" );
+         return false;
+      }
+
+      uint64_t numerator = 0;
+      uint64_t denominator = 1;
+      bool decimals = false;
+      bool digits = false;
+      for ( char c : word )
+      {
+         if ( c == '.' && !decimals )
+         {
+            decimals = true;
+         }
+         else if ( isdigit( (unsigned char)c ) && numerator < 1000000000ULL )
+         {
+            numerator = numerator * 10 + (c - '0');
+            denominator *= decimals ? 10 : 1;
+            digits = true;
+         }
+         else
+         {
+            Error( line, "'" + word + "' isn't a number of beats" );
+            return false;
+         }
+      }
+
+      uint64_t unit = denominator * tempo * DANCE_TIME_UNIT;
+      if ( !digits || (numerator * 60000) % unit != 0 )
+      {
+         Error( line, word + " beats at " + std::to_string( tempo ) + " bpm isn't a whole number of " +
+                std::to_string( DANCE_TIME_UNIT ) + " ms steps" );
+         return false;
+      }
+
+      uint64_t ms = numerator * 60000 / denominator / tempo;
+      if ( ms > 0xFFFFFFFFULL )
+      {
+         Error( line, word + " beats is too long" );
+         return false;
+      }
+      duration = (uint32_t)ms;
+      return true;
+   }
+
+   // ms of a wait or a move, which has to fit in a DanceMove
+   bool ParseDuration( const std::string& word, int line, uint16_t& duration )
+   {
+      uint32_t ms;
+      if ( !ParseBeats( word, line, ms ) )
+      {
+         return false;
+      }
+      if ( ms == 0 || ms > DANCE_MAX_DURATION )
+      {
+         Error( line, "a wait or move has to take from " + std::to_string( DANCE_TIME_UNIT ) + " to " +
+                std::to_string( DANCE_MAX_DURATION ) + " ms, not " + std::to_string( ms ) );
+         return false;
+      }
+      duration = ms;
+      return true;
+   }
+
+   bool NeedsWords( const std::vector<std::string>& words, size_t count, int line )
+   {
+      if ( words.size() != count )
+      {
+         Error( line, "'" + words[0] + "' takes " + std::to_string( count - 1 ) + " value(s)" );
+         return false;
+      }
+      return true;
+   }
+
+   bool InAxis( const std::string& statement, int line )
+   {
+      if ( axis < 0 )
+      {
+         Error( line, "'" + statement + "' has to come after roll, yaw or pitch" );
+         return false;
+      }
+      return true;
+   }
+
+   void AddEntry( const DanceEntry& entry, uint32_t duration )
+   {
+      routine->axes[axis].push_back( entry );
+      time += duration;
+   }
+
+   void CompileLine( const std::string& text, int line )
+   {
+      std::vector<std::string> words = Split( text );
+      if ( words.empty() )
+      {
+         return;
+      }
+
+      const std::string& statement = words[0];
+
+      if ( statement == "routine" )
+      {
+         FinishRoutine( line );
+         if ( NeedsWords( words, 2, line ) && !IsName( words[1] ) )
+         {
+            Error( line, "'" + words[1] + "' isn't a name" );
+         }
+         routines.push_back( DanceCompiledRoutine() );
+         routine = &routines.back();
+         routine->name = words.size() > 1 ? words[1] : "";
+         routine->file = file;
+         length = 0;
+         axis = -1;
+         time = 0;
+         repeats.clear();
+         return;
+      }
+
+      if ( statement == "tempo" )
+      {
+         long bpm;
+         if ( NeedsWords( words, 2, line ) && (!ParseInteger( words[1], bpm ) || bpm <= 0 || bpm > 60000) )
+         {
+            Error( line, "tempo has to be from 1 to 60000 beats per minute" );
+         }
+         else if ( words.size() == 2 )
+         {
+            tempo = bpm;
+         }
+         return;
+      }
+
+      if ( statement == "const" )
+      {
+         int value;
+         if ( NeedsWords( words, 3, line ) && ParseValue( words[2], line, value ) )
+         {
+            if ( !IsName( words[1] ) )
+            {
+               Error( line, "'" + words[1] + "' isn't a name" );
+               return;
+            }
+            consts.push_back( { words[1], value } );
+         }
+         return;
+      }
+
+      if ( routine == nullptr )
+      {
+         Error( line, "'" + statement + "' has to come after routine" );
+         return;
+      }
+
+      if ( statement == "length" )
+      {
+         if ( NeedsWords( words, 2, line ) && ParseBeats( words[1], line, length ) )
+         {
+            lengthLine = line;
+         }
+         return;
+      }
+
+      for ( uint8_t i = 0; i < DanceAxisCount; i++ )
+      {
+         if ( statement == axisNames[i] )
+         {
+            FinishAxis( line );
+            if ( routine->hasAxis[i] )
+            {
+               Error( line, statement + " has already been given" );
+            }
+            NeedsWords( words, 1, line );
+            axis = i;
+            time = 0;
+            routine->hasAxis[i] = true;
+            routine->axes[i].clear();
+            return;
+         }
+      }
+
+      if ( !InAxis( statement, line ) )
+      {
+         return;
+      }
+
+      DanceEntry entry;
+      entry.line = line;
+
+      if ( statement == "wait" )
+      {
+         entry.kind = DanceEntry::Wait;
+         if ( NeedsWords( words, 2, line ) && ParseDuration( words[1], line, entry.duration ) )
+         {
+            AddEntry( entry, entry.duration );
+         }
+      }
+      else if ( statement == "move" )
+      {
+         entry.kind = DanceEntry::Move;
+         if ( NeedsWords( words, 3, line ) && ParseDuration( words[1], line, entry.duration ) &&
+              ParseValue( words[2], line, entry.value ) )
+         {
+            if ( axis == DanceAxisPitch && (entry.value < PITCH_MIN_ANGLE || entry.value > PITCH_MAX_ANGLE) )
+            {
+               Error( line, "pitch angle " + std::to_string( entry.value ) + " is outside " +
+                      std::to_string( PITCH_MIN_ANGLE ) + " to " + std::to_string( PITCH_MAX_ANGLE ) );
+            }
+            else if ( axis != DanceAxisPitch && (entry.value < -100 || entry.value > 100) )
+            {
+               Error( line, "speed " + std::to_string( entry.value ) + " is outside -100 to 100" );
+            }
+            AddEntry( entry, entry.duration );
+         }
+      }
+      else if ( statement == "repeat" )
+      {
+         long count;
+         entry.kind = DanceEntry::Repeat;
+         if ( !NeedsWords( words, 2, line ) )
+         {
+            return;
+         }
+         if ( !ParseInteger( words[1], count ) || count < 1 || count > 63 )
+         {
+            Error( line, "repeat count has to be from 1 to 63" );
+            count = 1;
+         }
+         if ( repeats.size() >= DANCE_MAX_REPEAT_DEPTH )
+         {
+            Error( line, "repeats can only be nested " + std::to_string( DANCE_MAX_REPEAT_DEPTH ) + " deep" );
+         }
+         entry.value = count;
+         repeats.push_back( { (int)count, time } );
+         AddEntry( entry, 0 );
+      }
+      else if ( statement == "end" )
+      {
+         entry.kind = DanceEntry::EndRepeat;
+         if ( !NeedsWords( words, 1, line ) )
+         {
+            return;
+         }
+         if ( repeats.empty() )
+         {
+            Error( line, "end without a repeat" );
+            return;
+         }
+         OpenRepeat repeat = repeats.back();
+         repeats.pop_back();
+         AddEntry( entry, 0 );
+         time = repeat.timeBefore + (time - repeat.timeBefore) * repeat.count;
+      }
+      else if ( statement == "profile" )
+      {
+         CompileProfile( words, entry );
+      }
+      else if ( statement == "at" )
+      {
+         uint32_t expected;
+         if ( !repeats.empty() )
+         {
+            Error( line, "at can't be used in a repeat" );
+         }
+         else if ( NeedsWords( words, 2, line ) && ParseBeats( words[1], line, expected ) && expected != time )
+         {
+            Error( line, std::string( axisNames[axis] ) + " is at " + std::to_string( time ) + " ms, not " +
+                   std::to_string( expected ) + " ms" );
+         }
+      }
+      else
+      {
+         Error( line, "'" + statement + "' isn't a statement" );
+      }
+   }
+
+   void CompileProfile( const std::vector<std::string>& words, DanceEntry& entry )
+   {
+      int line = entry.line;
+      entry.kind = DanceEntry::Profile;
+
+      const std::string type = words.size() > 1 ? words[1] : "";
+      long acceleration = 0;
+      long jerk = 0;
+
+      if ( type == "constant" && NeedsWords( words, 2, line ) )
+      {
+         entry.profile = MotionProfile::Constant;
+      }
+      else if ( type == "trapezoid" && NeedsWords( words, 3, line ) )
+      {
+         entry.profile = MotionProfile::Trapezoid;
+         ParseInteger( words[2], acceleration );
+      }
+      else if ( type == "scurve" && NeedsWords( words, 4, line ) )
+      {
+         entry.profile = MotionProfile::SCurve;
+         ParseInteger( words[2], acceleration );
+         if ( !ParseInteger( words[3], jerk ) || (jerk != 0 && (jerk < DANCE_JERK_UNIT || jerk / DANCE_JERK_UNIT > 0xFF)) )
+         {
+            Error( line, "jerk has to be 0 or from " + std::to_string( DANCE_JERK_UNIT ) + " to " +
+                   std::to_string( DANCE_JERK_UNIT * 0xFF ) );
+            return;
+         }
+      }
+      else
+      {
+         if ( type != "constant" && type != "trapezoid" && type != "scurve" )
+         {
+            Error( line, "profile has to be constant, trapezoid <acceleration> or scurve <acceleration> <jerk>" );
+         }
+         return;
+      }
+
+      if ( entry.profile != MotionProfile::Constant && (acceleration < DANCE_ACCEL_UNIT || acceleration / DANCE_ACCEL_UNIT > 0xFF) )
+      {
+         Error( line, "acceleration has to be from " + std::to_string( DANCE_ACCEL_UNIT ) + " to " +
+                std::to_string( DANCE_ACCEL_UNIT * 0xFF ) );
+         return;
+      }
+
+      entry.acceleration = acceleration;
+      entry.jerk = jerk;
+      AddEntry( entry, 0 );
+   }
+
+   void FinishAxis( int line )
+   {
+      if ( axis < 0 )
+      {
+         return;
+      }
+      if ( !repeats.empty() )
+      {
+         Error( line, std::string( axisNames[axis] ) + " has a repeat that isn't ended" );
+         repeats.clear();
+      }
+      routine->axisLength[axis] = time;
+      MergeWaits( routine->axes[axis] );
+      if ( axis == DanceAxisPitch )
+      {
+         PlanPitch();
+      }
+      axis = -1;
+   }
+
+   // Stores waits that follow each other as one wait where it fits, which plays the same. Ramped moves can
+   // ramp down during a wait and a wait ends the ramp, so axes with a profile other than Constant are left as
+   // they are.
+   static void MergeWaits( std::vector<DanceEntry>& entries )
+   {
+      for ( const DanceEntry& entry : entries )
+      {
+         if ( entry.kind == DanceEntry::Profile && entry.profile != MotionProfile::Constant )
+         {
+            return;
+         }
+      }
+
+      for ( size_t i = 1; i < entries.size(); i++ )
+      {
+         DanceEntry& wait = entries[i - 1];
+         if ( wait.kind == DanceEntry::Wait && entries[i].kind == DanceEntry::Wait &&
+              (uint32_t)wait.duration + entries[i].duration <= DANCE_MAX_DURATION )
+         {
+            wait.duration += entries[i].duration;
+            entries.erase( entries.begin() + i-- );
+         }
+      }
+   }
+
+   void FinishRoutine( int line )
+   {
+      if ( routine == nullptr )
+      {
+         return;
+      }
+
+      FinishAxis( line );
+
+      uint32_t longest = 0;
+      for ( uint8_t i = 0; i < DanceAxisCount; i++ )
+      {
+         longest = max( longest, routine->axisLength[i] );
+      }
+      if ( length > 0 && longest != length )
+      {
+         Error( lengthLine, "the longest axis takes " + std::to_string( longest ) + " ms, not " + std::to_string( length ) + " ms" );
+      }
+
+      routine = nullptr;
+   }
+
+   // Walks the pitch moves the way they are played, with repeats expanded, to check their speeds and work
+   // out the ones that can be stored. A move's start angle is only known after a Constant move, which
+   // ServoAngleController always ends exactly on its target unless it is too fast (which is an error here).
+   void PlanPitch()
+   {
+      std::vector<DanceEntry>& entries = routine->axes[DanceAxisPitch];
+      std::vector<int> starts( entries.size(), 0 ); // Angle every move started from, -1 if it wasn't always the same
+      std::vector<bool> played( entries.size(), false );
+      int angle = -1;
+      MotionProfile profile = MotionProfile::Constant;
+
+      WalkPitch( entries, 0, entries.size(), angle, profile, starts, played );
+
+      for ( size_t i = 0; i < entries.size(); i++ )
+      {
+         DanceEntry& entry = entries[i];
+         if ( entry.kind == DanceEntry::Move && played[i] && starts[i] >= 0 )
+         {
+            entry.hasSpeed = true;
+            entry.speed = (((int32_t)entry.value - starts[i]) << 16) / (int32_t)entry.duration;
+         }
+      }
+   }
+
+   // Plays entries from begin to end (which ends any repeat that starts in it)
+   void WalkPitch( const std::vector<DanceEntry>& entries, size_t begin, size_t end, int& angle, MotionProfile& profile,
+                   std::vector<int>& starts, std::vector<bool>& played )
+   {
+      for ( size_t i = begin; i < end; i++ )
+      {
+         const DanceEntry& entry = entries[i];
+         switch ( entry.kind )
+         {
+            case DanceEntry::Profile:
+               profile = entry.profile;
+               break;
+            case DanceEntry::Repeat:
+            {
+               size_t phraseEnd = PhraseEnd( entries, i + 1 );
+               for ( int count = 0; count < entry.value; count++ )
+               {
+                  WalkPitch( entries, i + 1, phraseEnd, angle, profile, starts, played );
+               }
+               i = phraseEnd;
+               break;
+            }
+            case DanceEntry::Move:
+            {
+               int start = profile == MotionProfile::Constant ? angle : -1;
+               if ( start >= 0 && (uint32_t)abs( entry.value - start ) * 1000 > (uint32_t)PITCH_MAX_SPEED * entry.duration )
+               {
+                  Error( entry.line, "moving from " + std::to_string( start ) + " to " + std::to_string( entry.value ) + " in " +
+                         std::to_string( entry.duration ) + " ms is faster than " + std::to_string( PITCH_MAX_SPEED ) + " degrees/sec" );
+               }
+
+               starts[i] = !played[i] || starts[i] == start ? start : -1;
+               played[i] = true;
+               angle = profile == MotionProfile::Constant ? entry.value : -1;
+               break;
+            }
+            default:
+               break;
+         }
+      }
+   }
+
+   // Index of the EndRepeat that ends the phrase starting at index
+   static size_t PhraseEnd( const std::vector<DanceEntry>& entries, size_t index )
+   {
+      int depth = 0;
+      for ( ; index < entries.size(); index++ )
+      {
+         if ( entries[index].kind == DanceEntry::Repeat )
+         {
+            depth++;
+         }
+         else if ( entries[index].kind == DanceEntry::EndRepeat && depth-- == 0 )
+         {
+            return index;
+         }
+      }
+      return entries.size();
+   }
+
+   static std::string EntryText( const DanceEntry& entry )
+   {
+      switch ( entry.kind )
+      {
+         case DanceEntry::Wait:
+            return "DANCE_WAIT( " + std::to_string( entry.duration ) + " )";
+         case DanceEntry::Move:
+            return (entry.hasSpeed ? "DANCE_SPEED( " + std::to_string( entry.speed ) + " ), " : std::string()) +
+               "DANCE_MOVE( " + std::to_string( entry.duration ) + ", " + std::to_string( entry.value ) + " )";
+         case DanceEntry::Repeat:
+            return "DANCE_REPEAT( " + std::to_string( entry.value ) + " )";
+         case DanceEntry::EndRepeat:
+            return "DANCE_END_REPEAT";
+         case DanceEntry::Profile:
+            return std::string( "DANCE_PROFILE( MotionProfile::" ) +
+               (entry.profile == MotionProfile::Constant ? "Constant" : entry.profile == MotionProfile::Trapezoid ? "Trapezoid" : "SCurve") +
+               ", " + std::to_string( entry.acceleration ) + ", " + std::to_string( entry.jerk ) + " )";
+      }
+      return "";
+   }
+};
+
+constexpr const char* DanceCompiler::axisNames[DanceAxisCount];
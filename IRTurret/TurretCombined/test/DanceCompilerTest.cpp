@@ -0,0 +1,247 @@
+#include "DanceCompiler.h"
+#include "DanceRoutines.h"
+#include "ServoController.h"
+#include "TurretHardware.h"
+#include "TestCheck.h"
+
+// Checks the routine compiler (DanceCompiler.h): the choreographies in test/routines/ (given on the command
+// line) compile to the tables in DanceRoutines.h, mistakes in a choreography are reported, and the pitch speeds
+// it works out play exactly like the ones ServoAngleController works out for itself.
+
+typedef std::vector<uint8_t> Bytes;
+
+#define MIN_TICK_TIME 10 // TurretDance delays 10ms every Loop()
+#define MAX_TICK_TIME 25
+
+static Bytes TableBytes( const uint8_t* table, size_t size )
+{
+   return Bytes( table, table + size );
+}
+
+static bool CompileText( DanceCompiler& compiler, const std::string& text )
+{
+   return compiler.Compile( text, "test.dance" );
+}
+
+static Bytes CompileAxis( const std::string& text, DanceAxis axis )
+{
+   DanceCompiler compiler;
+   CHECK( CompileText( compiler, text ) );
+   printf( "%s", compiler.Errors().c_str() );
+   return compiler.Routines().empty() ? Bytes() : DanceCompiler::Bytes( compiler.Routines()[0].axes[axis] );
+}
+
+static void TestRoutinesMatchHeader( const std::vector<std::string>& paths )
+{
+   DanceCompiler compiler;
+   for ( const std::string& path : paths )
+   {
+      CHECK( compiler.CompileFile( path ) );
+   }
+   printf( "%s", compiler.Errors().c_str() );
+
+   struct Table
+   {
+      const char* routine;
+      DanceAxis axis;
+      Bytes bytes;
+   };
+
+   const Table tables[] =
+   {
+      { "DanceRoutine1", DanceAxisRoll, TableBytes( DANCE_MOVES( DanceRoutine1::rollMoves ) ) },
+      { "DanceRoutine1", DanceAxisYaw, TableBytes( DANCE_MOVES( DanceRoutine1::yawMoves ) ) },
+      { "DanceRoutine1", DanceAxisPitch, TableBytes( DANCE_MOVES( DanceRoutine1::pitchMoves ) ) },
+      { "DanceRoutine2", DanceAxisPitch, TableBytes( DANCE_MOVES( DanceRoutine2::pitchMoves ) ) },
+      { "DanceRoutine4", DanceAxisYaw, TableBytes( DANCE_MOVES( DanceRoutine4::yawMoves ) ) },
+      { "DanceRoutine4", DanceAxisPitch, TableBytes( DANCE_MOVES( DanceRoutine4::pitchMoves ) ) },
+   };
+
+   int matched = 0;
+   for ( const DanceCompiledRoutine& routine : compiler.Routines() )
+   {
+      for ( const Table& table : tables )
+      {
+         if ( routine.name == table.routine )
+         {
+            CHECK( DanceCompiler::Bytes( routine.axes[table.axis] ) == table.bytes );
+            matched++;
+         }
+      }
+   }
+   CHECK_EQUAL( 6, matched );
+}
+
+static void TestBeatsAndConsts()
+{
+   CHECK( CompileAxis( "routine A\n"
+                       "tempo 120\n"
+                       "const speed 40\n"
+                       "roll\n"
+                       "wait 0.5   # half a beat\n"
+                       "repeat 2\n"
+                       "   move 1.5 speed\n"
+                       "   move 0.2 -speed\n"
+                       "end\n", DanceAxisRoll ) ==
+          Bytes( { DANCE_WAIT( 250 ), DANCE_REPEAT( 2 ), DANCE_MOVE( 750, 40 ), DANCE_MOVE( 100, -40 ), DANCE_END_REPEAT } ) );
+
+   CHECK( CompileAxis( "routine A\n"
+                       "tempo 60\n"
+                       "yaw\n"
+                       "profile scurve 3000 30000\n"
+                       "move 1 50\n"
+                       "profile constant\n", DanceAxisYaw ) ==
+          Bytes( { DANCE_PROFILE( MotionProfile::SCurve, 3000, 30000 ), DANCE_MOVE( 1000, 50 ), DANCE_PROFILE( MotionProfile::Constant, 0, 0 ) } ) );
+}
+
+static void TestWaitsAreMerged()
+{
+   CHECK( CompileAxis( "routine A\ntempo 600\nroll\nwait 40\nwait 4\nat 44\nwait 1\nrepeat 2\nwait 1\nend\nwait 650\nwait 1\n", DanceAxisRoll ) ==
+          Bytes( { DANCE_WAIT( 4500 ), DANCE_REPEAT( 2 ), DANCE_WAIT( 100 ), DANCE_END_REPEAT, DANCE_WAIT( 65000 ), DANCE_WAIT( 100 ) } ) );
+
+   // A ramped move ramps down differently over one long wait than over two short ones
+   CHECK( CompileAxis( "routine A\ntempo 600\nyaw\nprofile trapezoid 4000\nmove 1 50\nwait 1\nwait 1\n", DanceAxisYaw ) ==
+          Bytes( { DANCE_PROFILE( MotionProfile::Trapezoid, 4000, 0 ), DANCE_MOVE( 100, 50 ), DANCE_WAIT( 100 ), DANCE_WAIT( 100 ) } ) );
+}
+
+static void TestPlannedSpeeds()
+{
+   // Nothing is known about where the pitch servo starts, after that every move starts from the last target
+   CHECK( CompileAxis( "routine A\ntempo 600\npitch\nmove 1 100\nwait 1\nmove 2 120\nmove 3 80\n", DanceAxisPitch ) ==
+          Bytes( { DANCE_MOVE( 100, 100 ), DANCE_WAIT( 100 ), DANCE_SPEED( (20 << 16) / 200 ), DANCE_MOVE( 200, 120 ),
+                   DANCE_SPEED( -(40 << 16) / 300 ), DANCE_MOVE( 300, 80 ) } ) );
+
+   // Ramped moves don't use a constant speed, and don't end in the same place every time
+   CHECK( CompileAxis( "routine A\ntempo 600\npitch\nmove 1 100\nprofile trapezoid 2000\nmove 2 120\nprofile constant\nmove 3 80\n", DanceAxisPitch ) ==
+          Bytes( { DANCE_MOVE( 100, 100 ), DANCE_PROFILE( MotionProfile::Trapezoid, 2000, 0 ), DANCE_MOVE( 200, 120 ),
+                   DANCE_PROFILE( MotionProfile::Constant, 0, 0 ), DANCE_MOVE( 300, 80 ) } ) );
+
+   // The first move of the repeat starts from 100 the first time and 110 after that
+   CHECK( CompileAxis( "routine A\ntempo 600\npitch\nmove 1 100\nrepeat 2\nmove 1 120\nmove 1 110\nend\n", DanceAxisPitch ) ==
+          Bytes( { DANCE_MOVE( 100, 100 ), DANCE_REPEAT( 2 ), DANCE_MOVE( 100, 120 ), DANCE_SPEED( -(10 << 16) / 100 ), DANCE_MOVE( 100, 110 ),
+                   DANCE_END_REPEAT } ) );
+
+   // Roll and yaw moves are speeds already
+   CHECK( CompileAxis( "routine A\ntempo 600\nroll\nmove 1 50\nmove 1 -50\n", DanceAxisRoll ) ==
+          Bytes( { DANCE_MOVE( 100, 50 ), DANCE_MOVE( 100, -50 ) } ) );
+}
+
+static void TestErrors()
+{
+   struct Mistake
+   {
+      const char* text;
+      const char* error;
+   };
+
+   const Mistake mistakes[] =
+   {
+      { "routine A\nroll\nwait 1\n", "test.dance:3: durations need a tempo first" },
+      { "routine A\ntempo 7\nroll\nwait 1\n", "test.dance:4: 1 beats at 7 bpm isn't a whole number of 10 ms steps" },
+      { "routine A\ntempo 600\nroll\nwait 651\n", "a wait or move has to take from 10 to 65000 ms, not 65100" },
+      { "routine A\ntempo 600\nroll\nwait 0\n", "a wait or move has to take from 10 to 65000 ms, not 0" },
+      { "routine A\ntempo 600\nroll\nmove 1 101\n", "test.dance:4: speed 101 is outside -100 to 100" },
+      { "routine A\ntempo 600\nconst low 34\npitch\nmove 1 low\n", "test.dance:5: pitch angle 34 is outside 35 to 170" },
+      { "routine A\ntempo 600\npitch\nmove 1 171\n", "pitch angle 171 is outside 35 to 170" },
+      { "routine A\ntempo 600\npitch\nmove 1 80\nmove 1 111\n", "test.dance:5: moving from 80 to 111 in 100 ms is faster than 300 degrees/sec" },
+      { "routine A\ntempo 600\npitch\nrepeat 2\nmove 1 80\nmove 3 140\nend\n", "test.dance:5: moving from 140 to 80 in 100 ms is faster than 300 degrees/sec" },
+      { "routine A\ntempo 600\npitch\nmove 1 height\n", "test.dance:4: 'height' isn't a number or a const" },
+      { "routine A\ntempo 600\nlength 5\nroll\nwait 4\nyaw\nwait 3\n", "test.dance:3: the longest axis takes 400 ms, not 500 ms" },
+      { "routine A\ntempo 600\nroll\nwait 4\nrepeat 2\nwait 1\nend\nat 5\n", "test.dance:8: roll is at 600 ms, not 500 ms" },
+      { "routine A\ntempo 600\nroll\nrepeat 2\nat 1\nend\n", "test.dance:5: at can't be used in a repeat" },
+      { "routine A\ntempo 600\nroll\nrepeat 2\nwait 1\n", "roll has a repeat that isn't ended" },
+      { "routine A\ntempo 600\nroll\nend\n", "test.dance:4: end without a repeat" },
+      { "routine A\ntempo 600\nroll\nrepeat 64\n", "test.dance:4: repeat count has to be from 1 to 63" },
+      { "routine A\ntempo 600\nroll\nrepeat 2\nrepeat 2\nrepeat 2\nrepeat 2\n", "test.dance:7: repeats can only be nested 3 deep" },
+      { "routine A\ntempo 600\nroll\nprofile trapezoid 20\n", "test.dance:4: acceleration has to be from 50 to 12750" },
+      { "routine A\ntempo 600\nroll\nprofile bouncy\n", "test.dance:4: profile has to be constant" },
+      { "routine A\ntempo 600\nroll\nwait 1\nroll\n", "test.dance:5: roll has already been given" },
+      { "routine A\ntempo 600\nwait 1\n", "test.dance:3: 'wait' has to come after roll, yaw or pitch" },
+      { "tempo 600\nroll\n", "test.dance:2: 'roll' has to come after routine" },
+      { "routine 1A\n", "test.dance:1: '1A' isn't a name" },
+      { "routine A\ntempo 600\nroll\nwiggle 1\n", "test.dance:4: 'wiggle' isn't a statement" },
+      { "routine A\ntempo 600\nroll\nmove 1\n", "test.dance:4: 'move' takes 2 value(s)" },
+   };
+
+   for ( const Mistake& mistake : mistakes )
+   {
+      DanceCompiler compiler;
+      bool compiled = CompileText( compiler, mistake.text );
+      bool reported = compiler.Errors().find( mistake.error ) != std::string::npos;
+      CHECK( !compiled );
+      CHECK( reported );
+      if ( compiled || !reported )
+      {
+         printf( "expected \"%s\", got:\n%s", mistake.error, compiler.Errors().c_str() );
+      }
+   }
+}
+
+// Pitch servo angle after every tick of playing moves, with ticks that arrive at uneven times like they do
+// when the program is busy
+static Bytes PlayPitch( const Bytes& moves, uint8_t startAngle )
+{
+   Host::Reset();
+   TurretServo pitch;
+   pitch.Attach( PITCH_SERVO_PIN, startAngle );
+   ServoAngleController pitchServo( pitch, PITCH_MIN_ANGLE, PITCH_MAX_ANGLE, PITCH_MAX_SPEED );
+   pitchServo.SetDanceMoves( moves.data(), moves.size() );
+
+   Bytes angles;
+   unsigned long routineTime = 0;
+   randomSeed( 3 );
+   while ( !pitchServo.Update( routineTime ) && routineTime < 600000 )
+   {
+      angles.push_back( pitch.Position() );
+      routineTime += random( MIN_TICK_TIME, MAX_TICK_TIME + 1 );
+   }
+   return angles;
+}
+
+static void TestPlannedSpeedsPlayTheSame( const std::vector<std::string>& paths )
+{
+   DanceCompiler compiler;
+   for ( const std::string& path : paths )
+   {
+      CHECK( compiler.CompileFile( path ) );
+   }
+
+   int planned = 0;
+   for ( const DanceCompiledRoutine& routine : compiler.Routines() )
+   {
+      std::vector<DanceEntry> entries = routine.axes[DanceAxisPitch];
+      std::vector<DanceEntry> unplanned = entries;
+      std::vector<DanceEntry> wrong = entries;
+      for ( size_t i = 0; i < entries.size(); i++ )
+      {
+         planned += entries[i].hasSpeed;
+         unplanned[i].hasSpeed = false;
+         wrong[i].speed += 7;
+      }
+
+      // Wherever the pitch servo starts, and with speeds that are off (which are worked out again instead)
+      for ( uint8_t startAngle : { (uint8_t)PITCH_HOME_ANGLE, (uint8_t)PITCH_MIN_ANGLE, (uint8_t)PITCH_MAX_ANGLE } )
+      {
+         Bytes expected = PlayPitch( DanceCompiler::Bytes( unplanned ), startAngle );
+         CHECK( expected.size() > 0 );
+         CHECK( PlayPitch( DanceCompiler::Bytes( entries ), startAngle ) == expected );
+         CHECK( PlayPitch( DanceCompiler::Bytes( wrong ), startAngle ) == expected );
+      }
+   }
+   CHECK( planned > 0 );
+}
+
+int main( int argc, char** argv )
+{
+   std::vector<std::string> paths( argv + 1, argv + argc );
+   CHECK( !paths.empty() );
+
+   TestRoutinesMatchHeader( paths );
+   TestBeatsAndConsts();
+   TestWaitsAreMerged();
+   TestPlannedSpeeds();
+   TestErrors();
+   TestPlannedSpeedsPlayTheSame( paths );
+
+   return TestResult();
+}
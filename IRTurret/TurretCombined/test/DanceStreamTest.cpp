@@ -0,0 +1,348 @@
+#include "HostSketch.h"
+#include "TestCheck.h"
+#include <poll.h>
+#include <signal.h>
+#include <vector>
+
+// Plays the host's side of the dance stream protocol (see DanceStream.h). Most tests feed frames into the
+// Serial buffers on the virtual clock, so they always play out the same way. TestStreamOverPipe runs the
+// sketch in a child process with Serial connected to pipes and streams a routine that doesn't fit in the
+// buffers to it, like a program on a PC would over USB.
+
+typedef std::vector<uint8_t> Bytes;
+
+struct Reply
+{
+   uint8_t type = 0; // 0 if no reply came
+   uint8_t sequence = 0;
+   uint8_t free[DanceAxisCount] = {};
+   uint8_t starved = 0;
+};
+
+static std::string Frame( uint8_t type, uint8_t sequence, const Bytes& payload = Bytes() )
+{
+   std::string frame;
+   frame += (char)DANCE_STREAM_SYNC1;
+   frame += (char)DANCE_STREAM_SYNC2;
+   frame += (char)(DANCE_STREAM_HEADER_SIZE + payload.size() + 2);
+   frame += (char)type;
+   frame += (char)sequence;
+   frame.append( payload.begin(), payload.end() );
+
+   uint16_t crc = 0xFFFF;
+   for ( size_t i = 2; i < frame.size(); i++ )
+   {
+      crc = Crc16( crc, frame[i] );
+   }
+   frame += (char)(crc & 0xFF);
+   frame += (char)(crc >> 8);
+   return frame;
+}
+
+static std::string MovesFrame( uint8_t sequence, DanceAxis axis, const Bytes& moves )
+{
+   Bytes payload( 1, axis );
+   payload.insert( payload.end(), moves.begin(), moves.end() );
+   return Frame( DANCE_STREAM_MOVES, sequence, payload );
+}
+
+static std::string EndFrame( uint8_t sequence, DanceAxis axis )
+{
+   return Frame( DANCE_STREAM_END, sequence, Bytes( 1, axis ) );
+}
+
+// Takes the first reply with a good CRC out of bytes, along with anything before it
+static bool TakeReply( std::string& bytes, Reply& reply )
+{
+   for ( size_t start = 0; start + DANCE_STREAM_REPLY_SIZE <= bytes.size(); start++ )
+   {
+      const uint8_t* frame = (const uint8_t*)bytes.data() + start;
+      if ( frame[0] != DANCE_STREAM_SYNC1 || frame[1] != DANCE_STREAM_SYNC2 || frame[2] != DANCE_STREAM_REPLY_SIZE )
+      {
+         continue;
+      }
+
+      uint16_t crc = 0xFFFF;
+      for ( size_t i = 2; i < DANCE_STREAM_REPLY_SIZE - 2; i++ )
+      {
+         crc = Crc16( crc, frame[i] );
+      }
+      if ( (crc & 0xFF) != frame[DANCE_STREAM_REPLY_SIZE - 2] || (crc >> 8) != frame[DANCE_STREAM_REPLY_SIZE - 1] )
+      {
+         continue;
+      }
+
+      reply.type = frame[3];
+      reply.sequence = frame[4];
+      for ( uint8_t i = 0; i < DanceAxisCount; i++ )
+      {
+         reply.free[i] = frame[5 + i];
+      }
+      reply.starved = frame[5 + DanceAxisCount];
+      bytes.erase( 0, start + DANCE_STREAM_REPLY_SIZE );
+      return true;
+   }
+   return false;
+}
+
+// Sends a frame through the Serial buffers and runs the sketch for a loop to get the reply
+static Reply Send( const std::string& frame )
+{
+   Host::SerialInput( frame );
+   RunUntil( millis() + 1 );
+
+   Reply reply;
+   std::string output = Host::TakeSerialOutput();
+   CHECK( TakeReply( output, reply ) );
+   return reply;
+}
+
+static void StartDance()
+{
+   Host::Reset();
+   setup();
+   Host::PressButton( 100, cmd0 );
+   Host::PressButton( 300, cmd3 );
+   RunUntil( 500 );
+}
+
+static void TestFramesAreChecked()
+{
+   StartDance();
+
+   Reply reply = Send( Frame( DANCE_STREAM_RESET, 1 ) );
+   CHECK_EQUAL( DANCE_STREAM_ACK, reply.type );
+   CHECK_EQUAL( 1, reply.sequence );
+   CHECK_EQUAL( DANCE_STREAM_BUFFER_SIZE, reply.free[DanceAxisRoll] );
+
+   // A byte changed on the way
+   std::string frame = MovesFrame( 2, DanceAxisRoll, { DANCE_MOVE( 500, 50 ) } );
+   frame[6] ^= 0x01;
+   reply = Send( frame );
+   CHECK_EQUAL( DANCE_STREAM_NAK, reply.type );
+   CHECK_EQUAL( 2, reply.sequence );
+   CHECK_EQUAL( DANCE_STREAM_BUFFER_SIZE, reply.free[DanceAxisRoll] );
+
+   CHECK_EQUAL( DANCE_STREAM_NAK, Send( Frame( 0x7F, 3 ) ).type );
+
+   // Sending a frame again when its reply was lost doesn't add the moves twice
+   reply = Send( MovesFrame( 4, DanceAxisRoll, { DANCE_MOVE( 500, 50 ) } ) );
+   CHECK_EQUAL( DANCE_STREAM_ACK, reply.type );
+   CHECK_EQUAL( DANCE_STREAM_BUFFER_SIZE - 3, reply.free[DanceAxisRoll] );
+   reply = Send( MovesFrame( 4, DanceAxisRoll, { DANCE_MOVE( 500, 50 ) } ) );
+   CHECK_EQUAL( DANCE_STREAM_ACK, reply.type );
+   CHECK_EQUAL( DANCE_STREAM_BUFFER_SIZE - 3, reply.free[DanceAxisRoll] );
+
+   // Moves that don't fit are refused
+   Bytes moves;
+   for ( int i = 0; i < 13; i++ )
+   {
+      moves.insert( moves.end(), { DANCE_MOVE( 100, 50 ) } );
+   }
+   CHECK_EQUAL( DANCE_STREAM_ACK, Send( MovesFrame( 5, DanceAxisYaw, moves ) ).type );
+   reply = Send( MovesFrame( 6, DanceAxisYaw, moves ) );
+   CHECK_EQUAL( DANCE_STREAM_NAK, reply.type );
+   CHECK_EQUAL( DANCE_STREAM_BUFFER_SIZE - 39, reply.free[DanceAxisYaw] );
+}
+
+static void TestResetRefusedWhilePlaying()
+{
+   StartDance();
+
+   CHECK_EQUAL( DANCE_STREAM_ACK, Send( Frame( DANCE_STREAM_RESET, 1 ) ).type );
+   CHECK_EQUAL( DANCE_STREAM_ACK, Send( MovesFrame( 2, DanceAxisRoll, { DANCE_MOVE( 2000, 50 ), DANCE_MOVE( 2000, -50 ) } ) ).type );
+   CHECK_EQUAL( DANCE_STREAM_ACK, Send( EndFrame( 3, DanceAxisRoll ) ).type );
+   CHECK_EQUAL( DANCE_STREAM_ACK, Send( EndFrame( 4, DanceAxisYaw ) ).type );
+   CHECK_EQUAL( DANCE_STREAM_ACK, Send( EndFrame( 5, DanceAxisPitch ) ).type );
+   CHECK_EQUAL( DANCE_STREAM_ACK, Send( Frame( DANCE_STREAM_PLAY, 6 ) ).type );
+   RunUntil( millis() + 1000 );
+   CHECK( !CanShutdownProgram() );
+
+   // The roll controller is still reading the second move out of the buffer
+   Reply reply = Send( Frame( DANCE_STREAM_RESET, 7 ) );
+   CHECK_EQUAL( DANCE_STREAM_NAK, reply.type );
+   CHECK( reply.free[DanceAxisRoll] < DANCE_STREAM_BUFFER_SIZE );
+
+   unsigned long stopTime = millis() + 100;
+   Host::PressButton( stopTime, ok );
+   RunUntil( stopTime + 200 );
+   CHECK( CanShutdownProgram() );
+
+   reply = Send( Frame( DANCE_STREAM_RESET, 8 ) );
+   CHECK_EQUAL( DANCE_STREAM_ACK, reply.type );
+   CHECK_EQUAL( DANCE_STREAM_BUFFER_SIZE, reply.free[DanceAxisRoll] );
+}
+
+static void TestLookingAheadDoesntStarve()
+{
+   StartDance();
+
+   // A ramped move looks at the next move to see what speed to ramp to, which hasn't been sent yet
+   CHECK_EQUAL( DANCE_STREAM_ACK, Send( Frame( DANCE_STREAM_RESET, 1 ) ).type );
+   CHECK_EQUAL( DANCE_STREAM_ACK, Send( MovesFrame( 2, DanceAxisRoll, { DANCE_PROFILE( MotionProfile::Trapezoid, 4000, 0 ), DANCE_MOVE( 1000, 50 ) } ) ).type );
+   CHECK_EQUAL( DANCE_STREAM_ACK, Send( EndFrame( 3, DanceAxisYaw ) ).type );
+   CHECK_EQUAL( DANCE_STREAM_ACK, Send( EndFrame( 4, DanceAxisPitch ) ).type );
+   CHECK_EQUAL( DANCE_STREAM_ACK, Send( Frame( DANCE_STREAM_PLAY, 5 ) ).type );
+
+   // It only ran out once the move was over
+   RunUntil( millis() + 500 );
+   CHECK_EQUAL( 0, Send( Frame( DANCE_STREAM_STATUS, 6 ) ).starved );
+   RunUntil( millis() + 1000 );
+   CHECK_EQUAL( 1 << DanceAxisRoll, Send( Frame( DANCE_STREAM_STATUS, 7 ) ).starved );
+}
+
+// Serial of the sketch in a child process
+struct PipeTurret
+{
+   pid_t pid = 0;
+   int in;  // Bytes written here are read by the sketch
+   int out; // What the sketch writes to Serial
+   std::string received;
+};
+
+static bool StartPipeTurret( PipeTurret& turret )
+{
+   int toTurret[2], fromTurret[2];
+   if ( pipe( toTurret ) != 0 || pipe( fromTurret ) != 0 )
+   {
+      return false;
+   }
+
+   fflush( stdout );
+   turret.pid = fork();
+   if ( turret.pid == 0 )
+   {
+      close( toTurret[1] );
+      close( fromTurret[0] );
+      StartDance();
+      Host::AttachSerial( toTurret[0], fromTurret[1] );
+      while ( true )
+      {
+         loop();
+      }
+   }
+
+   close( toTurret[0] );
+   close( fromTurret[1] );
+   turret.in = toTurret[1];
+   turret.out = fromTurret[0];
+   return turret.pid > 0;
+}
+
+static void StopPipeTurret( PipeTurret& turret )
+{
+   kill( turret.pid, SIGKILL );
+   waitpid( turret.pid, nullptr, 0 );
+   close( turret.in );
+   close( turret.out );
+}
+
+// Sends a frame and waits up to a second of real time for its reply
+static Reply Send( PipeTurret& turret, const std::string& frame )
+{
+   Reply reply;
+   if ( write( turret.in, frame.data(), frame.size() ) != (ssize_t)frame.size() )
+   {
+      return reply;
+   }
+
+   pollfd readable = { turret.out, POLLIN, 0 };
+   while ( !TakeReply( turret.received, reply ) && poll( &readable, 1, 1000 ) > 0 )
+   {
+      char buffer[64];
+      ssize_t count = read( turret.out, buffer, sizeof( buffer ) );
+      if ( count <= 0 )
+      {
+         break;
+      }
+      turret.received.append( buffer, count );
+   }
+   return reply;
+}
+
+static void TestStreamOverPipe()
+{
+   PipeTurret turret;
+   if ( !StartPipeTurret( turret ) )
+   {
+      CHECK( !"the turret couldn't be started" );
+      return;
+   }
+
+   // 120 bytes of roll moves, so they have to be sent as the buffer frees up while the routine plays
+   Bytes moves;
+   for ( int i = 0; i < 20; i++ )
+   {
+      moves.insert( moves.end(), { DANCE_MOVE( 100, 50 ), DANCE_MOVE( 100, -50 ) } );
+   }
+
+   uint8_t sequence = 0;
+   CHECK_EQUAL( DANCE_STREAM_ACK, Send( turret, Frame( DANCE_STREAM_RESET, ++sequence ) ).type );
+   CHECK_EQUAL( DANCE_STREAM_ACK, Send( turret, EndFrame( ++sequence, DanceAxisYaw ) ).type );
+   CHECK_EQUAL( DANCE_STREAM_ACK, Send( turret, EndFrame( ++sequence, DanceAxisPitch ) ).type );
+
+   size_t sent = 0;
+   bool playing = false;
+   int frames = 0;
+   while ( sent < moves.size() && frames++ < 10000 )
+   {
+      Reply status = Send( turret, Frame( DANCE_STREAM_STATUS, ++sequence ) );
+      CHECK_EQUAL( DANCE_STREAM_ACK, status.type );
+      if ( status.type != DANCE_STREAM_ACK )
+      {
+         break;
+      }
+
+      // Whole moves only, as many as fit in the buffer and in a frame
+      size_t count = min( (size_t)status.free[DanceAxisRoll], (size_t)(DANCE_STREAM_MAX_FRAME - DANCE_STREAM_HEADER_SIZE - 3) );
+      count = min( count - count % 3, moves.size() - sent );
+      if ( count > 0 )
+      {
+         Bytes chunk( moves.begin() + sent, moves.begin() + sent + count );
+         CHECK_EQUAL( DANCE_STREAM_ACK, Send( turret, MovesFrame( ++sequence, DanceAxisRoll, chunk ) ).type );
+         sent += count;
+      }
+
+      if ( !playing )
+      {
+         CHECK_EQUAL( DANCE_STREAM_ACK, Send( turret, Frame( DANCE_STREAM_PLAY, ++sequence ) ).type );
+         playing = true;
+      }
+   }
+   CHECK_EQUAL( moves.size(), sent );
+   CHECK_EQUAL( DANCE_STREAM_ACK, Send( turret, EndFrame( ++sequence, DanceAxisRoll ) ).type );
+
+   // Reset is refused until the routine is done, then the buffers are empty again
+   Reply reply;
+   for ( frames = 0; frames < 10000; frames++ )
+   {
+      reply = Send( turret, Frame( DANCE_STREAM_RESET, ++sequence ) );
+      if ( reply.type != DANCE_STREAM_NAK )
+      {
+         break;
+      }
+   }
+   CHECK_EQUAL( DANCE_STREAM_ACK, reply.type );
+   CHECK_EQUAL( DANCE_STREAM_BUFFER_SIZE, reply.free[DanceAxisRoll] );
+
+   StopPipeTurret( turret );
+}
+
+static void Run( void ( *test )() )
+{
+   RunIsolated( [test]()
+   {
+      test();
+      return std::string();
+   } );
+}
+
+int main()
+{
+   Run( TestFramesAreChecked );
+   Run( TestResetRefusedWhilePlaying );
+   Run( TestLookingAheadDoesntStarve );
+   TestStreamOverPipe();
+
+   return TestResult();
+}
@@ -0,0 +1,134 @@
+#include <Arduino.h>
+#include "ServoController.h"
+#include "TestCheck.h"
+
+// Plays a 60 second routine on all three axes from one routine clock, with ticks that arrive at uneven times
+// like they do when the program is busy, and reports how far each axis was from its schedule.
+//
+// Every controller is given the same routineTime each tick and moves end at the total duration of the moves
+// before them, so a move end is noticed by the first tick at or after it on every axis and lateness doesn't
+// build up. Before, each axis restarted its clock from millis() when it noticed a move had ended, so every
+// move's lateness was added on to the ones after it. "clock restart drift" is what that would have added up to.
+
+#define ROUTINE_LENGTH 60000UL
+#define MIN_TICK_TIME 10 // TurretDance delays 10ms every Loop()
+#define MAX_TICK_TIME 25
+
+static constexpr uint8_t rollMoves[] PROGMEM =
+{
+   DANCE_REPEAT( 30 ),
+      DANCE_MOVE( 1000, 50 ),
+      DANCE_MOVE( 1000, -50 ),
+   DANCE_END_REPEAT,
+};
+
+static constexpr uint8_t yawMoves[] PROGMEM =
+{
+   DANCE_REPEAT( 60 ),
+      DANCE_MOVE( 300, 30 ),
+      DANCE_WAIT( 200 ),
+      DANCE_MOVE( 300, -30 ),
+      DANCE_WAIT( 200 ),
+   DANCE_END_REPEAT,
+};
+
+static constexpr uint8_t pitchMoves[] PROGMEM =
+{
+   DANCE_REPEAT( 20 ),
+      DANCE_MOVE( 1500, 110 ),
+      DANCE_MOVE( 1500, 80 ),
+   DANCE_END_REPEAT,
+};
+
+static_assert( DanceRoutineLength( DANCE_MOVES( rollMoves ) ) == ROUTINE_LENGTH, "" );
+static_assert( DanceRoutineLength( DANCE_MOVES( yawMoves ) ) == ROUTINE_LENGTH, "" );
+static_assert( DanceRoutineLength( DANCE_MOVES( pitchMoves ) ) == ROUTINE_LENGTH, "" );
+
+static void PrintAxis( const char* name, const DanceStats& stats, unsigned long doneTime )
+{
+   printf( "%-5s moves=%u avgDriftMs=%.1f maxDriftMs=%d doneAt=%lu clockRestartDriftMs=%ld\n", name, stats.moves,
+           stats.moves > 0 ? (double)stats.totalDrift / stats.moves : 0.0, stats.maxDrift, doneTime, (long)stats.totalDrift );
+}
+
+int main()
+{
+   Host::Reset();
+
+   TurretServo roll, yaw, pitch;
+   roll.Attach( ROLL_SERVO_PIN, ROLL_STOP_SPEED );
+   yaw.Attach( YAW_SERVO_PIN, YAW_STOP_SPEED );
+   pitch.Attach( PITCH_SERVO_PIN, PITCH_HOME_ANGLE );
+
+   ServoSpeedController rollServo( roll, ROLL_STOP_SPEED, ROLL_MIN_SPEED, ROLL_MAX_SPEED );
+   ServoSpeedController yawServo( yaw, YAW_STOP_SPEED, YAW_MIN_SPEED, YAW_MAX_SPEED );
+   ServoAngleController pitchServo( pitch, PITCH_MIN_ANGLE, PITCH_MAX_ANGLE, PITCH_MAX_SPEED );
+
+   DanceStats rollStats, yawStats, pitchStats;
+   rollStats.Reset();
+   yawStats.Reset();
+   pitchStats.Reset();
+   rollServo.stats = &rollStats;
+   yawServo.stats = &yawStats;
+   pitchServo.stats = &pitchStats;
+
+   rollServo.SetDanceMoves( DANCE_MOVES( rollMoves ) );
+   yawServo.SetDanceMoves( DANCE_MOVES( yawMoves ) );
+   pitchServo.SetDanceMoves( DANCE_MOVES( pitchMoves ) );
+
+   unsigned long rollDone = 0, yawDone = 0, pitchDone = 0;
+   unsigned long routineTime = 0;
+   unsigned long ticks = 0;
+
+   randomSeed( 8 );
+   while ( rollDone == 0 || yawDone == 0 || pitchDone == 0 )
+   {
+      routineTime += random( MIN_TICK_TIME, MAX_TICK_TIME + 1 );
+      ticks++;
+
+      // Same clock sample for every axis, like TurretDanceProgram::Loop()
+      if ( rollServo.Update( routineTime ) && rollDone == 0 )
+      {
+         rollDone = routineTime;
+      }
+      if ( yawServo.Update( routineTime ) && yawDone == 0 )
+      {
+         yawDone = routineTime;
+      }
+      if ( pitchServo.Update( routineTime ) && pitchDone == 0 )
+      {
+         pitchDone = routineTime;
+      }
+
+      CHECK( routineTime < 2 * ROUTINE_LENGTH );
+      if ( routineTime >= 2 * ROUTINE_LENGTH )
+      {
+         break;
+      }
+   }
+
+   printf( "%lu ticks of %d-%dms over a %lums routine\n", ticks, MIN_TICK_TIME, MAX_TICK_TIME, ROUTINE_LENGTH );
+   PrintAxis( "roll", rollStats, rollDone );
+   PrintAxis( "yaw", yawStats, yawDone );
+   PrintAxis( "pitch", pitchStats, pitchDone );
+
+   // Every move end is noticed less than a tick after it was scheduled, however long the routine has played
+   CHECK_EQUAL( 60, rollStats.moves );
+   CHECK_EQUAL( 240, yawStats.moves );
+   CHECK_EQUAL( 40, pitchStats.moves );
+   for ( const DanceStats* stats : { &rollStats, &yawStats, &pitchStats } )
+   {
+      CHECK( stats->maxDrift >= 0 );
+      CHECK( stats->maxDrift < MAX_TICK_TIME );
+   }
+
+   // All three axes finish on the same tick, the first one at or after the end of the routine
+   CHECK_EQUAL( rollDone, yawDone );
+   CHECK_EQUAL( rollDone, pitchDone );
+   CHECK( rollDone >= ROUTINE_LENGTH );
+   CHECK( rollDone < ROUTINE_LENGTH + MAX_TICK_TIME );
+
+   // The pitch servo got to the last target
+   CHECK_EQUAL( 80, pitch.Position() );
+
+   return TestResult();
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+// The whole sketch, for building on the host. The Arduino IDE generates prototypes for the functions in
+// TurretCombined.ino, so they are declared here before it is included.
+
+#include <Arduino.h>
+#include "ProgramRegistry.h"
+
+void setup();
+void loop();
+void SetupProgram();
+bool CanShutdownProgram();
+void ShutdownProgram();
+void ChangeProgram( ProgramType newProgramType );
+void ReadSerial();
+void ProgramLoop( uint16_t cmd, bool isRepeat );
+
+#include "../TurretCombined.ino"
+
+// Calls loop() until millis() reaches time. Each loop() takes at least the 5ms it delays for.
+inline void RunUntil( unsigned long time )
+{
+   while ( (long)(millis() - time) < 0 )
+   {
+      loop();
+   }
+}
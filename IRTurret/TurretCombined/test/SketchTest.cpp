@@ -0,0 +1,416 @@
+#include "HostSketch.h"
+#include "TestCheck.h"
+
+// Runs the whole sketch against the stand-in core: setup(), then loop() with IR presses and Serial input
+// delivered on the virtual clock like they would arrive on the board. Every test runs in a process of its
+// own (see RunIsolated()), so it starts from a freshly powered on turret.
+
+static void Start()
+{
+   Host::Reset();
+   setup();
+}
+
+// Time of the first write of value to pin at or after from, 0 if there isn't one
+static unsigned long FindWrite( uint8_t pin, uint8_t value, unsigned long from )
+{
+   for ( const Host::ServoWrite& write : Host::ServoWrites() )
+   {
+      if ( write.pin == pin && write.value == value && write.time >= from )
+      {
+         return write.time;
+      }
+   }
+   return 0;
+}
+
+static void TestSetupHomesServos()
+{
+   Start();
+
+   CHECK_EQUAL( YAW_STOP_SPEED, Host::ServoValue( YAW_SERVO_PIN ) );
+   CHECK_EQUAL( PITCH_HOME_ANGLE, Host::ServoValue( PITCH_SERVO_PIN ) );
+   CHECK_EQUAL( ROLL_STOP_SPEED, Host::ServoValue( ROLL_SERVO_PIN ) );
+   CHECK_EQUAL( TurretControl, currentProgramType );
+}
+
+static void TestOkFiresOneDart()
+{
+   Start();
+
+   Host::PressButton( 100, ok );
+   RunUntil( 2000 );
+
+   unsigned long spinTime = FindWrite( ROLL_SERVO_PIN, config.rollStopSpeed + config.rollMoveSpeed, 100 );
+   unsigned long stopTime = FindWrite( ROLL_SERVO_PIN, config.rollStopSpeed, spinTime );
+   CHECK( spinTime >= 168 && spinTime < 180 );
+   CHECK( stopTime > spinTime );
+   CHECK( stopTime - spinTime >= config.rollPrecision );
+   CHECK_EQUAL( BARREL_CHAMBERS - 1, turret.barrel.Loaded() );
+   CHECK( CanShutdownProgram() );
+}
+
+static void TestProgramSelection()
+{
+   Start();
+
+   Host::PressButton( 100, cmd0 );
+   Host::PressButton( 300, cmd2 );
+   RunUntil( 500 );
+   CHECK_EQUAL( TurretRoulette, currentProgramType );
+
+   Host::PressButton( 600, cmd0 );
+   Host::PressButton( 800, cmd3 );
+   RunUntil( 1000 );
+   CHECK_EQUAL( TurretDance, currentProgramType );
+
+   // Without cmd0 first a number button belongs to the program
+   Host::PressButton( 1100, cmd1 );
+   RunUntil( 1300 );
+   CHECK_EQUAL( TurretDance, currentProgramType );
+   CHECK( !CanShutdownProgram() );
+}
+
+static void TestDanceRoutinePlaysToTheEnd()
+{
+   Start();
+
+   Host::PressButton( 100, cmd0 );
+   Host::PressButton( 300, cmd3 );
+   Host::PressButton( 500, cmd1 );
+   RunUntil( 1000 );
+   CHECK( !CanShutdownProgram() );
+
+   unsigned long end = 1000;
+   while ( !CanShutdownProgram() && end < 120000 )
+   {
+      end += 100;
+      RunUntil( end );
+   }
+
+   CHECK( CanShutdownProgram() );
+   CHECK( Host::ServoWrites().size() > 100 );
+   CHECK_EQUAL( YAW_STOP_SPEED, Host::ServoValue( YAW_SERVO_PIN ) );
+   CHECK_EQUAL( ROLL_STOP_SPEED, Host::ServoValue( ROLL_SERVO_PIN ) );
+}
+
+static void TestHashtagAgainStartsOver()
+{
+   Start();
+
+   // Pressed again in the middle of the nodding, which would queue more yaw moves than fit
+   Host::PressButton( 100, hashtag );
+   Host::PressButton( 600, hashtag );
+   RunUntil( 1000 );
+   CHECK( !CanShutdownProgram() );
+
+   RunUntil( 10000 );
+   CHECK( CanShutdownProgram() );
+   CHECK_EQUAL( YAW_STOP_SPEED, Host::ServoValue( YAW_SERVO_PIN ) );
+   CHECK_EQUAL( PITCH_HOME_ANGLE, Host::ServoValue( PITCH_SERVO_PIN ) );
+}
+
+static void TestRouletteShootsAnywayAndStops()
+{
+   Start();
+
+   Host::PressButton( 100, cmd0 );
+   Host::PressButton( 300, cmd2 );
+   RunUntil( 500 );
+   CHECK_EQUAL( TurretRoulette, currentProgramType );
+
+   // Seed that makes it shake its head no and then shoot anyway
+   randomSeed( 21 );
+   Host::PressButton( 500, hashtag );
+   RunUntil( 500 + ROULETTE_SPIN_TIME + 5000 );
+
+   unsigned long turnBack = FindWrite( YAW_SERVO_PIN, YAW_STOP_SPEED - 60, 500 + ROULETTE_SPIN_TIME );
+   CHECK( turnBack > 0 );
+   CHECK( FindWrite( YAW_SERVO_PIN, YAW_STOP_SPEED, turnBack ) > turnBack );
+   CHECK_EQUAL( YAW_STOP_SPEED, Host::ServoValue( YAW_SERVO_PIN ) );
+   CHECK_EQUAL( 0, turret.barrel.Loaded() );
+   CHECK( CanShutdownProgram() );
+}
+
+static void TestYawNeverSteersIntoTheDeadBand()
+{
+   Start();
+
+   // Calibrated table that jumps straight from not turning to 200 degrees/sec
+   const uint16_t steep[ROTATION_TABLE_SIZE] = { 0, 0, 0, 200, 220, 240, 260, 280, 300, 320 };
+   RotationEstimator& heading = turret.yawHeading;
+   heading.SetTable( steep );
+   for ( int rate = 1; rate <= 400; rate++ )
+   {
+      CHECK( heading.DegreesPerSecond( heading.ServoValue( rate ) ) > 0 );
+      CHECK( heading.DegreesPerSecond( heading.ServoValue( -rate ) ) < 0 );
+   }
+
+   // Turning far enough takes longer than YAW_TURN_TIMEOUT, so it stops instead of turning forever
+   ServoYawPositionController controller( turret.yaw, heading, YAW_STOP_SPEED, YAW_MIN_SPEED, YAW_MAX_SPEED, YAW_TURN_SPEED );
+   controller.TurnTo( 100000 );
+   while ( !controller.Update( 0 ) && millis() < 2 * YAW_TURN_TIMEOUT )
+   {
+      delay( 10 );
+   }
+   CHECK( millis() >= YAW_TURN_TIMEOUT && millis() < YAW_TURN_TIMEOUT + 20 );
+   CHECK_EQUAL( YAW_STOP_SPEED, Host::ServoValue( YAW_SERVO_PIN ) );
+
+   // A table that never turns can't get anywhere, so it stops straight away
+   const uint16_t stuck[ROTATION_TABLE_SIZE] = {};
+   heading.SetTable( stuck );
+   controller.TurnTo( heading.Heading() + 90 );
+   CHECK( controller.Update( 0 ) );
+   CHECK_EQUAL( YAW_STOP_SPEED, Host::ServoValue( YAW_SERVO_PIN ) );
+}
+
+static void TestConfigConsole()
+{
+   Start();
+
+   Host::SerialInput( "pitchMax 160\n" );
+   RunUntil( 100 );
+   CHECK_EQUAL( 160, config.pitchMax );
+   CHECK( Host::TakeSerialOutput().find( "pitchMax=160" ) != std::string::npos );
+
+   Host::SerialInput( "nonsense 1\n" );
+   RunUntil( 200 );
+   CHECK( Host::TakeSerialOutput().find( "?" ) != std::string::npos );
+
+   // Values that don't fit are refused rather than cut down to something else
+   Host::SerialInput( "pitchMax 300\n" );
+   RunUntil( 300 );
+   CHECK( Host::TakeSerialOutput().find( "?" ) != std::string::npos );
+   Host::SerialInput( "pitchMax -1\n" );
+   RunUntil( 400 );
+   CHECK( Host::TakeSerialOutput().find( "?" ) != std::string::npos );
+   Host::SerialInput( "pitchMax 12x\n" );
+   RunUntil( 500 );
+   CHECK( Host::TakeSerialOutput().find( "?" ) != std::string::npos );
+   CHECK_EQUAL( 160, config.pitchMax );
+
+   // Values that fit but conflict with each other aren't saved
+   const char* conflicts[] = { "pitchMin 170\n", "pitchMinAngle 171\n", "rollMinSpeed 91\n", "yawMoveSpeed 91\n",
+                               "rollPin 10\n", "pitchPin 1\n", "burstSize 7\n" };
+   unsigned long time = 600;
+   for ( const char* conflict : conflicts )
+   {
+      config.Load();
+      config.pitchMax = 160;
+      Host::SerialInput( conflict );
+      Host::SerialInput( "save\n" );
+      RunUntil( time += 100 );
+      std::string output = Host::TakeSerialOutput();
+      CHECK( output.find( "?" ) != std::string::npos );
+      CHECK( output.find( "saved" ) == std::string::npos );
+   }
+
+   config.Load();
+   Host::SerialInput( "burstSize 6\nsave\n" );
+   RunUntil( time += 100 );
+   CHECK( Host::TakeSerialOutput().find( "saved" ) != std::string::npos );
+
+   // A config with conflicting values in EEPROM isn't loaded, the last good one is used instead
+   config.pitchMin = 170;
+   config.pitchMax = 160;
+   config.Save();
+   CHECK( config.Load() );
+   CHECK_EQUAL( 10, config.pitchMin );
+   CHECK_EQUAL( 175, config.pitchMax );
+}
+
+static void TestHoldingUpJogs()
+{
+   Start();
+
+   // A tap moves one step
+   Host::PressButton( 100, up );
+   RunUntil( 1000 );
+   CHECK_EQUAL( PITCH_HOME_ANGLE - config.pitchMoveSpeed, Host::ServoValue( PITCH_SERVO_PIN ) );
+
+   // Holding it keeps going, further than one step
+   Host::PressButton( 1000, up, 1000 );
+   RunUntil( 3000 );
+   int angle = Host::ServoValue( PITCH_SERVO_PIN );
+   CHECK( angle < PITCH_HOME_ANGLE - 2 * config.pitchMoveSpeed );
+   CHECK( angle >= config.pitchMin );
+   CHECK( CanShutdownProgram() );
+}
+
+// Checks the yaw servo only ever turned faster once a left press held from pressTime started jogging, starting
+// at JOG_YAW_START_SPEED and getting to JOG_YAW_MAX_SPEED, and stopped when it was let go
+static void CheckLeftJog( unsigned long pressTime )
+{
+   unsigned long jogStart = pressTime + 110; // first repeat frame
+   int first = 0;
+   int fastest = 0;
+   for ( const Host::ServoWrite& write : Host::ServoWrites() )
+   {
+      int speed = write.value - YAW_STOP_SPEED;
+      if ( write.pin != YAW_SERVO_PIN || write.time < jogStart || speed == 0 )
+      {
+         continue;
+      }
+      CHECK( speed >= fastest );
+      first = first == 0 ? speed : first;
+      fastest = max( fastest, speed );
+   }
+   CHECK( first >= JOG_YAW_START_SPEED && first < JOG_YAW_START_SPEED + 5 );
+   CHECK_EQUAL( JOG_YAW_MAX_SPEED, fastest );
+   CHECK_EQUAL( YAW_STOP_SPEED, Host::ServoValue( YAW_SERVO_PIN ) );
+}
+
+static void TestHoldingLeftSpeedsUp()
+{
+   Start();
+
+   // A tap turns at the step speed
+   Host::PressButton( 100, left );
+   RunUntil( 1000 );
+   CHECK( FindWrite( YAW_SERVO_PIN, YAW_STOP_SPEED + config.yawMoveSpeed, 100 ) > 0 );
+   CHECK_EQUAL( YAW_STOP_SPEED, Host::ServoValue( YAW_SERVO_PIN ) );
+
+   // Holding it for longer than JOG_RAMP_TIME speeds up all the way
+   Host::PressButton( 1000, left, JOG_RAMP_TIME + 500 );
+   RunUntil( 4000 );
+   CheckLeftJog( 1000 );
+}
+
+static void TestOkOnlyDropsAimInTurretControl()
+{
+   Start();
+
+   // Two taps of up and ok arrive while the main loop is busy, so all three are queued together
+   Host::ScheduleIr( 1000, up, false );
+   Host::ScheduleIr( 1000, up, false );
+   Host::ScheduleIr( 1000, ok, false );
+   RunUntil( 1500 );
+   CHECK_EQUAL( 2, irCommands.PreemptedCount() );
+   CHECK_EQUAL( PITCH_HOME_ANGLE, Host::ServoValue( PITCH_SERVO_PIN ) );
+
+   // In TurretRoulette ok stops the game, so the taps before it are still played
+   Host::PressButton( 2000, cmd0 );
+   Host::PressButton( 2200, cmd2 );
+   RunUntil( 3000 );
+   CHECK_EQUAL( TurretRoulette, currentProgramType );
+   Host::ScheduleIr( 3000, up, false );
+   Host::ScheduleIr( 3000, up, false );
+   Host::ScheduleIr( 3000, ok, false );
+   RunUntil( 4000 );
+   CHECK_EQUAL( 2, irCommands.PreemptedCount() );
+   CHECK_EQUAL( PITCH_HOME_ANGLE - 2 * config.pitchMoveSpeed, Host::ServoValue( PITCH_SERVO_PIN ) );
+}
+
+static void TestBurstKeepsAiming()
+{
+   Start();
+
+   // Half a second between shots, picked up when TurretControl starts again
+   Host::SerialInput( "burstInterval 500\n" );
+   Host::PressButton( 100, cmd0 );
+   Host::PressButton( 300, cmd1 );
+   RunUntil( 1000 );
+
+   // Shots at 1068, 1568 and on. The second tap of left waits for the first one's move to finish, and a
+   // shot of the burst goes off while it is waiting.
+   Host::PressButton( 1000, star );
+   Host::PressButton( 1400, left );
+   Host::PressButton( 1450, left );
+   RunUntil( 2500 );
+
+   unsigned long firstMove = FindWrite( YAW_SERVO_PIN, YAW_STOP_SPEED + config.yawMoveSpeed, 1400 );
+   unsigned long stop = FindWrite( YAW_SERVO_PIN, YAW_STOP_SPEED, firstMove );
+   CHECK( firstMove > 0 && stop > firstMove );
+   CHECK( FindWrite( YAW_SERVO_PIN, YAW_STOP_SPEED + config.yawMoveSpeed, stop ) > stop );
+   CHECK( turret.barrel.Loaded() < BARREL_CHAMBERS - 1 );
+}
+
+static void TestBarrelEmptyIsAnEventFrame()
+{
+   Start();
+
+   for ( unsigned long time = 100; time < 100 + 7 * 500; time += 500 )
+   {
+      Host::PressButton( time, ok );
+   }
+   RunUntil( 5000 );
+   CHECK_EQUAL( 0, turret.barrel.Loaded() );
+
+   // Once for the last dart and once for the shot after it, and no text
+   const char frame[] = { (char)TELEMETRY_SYNC1, (char)EVENT_SYNC2, 5, EVENT_BARREL_EMPTY, (char)(TELEMETRY_SYNC1 ^ EVENT_SYNC2 ^ 5 ^ EVENT_BARREL_EMPTY) };
+   CHECK( Host::TakeSerialOutput() == std::string( frame, 5 ) + std::string( frame, 5 ) );
+}
+
+static void TestFullRollQueueDoesntCountDarts()
+{
+   Start();
+
+   MotionAxis roll;
+   roll.Attach( &turret.roll );
+   for ( uint8_t i = 0; i < MOTION_QUEUE_SIZE; i++ )
+   {
+      CHECK( roll.PushWait( 100 ) );
+   }
+
+   RecoilLayer recoil;
+   CHECK( FireResult::RollBusy == recoil.FireDarts( turret.barrel, roll, 1, ROLL_STOP_SPEED, config.rollMoveSpeed ) );
+   CHECK_EQUAL( BARREL_CHAMBERS, turret.barrel.Loaded() );
+   CHECK( recoil.IsIdle() );
+
+   // Once there is room the dart is fired and counted
+   roll.Clear();
+   CHECK( FireResult::Fired == recoil.FireDarts( turret.barrel, roll, 1, ROLL_STOP_SPEED, config.rollMoveSpeed ) );
+   CHECK_EQUAL( BARREL_CHAMBERS - 1, turret.barrel.Loaded() );
+   CHECK( !recoil.IsIdle() );
+}
+
+static void TestCalibrationIgnoresHeldOk()
+{
+   Start();
+
+   Host::PressButton( 100, cmd0 );
+   Host::PressButton( 200, cmd9 );
+   Host::PressButton( 300, ok );                     // start on the yaw servo
+   Host::PressButton( 300 + 12 * CALIBRATION_SWEEP_TIME, ok ); // it started turning during the 12th sweep step
+   RunUntil( 5000 );
+   CHECK_EQUAL( TurretCalibration, currentProgramType );
+
+   // Timing the first table entry above where it started turning
+   int speed = Host::ServoValue( YAW_SERVO_PIN );
+   CHECK_EQUAL( YAW_STOP_SPEED + 2 * ROTATION_TABLE_STEP, speed );
+
+   // Holding ok for a second is one mark, not one for every repeat frame
+   Host::PressButton( 6000, ok, 1000 );
+   RunUntil( 8000 );
+   CHECK_EQUAL( speed + ROTATION_TABLE_STEP, Host::ServoValue( YAW_SERVO_PIN ) );
+}
+
+static void Run( void ( *test )() )
+{
+   RunIsolated( [test]()
+   {
+      test();
+      return std::string();
+   } );
+}
+
+int main()
+{
+   Run( TestSetupHomesServos );
+   Run( TestOkFiresOneDart );
+   Run( TestProgramSelection );
+   Run( TestDanceRoutinePlaysToTheEnd );
+   Run( TestHashtagAgainStartsOver );
+   Run( TestRouletteShootsAnywayAndStops );
+   Run( TestYawNeverSteersIntoTheDeadBand );
+   Run( TestConfigConsole );
+   Run( TestHoldingUpJogs );
+   Run( TestHoldingLeftSpeedsUp );
+   Run( TestOkOnlyDropsAimInTurretControl );
+   Run( TestBurstKeepsAiming );
+   Run( TestBarrelEmptyIsAnEventFrame );
+   Run( TestFullRollQueueDoesntCountDarts );
+   Run( TestCalibrationIgnoresHeldOk );
+
+   return TestResult();
+}
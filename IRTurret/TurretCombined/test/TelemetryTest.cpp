@@ -0,0 +1,78 @@
+#include "HostSketch.h"
+#include "TestCheck.h"
+
+// Built with TELEMETRY_ENABLED=1. Runs the sketch for a little over one TELEMETRY_INTERVAL and decodes the
+// TelemetryFrame it sends from the bytes written to Serial, at the offsets documented on TelemetryFrame.
+
+#define FRAME_LENGTH 37
+
+static_assert( sizeof( TelemetryFrame ) == FRAME_LENGTH, "TelemetryFrame layout changed" );
+
+// Little endian value of size bytes at offset
+static unsigned long Read( const std::string& frame, size_t offset, size_t size )
+{
+   unsigned long value = 0;
+   for ( size_t i = 0; i < size; i++ )
+   {
+      value |= (unsigned long)(uint8_t)frame[offset + i] << (8 * i);
+   }
+   return value;
+}
+
+static void TestFrameIsSentEveryInterval()
+{
+   Host::Reset();
+   Host::UseRealMicros( true ); // so the loop times aren't all 0
+   setup();
+
+   Host::PressButton( 100, ok );
+   RunUntil( TELEMETRY_INTERVAL + 500 );
+
+   std::string output = Host::TakeSerialOutput();
+   CHECK_EQUAL( FRAME_LENGTH, output.size() );
+   if ( output.size() != FRAME_LENGTH )
+   {
+      return;
+   }
+
+   uint8_t checksum = 0;
+   for ( size_t i = 0; i < FRAME_LENGTH - 1; i++ )
+   {
+      checksum ^= (uint8_t)output[i];
+   }
+
+   CHECK_EQUAL( TELEMETRY_SYNC1, Read( output, 0, 1 ) );
+   CHECK_EQUAL( TELEMETRY_SYNC2, Read( output, 1, 1 ) );
+   CHECK_EQUAL( FRAME_LENGTH, Read( output, 2, 1 ) );
+   CHECK_EQUAL( TurretControl, Read( output, 3, 1 ) );
+   CHECK_EQUAL( checksum, Read( output, 36, 1 ) );
+
+   // loop() runs every 5ms of the first interval
+   unsigned long loops = Read( output, 4, 2 );
+   CHECK( loops >= TELEMETRY_INTERVAL / 5 - 2 && loops <= TELEMETRY_INTERVAL / 5 + 1 );
+
+   unsigned long loopMin = Read( output, 6, 4 );
+   unsigned long loopMax = Read( output, 10, 4 );
+   unsigned long loopAvg = Read( output, 14, 4 );
+   CHECK( loopMin <= loopAvg && loopAvg <= loopMax );
+   CHECK( Read( output, 22, 4 ) <= Read( output, 18, 4 ) ); // programAvg <= programMax
+   CHECK( Read( output, 18, 4 ) <= loopMax );
+
+   // ok is written to the ROLL servo in the same loop() it is handled in
+   CHECK_EQUAL( 1, Read( output, 26, 2 ) );
+   CHECK( Read( output, 28, 2 ) < 5 );
+   CHECK( Read( output, 30, 2 ) <= Read( output, 28, 2 ) );
+   CHECK( Read( output, 32, 2 ) >= 2 );
+   CHECK_EQUAL( 0, Read( output, 34, 2 ) );
+}
+
+int main()
+{
+   RunIsolated( []()
+   {
+      TestFrameIsSentEveryInterval();
+      return std::string();
+   } );
+
+   return TestResult();
+}
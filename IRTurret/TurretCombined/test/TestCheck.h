@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdio.h>
+#include <functional>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Minimal checks for the host tests. A failed check is printed and counted, and the test carries on so one
+// run shows every failure. main() returns TestResult().
+
+static int testFailures = 0;
+
+#define CHECK( condition ) \
+   do \
+   { \
+      if ( !(condition) ) \
+      { \
+         printf( "%s:%d: CHECK( %s ) failed\n", __FILE__, __LINE__, #condition ); \
+         testFailures++; \
+      } \
+   } while ( 0 )
+
+#define CHECK_EQUAL( expected, actual ) \
+   do \
+   { \
+      long expectedValue = (expected); \
+      long actualValue = (actual); \
+      if ( expectedValue != actualValue ) \
+      { \
+         printf( "%s:%d: CHECK_EQUAL( %s, %s ) failed: %ld != %ld\n", __FILE__, __LINE__, #expected, #actual, \
+                 expectedValue, actualValue ); \
+         testFailures++; \
+      } \
+   } while ( 0 )
+
+// Runs test in a child process, so it starts from the sketch's globals as they were before setup() and
+// whatever it changes (servo headings, the running program, config) is thrown away afterwards. Returns the
+// text test returned. Checks that fail in it are counted here.
+inline std::string RunIsolated( std::function<std::string()> test )
+{
+   int fds[2];
+   if ( pipe( fds ) != 0 )
+   {
+      testFailures++;
+      return "";
+   }
+
+   fflush( stdout );
+   pid_t child = fork();
+   if ( child == 0 )
+   {
+      close( fds[0] );
+      std::string text = test();
+      for ( size_t written = 0; written < text.size(); )
+      {
+         ssize_t count = write( fds[1], text.data() + written, text.size() - written );
+         if ( count <= 0 )
+         {
+            break;
+         }
+         written += count;
+      }
+      fflush( stdout );
+      _exit( testFailures < 255 ? testFailures : 255 );
+   }
+
+   close( fds[1] );
+   std::string text;
+   char buffer[256];
+   ssize_t count;
+   while ( (count = read( fds[0], buffer, sizeof( buffer ) )) > 0 )
+   {
+      text.append( buffer, count );
+   }
+   close( fds[0] );
+
+   int status = 0;
+   waitpid( child, &status, 0 );
+   testFailures += WIFEXITED( status ) ? WEXITSTATUS( status ) : 1;
+   return text;
+}
+
+inline int TestResult()
+{
+   if ( testFailures > 0 )
+   {
+      printf( "%d check(s) failed\n", testFailures );
+      return 1;
+   }
+   printf( "ok\n" );
+   return 0;
+}
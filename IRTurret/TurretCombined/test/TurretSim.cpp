@@ -0,0 +1,324 @@
+#include "HostSketch.h"
+#include <algorithm>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <time.h>
+
+// Runs TurretCombined on the host from a script of remote presses and Serial input, and prints every servo
+// write. See Host Build in README.md for the script format.
+//
+// turret_sim [--writes] [--pty [--speed <factor>]] <script>
+//   --writes: print the servo writes as CSV (time,servo,value) instead of a readable log
+//   --pty:    connect Serial to a pseudo terminal (its name is printed) and run at real time, so a tool on the
+//             other end can talk to the sketch like it would over USB. Runs until the script ends, or forever
+//             if the script has no end line.
+//   --speed:  how many times faster than real time to run with --pty
+
+struct ScriptLine
+{
+   unsigned long time;
+   std::string action;
+   std::string argument;
+   int lineNumber;
+};
+
+struct Button
+{
+   const char* name;
+   uint16_t command;
+};
+
+static const Button buttons[] =
+{
+   { "left", left }, { "right", right }, { "up", up }, { "down", down }, { "ok", ok },
+   { "star", star }, { "hashtag", hashtag },
+   { "0", cmd0 }, { "1", cmd1 }, { "2", cmd2 }, { "3", cmd3 }, { "4", cmd4 },
+   { "5", cmd5 }, { "6", cmd6 }, { "7", cmd7 }, { "8", cmd8 }, { "9", cmd9 }
+};
+
+static const char* ServoName( uint8_t pin )
+{
+   switch ( pin )
+   {
+      case YAW_SERVO_PIN: return "yaw";
+      case PITCH_SERVO_PIN: return "pitch";
+      case ROLL_SERVO_PIN: return "roll";
+      default: return "?";
+   }
+}
+
+static int ServoPin( const std::string& name )
+{
+   if ( name == "yaw" ) return YAW_SERVO_PIN;
+   if ( name == "pitch" ) return PITCH_SERVO_PIN;
+   if ( name == "roll" ) return ROLL_SERVO_PIN;
+   return -1;
+}
+
+static bool FindButton( const std::string& name, uint16_t& command )
+{
+   for ( const Button& button : buttons )
+   {
+      if ( name == button.name )
+      {
+         command = button.command;
+         return true;
+      }
+   }
+   return false;
+}
+
+// Takes what the sketch has written to Serial, with event frames (see EventFrame) moved out of the text into events
+static void TakeSerialOutput( std::string& text, std::vector<uint8_t>& events )
+{
+   std::string output = Host::TakeSerialOutput();
+   for ( size_t i = 0; i < output.size(); i++ )
+   {
+      const uint8_t* frame = (const uint8_t*)output.data() + i;
+      if ( i + sizeof( EventFrame ) <= output.size() && frame[0] == TELEMETRY_SYNC1 && frame[1] == EVENT_SYNC2 &&
+           frame[2] == sizeof( EventFrame ) && (frame[0] ^ frame[1] ^ frame[2] ^ frame[3]) == frame[4] )
+      {
+         events.push_back( frame[3] );
+         i += sizeof( EventFrame ) - 1;
+         continue;
+      }
+      text += output[i];
+   }
+}
+
+static bool ReadScript( const char* path, std::vector<ScriptLine>& script )
+{
+   FILE* file = fopen( path, "r" );
+   if ( file == nullptr )
+   {
+      perror( path );
+      return false;
+   }
+
+   char text[256];
+   int lineNumber = 0;
+   while ( fgets( text, sizeof( text ), file ) != nullptr )
+   {
+      lineNumber++;
+      std::string line = text;
+      line = line.substr( 0, line.find_first_of( "#\r\n" ) );
+
+      char action[32];
+      unsigned long time;
+      int consumed = 0;
+      if ( sscanf( line.c_str(), " %lu %31s %n", &time, action, &consumed ) < 2 )
+      {
+         continue; // blank or comment
+      }
+
+      std::string argument = line.substr( consumed );
+      argument = argument.substr( 0, argument.find_last_not_of( ' ' ) + 1 );
+      ScriptLine scriptLine = { time, action, argument, lineNumber };
+      script.push_back( scriptLine );
+   }
+
+   fclose( file );
+   return true;
+}
+
+// Every millisecond of virtual time takes 1/speed ms of real time
+static void WaitForRealTime( const timespec& start, double speed )
+{
+   double target = millis() / speed / 1000.0;
+   timespec now;
+   clock_gettime( CLOCK_MONOTONIC, &now );
+   double elapsed = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+   if ( target > elapsed )
+   {
+      usleep( (useconds_t)((target - elapsed) * 1e6) );
+   }
+}
+
+static int OpenPty()
+{
+   int master = posix_openpt( O_RDWR | O_NOCTTY );
+   if ( master < 0 || grantpt( master ) != 0 || unlockpt( master ) != 0 )
+   {
+      perror( "pty" );
+      return -1;
+   }
+
+   // Raw like a USB serial port, otherwise the pty echoes what the sketch writes back to it as input
+   termios settings;
+   tcgetattr( master, &settings );
+   cfmakeraw( &settings );
+   tcsetattr( master, TCSANOW, &settings );
+
+   fprintf( stderr, "Serial is on %s\n", ptsname( master ) );
+   return master;
+}
+
+int main( int argc, char** argv )
+{
+   bool csv = false;
+   bool pty = false;
+   double speed = 1;
+   const char* path = nullptr;
+
+   for ( int i = 1; i < argc; i++ )
+   {
+      std::string arg = argv[i];
+      if ( arg == "--writes" )
+      {
+         csv = true;
+      }
+      else if ( arg == "--pty" )
+      {
+         pty = true;
+      }
+      else if ( arg == "--speed" && i + 1 < argc )
+      {
+         speed = atof( argv[++i] );
+      }
+      else
+      {
+         path = argv[i];
+      }
+   }
+
+   std::vector<ScriptLine> script;
+   if ( (path == nullptr && !pty) || (path != nullptr && !ReadScript( path, script )) || speed <= 0 )
+   {
+      fprintf( stderr, "usage: %s [--writes] [--pty [--speed <factor>]] <script>\n", argv[0] );
+      return 2;
+   }
+
+   Host::Reset();
+
+   if ( csv )
+   {
+      printf( "time,servo,value\n" );
+   }
+   Host::OnServoWrite( [csv]( const Host::ServoWrite& write )
+   {
+      printf( csv ? "%lu,%s,%d\n" : "%6lu %-5s %3d\n", write.time, ServoName( write.pin ), write.value );
+   } );
+
+   int master = -1;
+   if ( pty )
+   {
+      master = OpenPty();
+      if ( master < 0 )
+      {
+         return 1;
+      }
+      Host::AttachSerial( master, master );
+   }
+
+   // IR presses go in up front, they are delivered by the virtual clock
+   int failures = 0;
+   bool hasEnd = false;
+   for ( const ScriptLine& line : script )
+   {
+      uint16_t command;
+      if ( line.action == "end" )
+      {
+         hasEnd = true;
+      }
+      else if ( FindButton( line.action, command ) )
+      {
+         unsigned long hold = 0;
+         sscanf( line.argument.c_str(), "hold %lu", &hold );
+         Host::PressButton( line.time, command, hold );
+      }
+      else if ( line.action != "serial" && line.action != "expect" )
+      {
+         fprintf( stderr, "%s:%d: unknown action %s\n", path, line.lineNumber, line.action.c_str() );
+         return 2;
+      }
+   }
+
+   timespec start;
+   clock_gettime( CLOCK_MONOTONIC, &start );
+
+   setup();
+
+   size_t next = 0;
+   std::string serialOutput;
+   std::vector<uint8_t> events;
+   while ( true )
+   {
+      // Serial input and checks happen between loops, at the first loop at or after their time
+      while ( next < script.size() && (long)(millis() - script[next].time) >= 0 )
+      {
+         const ScriptLine& line = script[next++];
+         TakeSerialOutput( serialOutput, events );
+
+         if ( line.action == "serial" )
+         {
+            Host::SerialInput( line.argument + "\n" );
+         }
+         else if ( line.action == "expect" )
+         {
+            char what[16];
+            int value = 0;
+            bool passed;
+
+            if ( sscanf( line.argument.c_str(), "%15s %d", what, &value ) == 2 && ServoPin( what ) >= 0 )
+            {
+               passed = Host::ServoValue( ServoPin( what ) ) == value;
+            }
+            else if ( line.argument.compare( 0, 7, "serial " ) == 0 )
+            {
+               passed = serialOutput.find( line.argument.substr( 7 ) ) != std::string::npos;
+            }
+            else if ( sscanf( line.argument.c_str(), "event %d", &value ) == 1 )
+            {
+               passed = std::find( events.begin(), events.end(), value ) != events.end();
+            }
+            else if ( line.argument == "idle" || line.argument == "busy" )
+            {
+               passed = CanShutdownProgram() == (line.argument == "idle");
+            }
+            else
+            {
+               passed = false;
+            }
+
+            if ( !passed )
+            {
+               fprintf( stderr, "%s:%d: expect %s failed at %lums\n", path, line.lineNumber, line.argument.c_str(), millis() );
+               failures++;
+            }
+         }
+         else if ( line.action == "end" )
+         {
+            TakeSerialOutput( serialOutput, events );
+            if ( !csv && !serialOutput.empty() )
+            {
+               printf( "serial:\n%s", serialOutput.c_str() );
+            }
+            if ( !csv && !events.empty() )
+            {
+               printf( "events:" );
+               for ( uint8_t event : events )
+               {
+                  printf( " %d", event );
+               }
+               printf( "\n" );
+            }
+            return failures > 0 ? 1 : 0;
+         }
+      }
+
+      loop();
+
+      if ( pty )
+      {
+         WaitForRealTime( start, speed );
+      }
+      else if ( !hasEnd && next >= script.size() )
+      {
+         break;
+      }
+   }
+
+   return failures > 0 ? 1 : 0;
+}
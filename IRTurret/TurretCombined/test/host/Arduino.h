@@ -0,0 +1,145 @@
+#pragma once
+
+// Stand-in for the Arduino core, so TurretCombined can be built and run on a Linux host (see Host Build in README.md).
+// Time is virtual: millis() only moves when delay() or Host::AdvanceTime() is called, so a sketch runs
+// thousands of times faster than on the board and always does the same thing.
+
+// Standard headers are pulled in before min/max/abs are defined as macros like the AVR core does,
+// otherwise the macros break them
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define LED_BUILTIN 13
+#define NUM_DIGITAL_PINS 20 // Like an Uno
+#define A0 14
+
+#define DEC 10
+#define HEX 16
+
+#define min( a, b ) ((a) < (b) ? (a) : (b))
+#define max( a, b ) ((a) > (b) ? (a) : (b))
+#define abs( x ) ((x) > 0 ? (x) : -(x))
+#define constrain( x, low, high ) ((x) < (low) ? (low) : ((x) > (high) ? (high) : (x)))
+
+typedef uint8_t byte;
+
+// Flash is ordinary memory on the host
+#define PROGMEM
+#define PSTR( s ) (s)
+#define pgm_read_byte( address ) (*(const uint8_t*)(address))
+#define pgm_read_word( address ) (*(const uint16_t*)(address))
+#define memcpy_P memcpy
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strchr_P strchr
+#define strlen_P strlen
+
+class __FlashStringHelper;
+#define F( s ) (reinterpret_cast<const __FlashStringHelper*>( s ))
+
+unsigned long millis();
+unsigned long micros();
+void delay( unsigned long ms );
+void delayMicroseconds( unsigned int us );
+
+long random( long howBig );
+long random( long howSmall, long howBig );
+void randomSeed( unsigned long seed );
+long map( long x, long inMin, long inMax, long outMin, long outMax );
+
+inline void pinMode( uint8_t, uint8_t ) {}
+inline void digitalWrite( uint8_t, uint8_t ) {}
+inline int digitalRead( uint8_t ) { return LOW; }
+inline int analogRead( uint8_t ) { return 0; }
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+// Serial port. Bytes the sketch writes are kept for the test to look at, and bytes for the sketch to read
+// are queued by the test. It can also be connected to file descriptors (e.g. a pty) with Host::AttachSerial().
+class HardwareSerial
+{
+public:
+   void begin( unsigned long ) {}
+   int available();
+   int read();
+   int availableForWrite() { return 64; }
+
+   size_t write( uint8_t c );
+   size_t write( const uint8_t* buffer, size_t size );
+
+   size_t print( const char* text );
+   size_t print( const __FlashStringHelper* text ) { return print( reinterpret_cast<const char*>( text ) ); }
+   size_t print( char c ) { return write( (uint8_t)c ); }
+   size_t print( unsigned char value, int base = DEC ) { return print( (unsigned long)value, base ); }
+   size_t print( int value, int base = DEC ) { return print( (long)value, base ); }
+   size_t print( unsigned int value, int base = DEC ) { return print( (unsigned long)value, base ); }
+   size_t print( long value, int base = DEC );
+   size_t print( unsigned long value, int base = DEC );
+
+   size_t println() { return print( "\r\n" ); }
+   template<typename T>
+   size_t println( T value ) { return print( value ) + println(); }
+   template<typename T>
+   size_t println( T value, int base ) { return print( value, base ) + println(); }
+};
+
+extern HardwareSerial Serial;
+
+namespace Host
+{
+   // Puts the clock back to 0 and empties the Serial buffers, the servo log, scheduled IR frames and EEPROM
+   void Reset();
+
+   // Makes micros() read the machine's monotonic clock, so code that times itself with it (e.g. DANCE_BENCHMARK)
+   // measures how long it really took. millis() and delay() stay on virtual time.
+   void UseRealMicros( bool useRealMicros );
+
+   // Moves the clock forward, delivering IR frames that are due on the way like the receive interrupt would
+   void AdvanceTime( unsigned long ms );
+
+   // A value written to a servo
+   struct ServoWrite
+   {
+      unsigned long time; // millis()
+      uint8_t pin;
+      uint8_t value;
+   };
+
+   // Every servo write since the last Reset(), oldest first
+   const std::vector<ServoWrite>& ServoWrites();
+
+   // Last value written to the servo on pin, -1 if it hasn't been written
+   int ServoValue( uint8_t pin );
+
+   // Called for every servo write, e.g. to print them as they happen
+   void OnServoWrite( std::function<void( const ServoWrite& )> callback );
+
+   // Queues an NEC frame to be received at time (millis)
+   void ScheduleIr( unsigned long time, uint16_t command, bool isRepeat );
+
+   // Queues a button press on the remote at time. If it is held for longer than the ~110ms the first frame
+   // takes, repeat frames are sent every 110ms like a real NEC remote.
+   void PressButton( unsigned long time, uint16_t command, unsigned long holdTime = 0 );
+
+   // Adds bytes for the sketch to read from Serial
+   void SerialInput( const std::string& bytes );
+
+   // Takes everything the sketch has written to Serial so far
+   std::string TakeSerialOutput();
+
+   // Reads Serial input from inFd and writes Serial output to outFd instead of the buffers above
+   void AttachSerial( int inFd, int outFd );
+}
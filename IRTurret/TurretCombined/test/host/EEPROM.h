@@ -0,0 +1,54 @@
+#pragma once
+
+#include <Arduino.h>
+
+#define HOST_EEPROM_SIZE 1024 // Same as an ATmega328P
+
+// Stand-in for the EEPROM library backed by memory. It starts out erased (0xFF) after Host::Reset().
+class EEPROMClass
+{
+public:
+   uint8_t read( int address )
+   {
+      return bytes[address];
+   }
+
+   void write( int address, uint8_t value )
+   {
+      bytes[address] = value;
+   }
+
+   void update( int address, uint8_t value )
+   {
+      write( address, value );
+   }
+
+   uint16_t length()
+   {
+      return HOST_EEPROM_SIZE;
+   }
+
+   template<typename T>
+   T& get( int address, T& value )
+   {
+      memcpy( &value, bytes + address, sizeof( T ) );
+      return value;
+   }
+
+   template<typename T>
+   const T& put( int address, const T& value )
+   {
+      memcpy( bytes + address, &value, sizeof( T ) );
+      return value;
+   }
+
+   void Erase()
+   {
+      memset( bytes, 0xFF, sizeof( bytes ) );
+   }
+
+private:
+   uint8_t bytes[HOST_EEPROM_SIZE];
+};
+
+extern EEPROMClass EEPROM;
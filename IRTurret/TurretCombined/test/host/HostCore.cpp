@@ -0,0 +1,293 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <IRremote.hpp>
+#include <Servo.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+HardwareSerial Serial;
+EEPROMClass EEPROM;
+IRrecv IrReceiver;
+
+namespace
+{
+   struct ScheduledIr
+   {
+      unsigned long time;
+      uint16_t command;
+      bool isRepeat;
+   };
+
+   unsigned long nowMicros = 0;
+   bool realMicros = false; // micros() reads the machine's clock instead of the virtual one
+   unsigned long randomState = 1;
+
+   std::vector<Host::ServoWrite> servoWrites;
+   int servoValues[256];
+   std::function<void( const Host::ServoWrite& )> servoCallback;
+
+   std::vector<ScheduledIr> scheduledIr; // Sorted by time
+   bool deliveringIr = false;
+
+   std::deque<uint8_t> serialInput;
+   std::string serialOutput;
+   int serialInFd = -1;
+   int serialOutFd = -1;
+
+   void ReadSerialFd()
+   {
+      if ( serialInFd < 0 )
+      {
+         return;
+      }
+
+      uint8_t buffer[64];
+      ssize_t count = ::read( serialInFd, buffer, sizeof( buffer ) );
+      if ( count > 0 )
+      {
+         serialInput.insert( serialInput.end(), buffer, buffer + count );
+      }
+   }
+}
+
+unsigned long millis()
+{
+   return nowMicros / 1000;
+}
+
+unsigned long micros()
+{
+   if ( realMicros )
+   {
+      timespec now;
+      clock_gettime( CLOCK_MONOTONIC, &now );
+      return now.tv_sec * 1000000UL + now.tv_nsec / 1000;
+   }
+
+   return nowMicros;
+}
+
+void delay( unsigned long ms )
+{
+   Host::AdvanceTime( ms );
+}
+
+void delayMicroseconds( unsigned int us )
+{
+   nowMicros += us;
+}
+
+// Same sequence on every run, so roulette plays out the same way every time
+long random( long howBig )
+{
+   if ( howBig <= 0 )
+   {
+      return 0;
+   }
+
+   randomState = randomState * 1103515245UL + 12345UL;
+   return (long)((randomState >> 16) & 0x7FFF) % howBig;
+}
+
+long random( long howSmall, long howBig )
+{
+   return howSmall >= howBig ? howSmall : howSmall + random( howBig - howSmall );
+}
+
+void randomSeed( unsigned long seed )
+{
+   randomState = seed != 0 ? seed : 1;
+}
+
+long map( long x, long inMin, long inMax, long outMin, long outMax )
+{
+   return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+int HardwareSerial::available()
+{
+   ReadSerialFd();
+   return serialInput.size();
+}
+
+int HardwareSerial::read()
+{
+   ReadSerialFd();
+   if ( serialInput.empty() )
+   {
+      return -1;
+   }
+
+   uint8_t c = serialInput.front();
+   serialInput.pop_front();
+   return c;
+}
+
+size_t HardwareSerial::write( uint8_t c )
+{
+   return write( &c, 1 );
+}
+
+size_t HardwareSerial::write( const uint8_t* buffer, size_t size )
+{
+   if ( serialOutFd >= 0 )
+   {
+      size_t written = 0;
+      while ( written < size )
+      {
+         ssize_t count = ::write( serialOutFd, buffer + written, size - written );
+         if ( count < 0 && errno != EAGAIN && errno != EINTR )
+         {
+            break;
+         }
+         written += count > 0 ? count : 0;
+      }
+   }
+   else
+   {
+      serialOutput.append( (const char*)buffer, size );
+   }
+   return size;
+}
+
+size_t HardwareSerial::print( const char* text )
+{
+   return write( (const uint8_t*)text, strlen( text ) );
+}
+
+size_t HardwareSerial::print( long value, int base )
+{
+   if ( value < 0 && base == DEC )
+   {
+      return print( '-' ) + print( (unsigned long)-value, base );
+   }
+   return print( (unsigned long)value, base );
+}
+
+size_t HardwareSerial::print( unsigned long value, int base )
+{
+   char digits[sizeof( unsigned long ) * 8 + 1];
+   char* end = digits + sizeof( digits ) - 1;
+   *end = '\0';
+
+   char* start = end;
+   do
+   {
+      uint8_t digit = value % base;
+      *--start = digit < 10 ? '0' + digit : 'A' + digit - 10;
+      value /= base;
+   } while ( value > 0 );
+
+   return print( start );
+}
+
+namespace Host
+{
+   void Reset()
+   {
+      nowMicros = 0;
+      realMicros = false;
+      randomState = 1;
+      servoWrites.clear();
+      memset( servoValues, 0xFF, sizeof( servoValues ) );
+      scheduledIr.clear();
+      serialInput.clear();
+      serialOutput.clear();
+      EEPROM.Erase();
+   }
+
+   void UseRealMicros( bool useRealMicros )
+   {
+      realMicros = useRealMicros;
+   }
+
+   void AdvanceTime( unsigned long ms )
+   {
+      unsigned long end = nowMicros + ms * 1000;
+
+      // Frames are delivered at the time they finish arriving, as if the receive interrupt had run in the middle
+      // of the delay. A program that is delivering a frame doesn't get another one until it is done.
+      while ( !deliveringIr && !scheduledIr.empty() && scheduledIr.front().time * 1000 <= end )
+      {
+         ScheduledIr frame = scheduledIr.front();
+         scheduledIr.erase( scheduledIr.begin() );
+
+         nowMicros = max( nowMicros, frame.time * 1000 );
+         deliveringIr = true;
+         IrReceiver.HostReceive( frame.command, frame.isRepeat );
+         deliveringIr = false;
+      }
+
+      nowMicros = end;
+   }
+
+   void RecordServoWrite( uint8_t pin, uint8_t value )
+   {
+      ServoWrite write = { millis(), pin, value };
+      servoWrites.push_back( write );
+      servoValues[pin] = value;
+
+      if ( servoCallback )
+      {
+         servoCallback( write );
+      }
+   }
+
+   const std::vector<ServoWrite>& ServoWrites()
+   {
+      return servoWrites;
+   }
+
+   int ServoValue( uint8_t pin )
+   {
+      return servoValues[pin];
+   }
+
+   void OnServoWrite( std::function<void( const ServoWrite& )> callback )
+   {
+      servoCallback = callback;
+   }
+
+   void ScheduleIr( unsigned long time, uint16_t command, bool isRepeat )
+   {
+      ScheduledIr frame = { time, command, isRepeat };
+      auto position = std::upper_bound( scheduledIr.begin(), scheduledIr.end(), frame,
+         []( const ScheduledIr& a, const ScheduledIr& b ) { return a.time < b.time; } );
+      scheduledIr.insert( position, frame );
+   }
+
+   void PressButton( unsigned long time, uint16_t command, unsigned long holdTime )
+   {
+      // An NEC frame takes ~68ms to send and repeat frames follow every ~110ms after the start of the first one
+      ScheduleIr( time + 68, command, false );
+      for ( unsigned long repeat = 110; repeat < holdTime; repeat += 110 )
+      {
+         ScheduleIr( time + repeat + 12, command, true );
+      }
+   }
+
+   void SerialInput( const std::string& bytes )
+   {
+      serialInput.insert( serialInput.end(), bytes.begin(), bytes.end() );
+   }
+
+   std::string TakeSerialOutput()
+   {
+      std::string output;
+      output.swap( serialOutput );
+      return output;
+   }
+
+   void AttachSerial( int inFd, int outFd )
+   {
+      serialInFd = inFd;
+      serialOutFd = outFd;
+
+      if ( inFd >= 0 )
+      {
+         fcntl( inFd, F_SETFL, fcntl( inFd, F_GETFL ) | O_NONBLOCK );
+      }
+   }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Stand-in for the parts of IRremote that TurretCombined uses. Frames are scheduled with
+// Host::ScheduleIr()/Host::PressButton() and handed to the receive complete callback as NEC.
+
+#define ENABLE_LED_FEEDBACK true
+#define DISABLE_LED_FEEDBACK false
+#define IRDATA_FLAGS_IS_REPEAT 0x01
+
+enum decode_type_t
+{
+   UNKNOWN = 0,
+   NEC = 8
+};
+
+struct IRData
+{
+   decode_type_t protocol;
+   uint16_t address;
+   uint16_t command;
+   uint8_t flags;
+};
+
+class IRrecv
+{
+public:
+   IRData decodedIRData = {};
+
+   void begin( uint_fast8_t, bool = false ) {}
+
+   void registerReceiveCompleteCallback( void ( *callback )() )
+   {
+      receiveCompleteCallback = callback;
+   }
+
+   bool decode()
+   {
+      return decodedIRData.protocol != UNKNOWN;
+   }
+
+   void resume() {}
+
+   // Host only: receives a frame as if it had just come in
+   void HostReceive( uint16_t command, bool isRepeat )
+   {
+      decodedIRData.protocol = NEC;
+      decodedIRData.address = 0;
+      decodedIRData.command = command;
+      decodedIRData.flags = isRepeat ? IRDATA_FLAGS_IS_REPEAT : 0;
+
+      if ( receiveCompleteCallback != nullptr )
+      {
+         receiveCompleteCallback();
+      }
+   }
+
+private:
+   void ( *receiveCompleteCallback )() = nullptr;
+};
+
+extern IRrecv IrReceiver;
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <Arduino.h>
+
+namespace Host
+{
+   void RecordServoWrite( uint8_t pin, uint8_t value );
+}
+
+// Stand-in for the Servo library that records every write (see Host::ServoWrites())
+class Servo
+{
+public:
+   uint8_t attach( int servoPin )
+   {
+      pin = servoPin;
+      return 0;
+   }
+
+   void detach()
+   {
+      pin = -1;
+   }
+
+   bool attached()
+   {
+      return pin >= 0;
+   }
+
+   void write( int value )
+   {
+      angle = constrain( value, 0, 180 );
+      if ( pin >= 0 )
+      {
+         Host::RecordServoWrite( pin, angle );
+      }
+   }
+
+   int read()
+   {
+      return angle;
+   }
+
+private:
+   int pin = -1;
+   int angle = 90;
+};
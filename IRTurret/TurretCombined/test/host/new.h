@@ -0,0 +1,4 @@
+#pragma once
+
+// The AVR core has placement new in <new.h>
+#include <new>